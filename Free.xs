@@ -9,6 +9,9 @@
 #include "cbor_free_boolean.h"
 #include "cbor_free_encode.h"
 #include "cbor_free_decode.h"
+#include "cbor_free_iov.h"
+#include "cbor_free_typedarray.h"
+#include "cbor_free_utf8.h"
 
 #define _PACKAGE "CBOR::Free"
 
@@ -16,6 +19,18 @@
 #define PRESERVE_REFS_OPT       "preserve_references"
 #define SCALAR_REFS_OPT         "scalar_references"
 #define STRING_ENCODE_MODE_OPT  "string_encode_mode"
+#define SIZE_HINT_OPT           "size_hint"
+#define CHUNK_SIZE_OPT          "chunk_size"
+#define COMPACT_FLOATS_OPT      "compact_floats"
+#define MAX_DEPTH_OPT           "max_depth"
+#define INDEFINITE_MAGIC_OPT    "indefinite_magic"
+#define CONVERT_BLESSED_OPT     "convert_blessed"
+#define FREEZE_OBJECTS_OPT      "freeze_objects"
+#define STRINGREFS_OPT          "stringrefs"
+#define LENGTH_PREFIX_OPT       "length_prefix"
+#define IOV_THRESHOLD_OPT       "iov_threshold"
+#define INTEGER_KEYS_OPT        "integer_keys"
+#define COLUMNAR_OPT            "columnar"
 
 #define UNUSED(x) (void)(x)
 
@@ -24,6 +39,7 @@ const char* const cbf_string_encode_mode_options[] = {
     "encode_text",
     "as_text",
     "as_binary",
+    "auto",
 };
 
 HV *cbf_stash = NULL;
@@ -32,6 +48,7 @@ SV* _seqdecode_get( pTHX_ seqdecode_ctx* seqdecode) {
     decode_ctx* decode_state = seqdecode->decode_state;
 
     decode_state->curbyte = decode_state->start;
+    decode_state->stringrefs = NULL;
 
     if (decode_state->flags & CBF_FLAG_PRESERVE_REFERENCES) {
         reset_reflist_if_needed(aTHX_ decode_state);
@@ -90,6 +107,20 @@ static inline SV* _seq_set_string_decode( pTHX_ SV* self, enum cbf_string_decode
     return (GIMME_V == G_VOID) ? NULL : newSVsv(self);
 }
 
+static inline SV* _set_typed_array_decode( pTHX_ SV* self, enum cbf_typed_array_decode_mode new_setting ) {
+    decode_ctx* decode_state = (decode_ctx*) sv_to_ptr(aTHX_ self);
+    decode_state->typed_array_decode_mode = new_setting;
+
+    return (GIMME_V == G_VOID) ? NULL : newSVsv(self);
+}
+
+static inline SV* _seq_set_typed_array_decode( pTHX_ SV* self, enum cbf_typed_array_decode_mode new_setting ) {
+    seqdecode_ctx* seqdecode = (seqdecode_ctx*) sv_to_ptr(aTHX_ self);
+    seqdecode->decode_state->typed_array_decode_mode = new_setting;
+
+    return (GIMME_V == G_VOID) ? NULL : newSVsv(self);
+}
+
 static inline bool _handle_preserve_references( pTHX_ decode_ctx* decode_state, SV* new_setting ) {
     bool RETVAL = _handle_flag_call( aTHX_ decode_state, new_setting, CBF_FLAG_PRESERVE_REFERENCES );
 
@@ -136,9 +167,216 @@ static inline void _set_tag_handlers( pTHX_ decode_ctx* decode_state, U8 items_l
     }
 }
 
+static void _parse_encode_opts( pTHX_ SV** args, I32 argslen, encode_ctx* encode_state ) {
+    I32 i;
+    char* optname;
+    SV* opt_sv;
+
+    for (i=0; i<argslen; i++) {
+        if (i % 2) continue;
+
+        opt_sv = args[i];
+        if (!SvPOK(opt_sv)) continue;
+
+        optname = SvPVX(opt_sv);
+
+        if (strEQ(optname, STRING_ENCODE_MODE_OPT)) {
+            ++i;
+
+            if (i<argslen) {
+                SV* opt = args[i];
+
+                if (SvOK(opt)) {
+                    char* optstr = SvPV_nolen(opt);
+
+                    U8 i;
+                    for (i=0; i<CBF_STRING_ENCODE__LIMIT; i++) {
+                        if (strEQ(optstr, cbf_string_encode_mode_options[i])) {
+                            encode_state->string_encode_mode = i;
+                            break;
+                        }
+                    }
+
+                    if (i == CBF_STRING_ENCODE__LIMIT) {
+                        croak("Invalid " STRING_ENCODE_MODE_OPT ": %s", optstr);
+                    }
+                }
+
+            }
+        }
+
+        else if (strEQ(optname, CANONICAL_OPT)) {
+            ++i;
+            encode_state->is_canonical = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, PRESERVE_REFS_OPT)) {
+            ++i;
+            encode_state->preserve_references = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, SCALAR_REFS_OPT)) {
+            ++i;
+            encode_state->encode_scalar_refs = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, COMPACT_FLOATS_OPT)) {
+            ++i;
+            encode_state->compact_floats = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, INDEFINITE_MAGIC_OPT)) {
+            ++i;
+            encode_state->indefinite_magic = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, CONVERT_BLESSED_OPT)) {
+            ++i;
+            encode_state->convert_blessed = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, FREEZE_OBJECTS_OPT)) {
+            ++i;
+            encode_state->freeze_objects = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, STRINGREFS_OPT)) {
+            ++i;
+            encode_state->stringrefs = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, INTEGER_KEYS_OPT)) {
+            ++i;
+            encode_state->integer_keys = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, COLUMNAR_OPT)) {
+            ++i;
+            encode_state->columnar = (i<argslen && SvTRUE(args[i]));
+        }
+
+        else if (strEQ(optname, MAX_DEPTH_OPT)) {
+            ++i;
+            encode_state->max_depth = (i<argslen && SvOK(args[i])) ? SvUV(args[i]) : MAX_ENCODE_RECURSE;
+        }
+
+        else if (strEQ(optname, SIZE_HINT_OPT)) {
+            ++i;
+            encode_state->size_hint = (i<argslen && SvOK(args[i])) ? SvUV(args[i]) : 0;
+        }
+
+        else if (strEQ(optname, CHUNK_SIZE_OPT)) {
+            ++i;
+
+            if (i<argslen && SvOK(args[i])) {
+                encode_state->chunk_size = SvUV(args[i]);
+
+                if (!encode_state->chunk_size) {
+                    croak("Invalid " CHUNK_SIZE_OPT ": %" SVf, SVfARG(args[i]));
+                }
+            }
+        }
+
+        else if (strEQ(optname, LENGTH_PREFIX_OPT)) {
+            ++i;
+
+            UV width = (i<argslen && SvOK(args[i])) ? SvUV(args[i]) : 0;
+
+            switch (width) {
+                case 0: case 1: case 2: case 4: case 8:
+                    encode_state->length_prefix = width;
+                    break;
+
+                default:
+                    croak("Invalid " LENGTH_PREFIX_OPT ": %" SVf " (must be 1, 2, 4, or 8)", SVfARG(args[i]));
+            }
+        }
+
+        else if (strEQ(optname, IOV_THRESHOLD_OPT)) {
+            ++i;
+
+            if (i<argslen && SvOK(args[i])) {
+                encode_state->iov_threshold = SvUV(args[i]);
+
+                if (!encode_state->iov_threshold) {
+                    croak("Invalid " IOV_THRESHOLD_OPT ": %" SVf, SVfARG(args[i]));
+                }
+            }
+            else {
+                encode_state->iov_threshold = ENCODE_IOV_THRESHOLD;
+            }
+        }
+
+        else {
+            warn("Invalid option: %s", optname);
+        }
+    }
+}
+
+// Encodes value, then hands off the encode buffer to a new SV.
+// The encode_state’s buffer is NULL afterward.
+static SV* _encode_to_new_sv( pTHX_ SV* value, encode_ctx* encode_state ) {
+    cbf_encode(aTHX_ value, encode_state, NULL);
+
+    cbf_encode_ctx_free_reftracker( encode_state );
+
+    return cbf_encode_ctx_buffer_to_sv( aTHX_ encode_state );
+}
+
+// Like _encode_to_new_sv() but for encode_sequence(). In list context
+// this also returns a reference to an array of the items’ offsets.
+static U8 _encode_sequence_to_stack( pTHX_ SV* values, encode_ctx* encode_state, SV** stack ) {
+    SvGETMAGIC(values);
+
+    if (!SvROK(values) || SVt_PVAV != SvTYPE(SvRV(values))) {
+        cbf_encode_ctx_free_all( encode_state );
+        croak("encode_sequence() needs an array reference!");
+    }
+
+    AV* offsets = (GIMME_V == G_ARRAY) ? (AV*) sv_2mortal( (SV*) newAV() ) : NULL;
+
+    cbf_encode_sequence(aTHX_ (AV*) SvRV(values), encode_state, offsets, NULL);
+
+    cbf_encode_ctx_free_reftracker( encode_state );
+
+    stack[0] = sv_2mortal( cbf_encode_ctx_buffer_to_sv( aTHX_ encode_state ) );
+
+    if (!offsets) return 1;
+
+    stack[1] = sv_2mortal( newRV_inc( (SV*) offsets ) );
+
+    return 2;
+}
+
+// Wraps encode_iov()’s segments in a CBOR::Free::IOV instance.
+static SV* _iov_to_object( pTHX_ AV* segments ) {
+    return sv_bless( newRV_noinc( (SV*) segments ), gv_stashpv(IOV_CLASS, GV_ADD) );
+}
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 
+// Marks a persistent encode context as in use until the current scope
+// ends (including via an exception), or croaks if it’s already in use.
+// This also keeps the object alive that long since Perl code that
+// runs mid-encode could otherwise free it.
+static void _release_encoder( pTHX_ void *encode_state ) {
+    ((encode_ctx *) encode_state)->in_use = false;
+}
+
+static void _claim_encoder( pTHX_ SV *self, encode_ctx *encode_state ) {
+    if (encode_state->in_use) {
+        croak("%s is busy!", sv_reftype(SvRV(self), TRUE));
+    }
+
+    // The savestack unwinds in reverse, so the release precedes
+    // the object’s (possible) destruction.
+    SAVEFREESV( SvREFCNT_inc_simple_NN(SvRV(self)) );
+    SAVEDESTRUCTOR_X( _release_encoder, encode_state );
+
+    encode_state->in_use = true;
+}
+
 MODULE = CBOR::Free           PACKAGE = CBOR::Free
 
 PROTOTYPES: DISABLE
@@ -151,89 +389,128 @@ BOOT:
 SV *
 encode( SV * value, ... )
     CODE:
-        uint8_t encode_state_flags = 0;
-        enum cbf_string_encode_mode string_encode_mode = CBF_STRING_ENCODE_SV;
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
 
-        U8 i;
-        char* optname;
-        SV* opt_sv;
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &encode_state );
 
-        for (i=1; i<items; i++) {
-            if (!(i % 2)) continue;
+        cbf_encode_ctx_prepare( &encode_state, cbf_encode_ctx_initial_buflen(&encode_state) );
 
-            opt_sv = ST(i);
-            if (!SvPOK(opt_sv)) continue;
+        RETVAL = _encode_to_new_sv( aTHX_ value, &encode_state );
 
-            optname = SvPVX(opt_sv);
+        cbf_encode_ctx_free_all( &encode_state );
+
+    OUTPUT:
+        RETVAL
 
-            if (strEQ(optname, STRING_ENCODE_MODE_OPT)) {
-                ++i;
 
-                if (i<items) {
-                    SV* opt = ST(i);
+void
+encode_sequence( SV * values, ... )
+    PPCODE:
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
 
-                    if (SvOK(opt)) {
-                        char* optstr = SvPV_nolen(opt);
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &encode_state );
 
-                        U8 i;
-                        for (i=0; i<CBF_STRING_ENCODE__LIMIT; i++) {
-                            if (strEQ(optstr, cbf_string_encode_mode_options[i])) {
-                                string_encode_mode = i;
-                                break;
-                            }
-                        }
+        cbf_encode_ctx_prepare( &encode_state, cbf_encode_ctx_initial_buflen(&encode_state) );
 
-                        if (i == CBF_STRING_ENCODE__LIMIT) {
-                            croak("Invalid " STRING_ENCODE_MODE_OPT ": %s", optstr);
-                        }
-                    }
+        EXTEND(SP, 2);
+        U8 count = _encode_sequence_to_stack( aTHX_ values, &encode_state, &ST(0) );
 
-                }
-            }
+        cbf_encode_ctx_free_all( &encode_state );
 
-            else if (strEQ(optname, CANONICAL_OPT)) {
-                ++i;
-                if (i<items && SvTRUE(ST(i))) {
-                    encode_state_flags |= ENCODE_FLAG_CANONICAL;
-                }
-            }
+        XSRETURN(count);
 
-            else if (strEQ(optname, PRESERVE_REFS_OPT)) {
-                ++i;
-                if (i<items && SvTRUE(ST(i))) {
-                    encode_state_flags |= ENCODE_FLAG_PRESERVE_REFS;
-                }
-            }
 
-            else if (strEQ(optname, SCALAR_REFS_OPT)) {
-                ++i;
-                if (i<items && SvTRUE(ST(i))) {
-                    encode_state_flags |= ENCODE_FLAG_SCALAR_REFS;
-                }
-            }
+UV
+encode_to_fh( SV * fh, SV * value, ... )
+    CODE:
+        PerlIO* output_fh = IoOFP( sv_2io(fh) );
 
-            else {
-                warn("Invalid option: %s", optname);
-            }
+        if (!output_fh) {
+            croak("Filehandle is not open for writing!");
         }
 
-        encode_ctx encode_state = cbf_encode_ctx_create(encode_state_flags, string_encode_mode);
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
 
-        RETVAL = newSV(0);
+        _parse_encode_opts( aTHX_ &ST(2), items - 2, &encode_state );
 
-        cbf_encode(aTHX_ value, &encode_state, RETVAL);
+        encode_state.output_fh = output_fh;
 
-        cbf_encode_ctx_free_reftracker( &encode_state );
+        RETVAL = cbf_encode_to_output( aTHX_ value, &encode_state );
 
-        // Don’t use newSVpvn here because that will copy the string.
-        // Instead, create a new SV and manually assign its pieces.
-        // This follows the example from ext/POSIX/POSIX.xs:
+    OUTPUT:
+        RETVAL
+
+
+UV
+encode_into( SV * output, SV * value, ... )
+    CODE:
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
 
-        SvUPGRADE(RETVAL, SVt_PV);
-        SvPV_set(RETVAL, encode_state.buffer);
-        SvPOK_on(RETVAL);
-        SvCUR_set(RETVAL, encode_state.len - 1);
-        SvLEN_set(RETVAL, encode_state.buflen);
+        _parse_encode_opts( aTHX_ &ST(2), items - 2, &encode_state );
+
+        RETVAL = cbf_encode_into( aTHX_ value, &encode_state, output );
+
+        cbf_encode_ctx_free_all( &encode_state );
+
+    OUTPUT:
+        RETVAL
+
+
+UV
+encoded_length( SV * value, ... )
+    CODE:
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
+
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &encode_state );
+
+        RETVAL = cbf_encoded_length( aTHX_ value, &encode_state );
+
+        cbf_encode_ctx_free_all( &encode_state );
+
+    OUTPUT:
+        RETVAL
+
+
+SV *
+encode_iov( SV * value, ... )
+    CODE:
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
+
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &encode_state );
+
+        AV *segments = cbf_encode_iov( aTHX_ value, &encode_state );
+
+        cbf_encode_ctx_free_all( &encode_state );
+
+        RETVAL = _iov_to_object( aTHX_ segments );
+
+    OUTPUT:
+        RETVAL
+
+
+UV
+encode_to_cb( SV * cb, SV * value, ... )
+    CODE:
+        SvGETMAGIC(cb);
+
+        if (!SvROK(cb) || SVt_PVCV != SvTYPE(SvRV(cb))) {
+            croak("Callback must be a code reference!");
+        }
+
+        encode_ctx encode_state;
+        cbf_encode_ctx_init( &encode_state, 0, CBF_STRING_ENCODE_SV );
+
+        _parse_encode_opts( aTHX_ &ST(2), items - 2, &encode_state );
+
+        encode_state.output_cb = cb;
+
+        RETVAL = cbf_encode_to_output( aTHX_ value, &encode_state );
 
     OUTPUT:
         RETVAL
@@ -247,6 +524,296 @@ decode( SV *cbor )
     OUTPUT:
         RETVAL
 
+const char *
+_string_kernel()
+    CODE:
+        RETVAL = cbf_string_kernel_name();
+
+    OUTPUT:
+        RETVAL
+
+bool
+_set_string_kernel( const char *name )
+    CODE:
+        RETVAL = cbf_set_string_kernel(name);
+
+    OUTPUT:
+        RETVAL
+
+const char *
+_byteswap_kernel()
+    CODE:
+        RETVAL = cbf_byteswap_kernel_name();
+
+    OUTPUT:
+        RETVAL
+
+bool
+_set_byteswap_kernel( const char *name )
+    CODE:
+        RETVAL = cbf_set_byteswap_kernel(name);
+
+    OUTPUT:
+        RETVAL
+
+# ----------------------------------------------------------------------
+
+MODULE = CBOR::Free     PACKAGE = CBOR::Free::Encoder
+
+PROTOTYPES: DISABLE
+
+SV*
+new(SV *class, ...)
+    CODE:
+        encode_ctx opts_state;
+        cbf_encode_ctx_init( &opts_state, 0, CBF_STRING_ENCODE_SV );
+
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &opts_state );
+
+        encode_ctx* encode_state;
+        Newx( encode_state, 1, encode_ctx );
+
+        *encode_state = opts_state;
+
+        RETVAL = _bless_to_sv( aTHX_ class, (void*)encode_state);
+
+    OUTPUT:
+        RETVAL
+
+SV*
+encode(encode_ctx* encode_state, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), encode_state );
+
+        cbf_encode_ctx_prepare( encode_state, cbf_encode_ctx_initial_buflen(encode_state) );
+
+        RETVAL = _encode_to_new_sv( aTHX_ value, encode_state );
+
+        cbf_encode_ctx_record_len( encode_state );
+
+        LEAVE;
+
+    OUTPUT:
+        RETVAL
+
+UV
+encode_into(encode_ctx* encode_state, SV* output, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), encode_state );
+
+        RETVAL = cbf_encode_into( aTHX_ value, encode_state, output );
+
+        cbf_encode_ctx_free_reftracker( encode_state );
+
+        LEAVE;
+
+    OUTPUT:
+        RETVAL
+
+UV
+encoded_length(encode_ctx* encode_state, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), encode_state );
+
+        RETVAL = cbf_encoded_length( aTHX_ value, encode_state );
+
+        cbf_encode_ctx_free_reftracker( encode_state );
+
+        LEAVE;
+
+    OUTPUT:
+        RETVAL
+
+SV*
+encode_iov(encode_ctx* encode_state, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), encode_state );
+
+        AV *segments = cbf_encode_iov( aTHX_ value, encode_state );
+
+        cbf_encode_ctx_free_reftracker( encode_state );
+
+        LEAVE;
+
+        RETVAL = _iov_to_object( aTHX_ segments );
+
+    OUTPUT:
+        RETVAL
+
+void
+encode_sequence(encode_ctx* encode_state, SV* values)
+    PPCODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), encode_state );
+
+        cbf_encode_ctx_prepare( encode_state, cbf_encode_ctx_initial_buflen(encode_state) );
+
+        EXTEND(SP, 2);
+        U8 count = _encode_sequence_to_stack( aTHX_ values, encode_state, &ST(0) );
+
+        cbf_encode_ctx_record_len( encode_state );
+
+        LEAVE;
+
+        XSRETURN(count);
+
+void
+DESTROY(encode_ctx* encode_state)
+    CODE:
+        cbf_encode_ctx_free_all( encode_state );
+
+        Safefree(encode_state);
+
+# ----------------------------------------------------------------------
+
+MODULE = CBOR::Free     PACKAGE = CBOR::Free::IOV
+
+PROTOTYPES: DISABLE
+
+UV
+writev(SV* self, SV* fh)
+    CODE:
+        SvGETMAGIC(fh);
+
+        int fd;
+
+        if (SvROK(fh) || isGV_with_GP(fh)) {
+            PerlIO* output_fh = IoOFP( sv_2io(fh) );
+
+            if (!output_fh) {
+                croak("Filehandle is not open for writing!");
+            }
+
+            // Anything that Perl has buffered must go out first.
+            PerlIO_flush(output_fh);
+
+            fd = PerlIO_fileno(output_fh);
+        }
+        else {
+            fd = SvIV_nomg(fh);
+        }
+
+        if (fd < 0) {
+            croak("Invalid file descriptor: %d", fd);
+        }
+
+        RETVAL = cbf_iov_writev( aTHX_ (AV*) SvRV(self), fd );
+
+    OUTPUT:
+        RETVAL
+
+# ----------------------------------------------------------------------
+
+MODULE = CBOR::Free     PACKAGE = CBOR::Free::Encoder::Stream
+
+PROTOTYPES: DISABLE
+
+SV*
+new(SV *class, ...)
+    CODE:
+        encode_stream_ctx* stream;
+        Newxz( stream, 1, encode_stream_ctx );
+
+        cbf_encode_ctx_init( &stream->encode_state, 0, CBF_STRING_ENCODE_SV );
+
+        _parse_encode_opts( aTHX_ &ST(1), items - 1, &stream->encode_state );
+
+        // A stream’s additions would all need to share one namespace,
+        // which its rollbacks would then have to undo.
+        if (stream->encode_state.stringrefs) {
+            Safefree(stream);
+            croak("%" SVf " does not support " STRINGREFS_OPT "!", SVfARG(class));
+        }
+
+        stream->encode_state.is_stream = true;
+
+        RETVAL = _bless_to_sv( aTHX_ class, (void*)stream);
+
+    OUTPUT:
+        RETVAL
+
+void
+begin_array(encode_stream_ctx* stream, SV* key = NULL)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        cbf_encode_stream_begin( aTHX_ stream, CBOR_TYPE_ARRAY, key );
+
+        LEAVE;
+
+void
+begin_map(encode_stream_ctx* stream, SV* key = NULL)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        cbf_encode_stream_begin( aTHX_ stream, CBOR_TYPE_MAP, key );
+
+        LEAVE;
+
+void
+add(encode_stream_ctx* stream, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        cbf_encode_stream_add( aTHX_ stream, NULL, value );
+
+        LEAVE;
+
+void
+add_pair(encode_stream_ctx* stream, SV* key, SV* value)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        cbf_encode_stream_add( aTHX_ stream, key, value );
+
+        LEAVE;
+
+void
+end(encode_stream_ctx* stream)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        cbf_encode_stream_end( aTHX_ stream );
+
+        LEAVE;
+
+UV
+depth(encode_stream_ctx* stream)
+    CODE:
+        RETVAL = stream->open_count;
+
+    OUTPUT:
+        RETVAL
+
+SV*
+take_bytes(encode_stream_ctx* stream)
+    CODE:
+        ENTER;
+        _claim_encoder( aTHX_ ST(0), &stream->encode_state );
+
+        RETVAL = cbf_encode_stream_take_bytes( aTHX_ stream );
+
+        LEAVE;
+
+    OUTPUT:
+        RETVAL
+
+void
+DESTROY(encode_stream_ctx* stream)
+    CODE:
+        cbf_encode_stream_free( stream );
+
+        Safefree(stream);
+
 # ----------------------------------------------------------------------
 
 MODULE = CBOR::Free     PACKAGE = CBOR::Free::Decoder
@@ -294,6 +861,30 @@ naive_utf8(decode_ctx* decode_state, SV* new_setting = NULL)
     OUTPUT:
         RETVAL
 
+bool
+lazy_embedded_cbor(decode_ctx* decode_state, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ decode_state, new_setting, CBF_FLAG_LAZY_EMBEDDED );
+
+    OUTPUT:
+        RETVAL
+
+bool
+thaw_objects(decode_ctx* decode_state, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ decode_state, new_setting, CBF_FLAG_THAW_OBJECTS );
+
+    OUTPUT:
+        RETVAL
+
+bool
+keep_columnar(decode_ctx* decode_state, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ decode_state, new_setting, CBF_FLAG_KEEP_COLUMNAR );
+
+    OUTPUT:
+        RETVAL
+
 SV *
 string_decode_cbor(SV* self)
     CODE:
@@ -318,6 +909,38 @@ string_decode_always(SV* self)
     OUTPUT:
         RETVAL
 
+SV *
+typed_arrays_as_tags(SV* self)
+    CODE:
+        RETVAL = _set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_TAG );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_arrays(SV* self)
+    CODE:
+        RETVAL = _set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_ARRAY );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_packed(SV* self)
+    CODE:
+        RETVAL = _set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_PACKED );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_objects(SV* self)
+    CODE:
+        RETVAL = _set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_OBJECT );
+
+    OUTPUT:
+        RETVAL
+
 void
 _set_tag_handlers_backend(decode_ctx* decode_state, ...)
     CODE:
@@ -391,6 +1014,30 @@ naive_utf8(seqdecode_ctx* seqdecode, SV* new_setting = NULL)
     OUTPUT:
         RETVAL
 
+bool
+lazy_embedded_cbor(seqdecode_ctx* seqdecode, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ seqdecode->decode_state, new_setting, CBF_FLAG_LAZY_EMBEDDED );
+
+    OUTPUT:
+        RETVAL
+
+bool
+thaw_objects(seqdecode_ctx* seqdecode, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ seqdecode->decode_state, new_setting, CBF_FLAG_THAW_OBJECTS );
+
+    OUTPUT:
+        RETVAL
+
+bool
+keep_columnar(seqdecode_ctx* seqdecode, SV* new_setting = NULL)
+    CODE:
+        RETVAL = _handle_flag_call( aTHX_ seqdecode->decode_state, new_setting, CBF_FLAG_KEEP_COLUMNAR );
+
+    OUTPUT:
+        RETVAL
+
 
 SV *
 string_decode_cbor(SV* self)
@@ -416,6 +1063,38 @@ string_decode_always(SV* self)
     OUTPUT:
         RETVAL
 
+SV *
+typed_arrays_as_tags(SV* self)
+    CODE:
+        RETVAL = _seq_set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_TAG );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_arrays(SV* self)
+    CODE:
+        RETVAL = _seq_set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_ARRAY );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_packed(SV* self)
+    CODE:
+        RETVAL = _seq_set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_PACKED );
+
+    OUTPUT:
+        RETVAL
+
+SV *
+typed_arrays_as_objects(SV* self)
+    CODE:
+        RETVAL = _seq_set_typed_array_decode( aTHX_ self, CBF_TYPED_ARRAY_DECODE_OBJECT );
+
+    OUTPUT:
+        RETVAL
+
 void
 _set_tag_handlers_backend(seqdecode_ctx* seqdecode, ...)
     CODE:
@@ -0,0 +1,28 @@
+#!/usr/bin/env perl
+
+# Compares canonical and non-canonical encoding of wide hashes.
+#
+# Usage: perl -Mblib bench/canonical.pl [MAX_KEYS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $max_keys = $ARGV[0] || 1_000_000;
+
+printf "%10s %14s %14s %8s\n", 'keys', 'plain (s)', 'canonical (s)', 'ratio';
+
+for (my $keys = 1_000; $keys <= $max_keys; $keys *= 10) {
+    my %hash = map { ( "key-$_" => $_ ) } 1 .. $keys;
+
+    my @times = map {
+        my $start = Time::HiRes::time();
+        CBOR::Free::encode( \%hash, canonical => $_ );
+        Time::HiRes::time() - $start;
+    } ( 0, 1 );
+
+    printf "%10d %14.4f %14.4f %8.2f\n", $keys, @times, $times[1] / $times[0];
+}
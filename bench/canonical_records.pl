@@ -0,0 +1,32 @@
+#!/usr/bin/env perl
+
+# Compares canonical and non-canonical encoding of many records
+# that share a key set, e.g., rows from a database query.
+#
+# Usage: perl -Mblib bench/canonical_records.pl [RECORDS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $count = $ARGV[0] || 200_000;
+
+printf "%6s %14s %14s %8s\n", 'keys', 'plain (s)', 'canonical (s)', 'ratio';
+
+for my $keys (4, 12, 40) {
+    my @records = map {
+        my $n = $_;
+        +{ map { ( "column_$_" => $n ) } 1 .. $keys };
+    } 1 .. ($count / $keys * 4);
+
+    my @times = map {
+        my $start = Time::HiRes::time();
+        CBOR::Free::encode( \@records, canonical => $_ );
+        Time::HiRes::time() - $start;
+    } ( 0, 1 );
+
+    printf "%6d %14.4f %14.4f %8.2f\n", $keys, @times, $times[1] / $times[0];
+}
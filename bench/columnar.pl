@@ -0,0 +1,45 @@
+#!/usr/bin/env perl
+
+# Compares plain and columnar encoding of database-style rows, then
+# decoding of each.
+#
+# Usage: perl -Mblib bench/columnar.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my $rows = [
+    map {
+        {
+            id => $_,
+            name => "name $_",
+            email => "user$_\@example.com",
+            created => 1_600_000_000 + $_,
+            active => $_ % 2,
+            score => $_ / 7,
+        }
+    } 1 .. 20_000
+];
+
+for my $columnar ( 0, 1 ) {
+    my $label = $columnar ? 'columnar' : 'plain';
+
+    my $start = Time::HiRes::time();
+
+    my $cbor;
+    $cbor = CBOR::Free::encode( $rows, columnar => $columnar ) for 1 .. $iterations;
+
+    printf "encode_%-8s %10.4f s %10d bytes\n", $label, Time::HiRes::time() - $start, length $cbor;
+
+    $start = Time::HiRes::time();
+
+    CBOR::Free::decode($cbor) for 1 .. $iterations;
+
+    printf "decode_%-8s %10.4f s\n", $label, Time::HiRes::time() - $start;
+}
@@ -0,0 +1,61 @@
+#!/usr/bin/env perl
+
+# Measures encode time and peak RSS against document size.
+#
+# Usage: perl -Mblib bench/encode_growth.pl [MAX_MIB]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $max_mib = $ARGV[0] || 256;
+
+# Each element encodes to 1 KiB (3-byte header + 1021-byte string).
+my $element = 'x' x 1021;
+
+printf "%10s %10s %12s %12s %14s\n", 'doc (MiB)', 'hint', 'encode (s)', 'peak RSS', 'RSS delta';
+
+for (my $mib = 1; $mib <= $max_mib; $mib *= 4) {
+    for my $use_hint (0, 1) {
+        _run_in_child( $mib, $use_hint );
+    }
+}
+
+sub _run_in_child {
+    my ($mib, $use_hint) = @_;
+
+    my $pid = fork // die "fork: $!";
+
+    if (!$pid) {
+        my $doc = [ ($element) x ($mib * 1024) ];
+
+        my @hint = $use_hint ? ( size_hint => 4 + $mib * 1024 * 1024 ) : ();
+
+        my $before = _peak_rss();
+
+        my $start = Time::HiRes::time();
+        my $cbor = CBOR::Free::encode($doc, @hint);
+        my $elapsed = Time::HiRes::time() - $start;
+
+        my $peak = _peak_rss();
+
+        printf "%10d %10s %12.4f %10d kB %11d kB\n", $mib, ($use_hint ? 'yes' : 'no'), $elapsed, $peak, $peak - $before;
+
+        exit;
+    }
+
+    waitpid $pid, 0;
+}
+
+sub _peak_rss {
+    open my $fh, '<', '/proc/self/status' or return 0;
+
+    while (<$fh>) {
+        return $1 if m<\AVmHWM:\s+([0-9]+)>;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+#!/usr/bin/env perl
+
+# Compares framing many small messages into one output buffer via
+# encode() and concatenation against encode_into().
+#
+# Usage: perl -Mblib bench/encode_into.pl [MESSAGES]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+my $count = $ARGV[0] || 200_000;
+
+my @messages = map { { id => $_, method => 'update', params => [ $_, "item $_" ] } } 1 .. 1000;
+
+my $encoder = CBOR::Free::Encoder->new();
+my $prefixed_encoder = CBOR::Free::Encoder->new( length_prefix => 4 );
+
+my %cases = (
+    'encode + .=' => sub {
+        my $out = q<>;
+
+        for my $i ( 1 .. $count ) {
+            my $cbor = $encoder->encode( $messages[ $i % @messages ] );
+            $out .= pack( 'N', length $cbor ) . $cbor;
+        }
+    },
+    'encode_into' => sub {
+        my $out = q<>;
+
+        $prefixed_encoder->encode_into( $out, $messages[ $_ % @messages ] ) for 1 .. $count;
+    },
+);
+
+for my $name (sort keys %cases) {
+    my $start = Time::HiRes::time();
+
+    $cases{$name}->();
+
+    printf "%-12s %10.4f s\n", $name, Time::HiRes::time() - $start;
+}
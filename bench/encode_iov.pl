@@ -0,0 +1,47 @@
+#!/usr/bin/env perl
+
+# Compares writing responses that carry large blobs via encode() and
+# syswrite() against encode_iov() and writev().
+#
+# Usage: perl -Mblib bench/encode_iov.pl [RESPONSES] [BLOB_SIZE]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+my $count = $ARGV[0] || 5_000;
+my $blob_size = $ARGV[1] || 1_000_000;
+
+my @blobs = map { chr( 65 + $_ ) x $blob_size } 0 .. 3;
+
+my @responses = map {
+    { id => $_, status => 'ok', files => [ map { { name => "file$_", content => $blobs[$_] } } 0 .. 3 ] }
+} 1 .. 10;
+
+open my $null, '>', '/dev/null' or die "open: $!";
+
+my $encoder = CBOR::Free::Encoder->new();
+
+my %cases = (
+    'encode + syswrite' => sub {
+        for my $i ( 1 .. $count ) {
+            my $cbor = $encoder->encode( $responses[ $i % @responses ] );
+            syswrite $null, $cbor;
+        }
+    },
+    'encode_iov + writev' => sub {
+        $encoder->encode_iov( $responses[ $_ % @responses ] )->writev($null) for 1 .. $count;
+    },
+);
+
+for my $name (sort keys %cases) {
+    my $start = Time::HiRes::time();
+
+    $cases{$name}->();
+
+    printf "%-20s %10.4f s\n", $name, Time::HiRes::time() - $start;
+}
@@ -0,0 +1,37 @@
+#!/usr/bin/env perl
+
+# Times encoding of a few typical data shapes.
+#
+# Usage: perl -Mblib bench/encode_structures.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my %structures = (
+    records => [
+        map { { id => $_, name => "name $_", tags => [ 'a', 'b' ], score => $_ / 7 } } 1 .. 20_000
+    ],
+    ints => [ 1 .. 200_000 ],
+    arrays => [ map { [ $_, "s$_", [ $_, -$_ ], undef ] } 1 .. 50_000 ],
+    hashes => [ map { +{ map { ( "key$_" => $_ ) } 1 .. 30 } } 1 .. 5_000 ],
+    strings => [ map { "string number $_" } 1 .. 100_000 ],
+    tree => do {
+        my $t = 1;
+        $t = [ $t, { left => $t, right => [ 1, 2 ] } ] for 1 .. 16;
+        $t;
+    },
+);
+
+for my $name (sort keys %structures) {
+    my $start = Time::HiRes::time();
+
+    CBOR::Free::encode( $structures{$name} ) for 1 .. $iterations;
+
+    printf "%10s %10.4f s\n", $name, Time::HiRes::time() - $start;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env perl
+
+# Compares length(encode()) against encoded_length() for a few
+# typical data shapes.
+#
+# Usage: perl -Mblib bench/encoded_length.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my %structures = (
+    records => [
+        map { { id => $_, name => "name $_", tags => [ 'a', 'b' ], score => $_ / 7 } } 1 .. 20_000
+    ],
+    ints => [ 1 .. 200_000 ],
+    strings => [ map { "string number $_" } 1 .. 100_000 ],
+    blobs => [ map { chr(65 + $_) x 100_000 } 0 .. 25 ],
+    latin1 => [ map { "caf\xe9 number $_" x 50 } 1 .. 2_000 ],
+);
+
+for my $name (sort keys %structures) {
+    my %opts = ( string_encode_mode => ( $name eq 'latin1' ? 'encode_text' : 'sv' ) );
+
+    my $start = Time::HiRes::time();
+
+    for (1 .. $iterations) {
+        my $length = length CBOR::Free::encode( $structures{$name}, %opts );
+    }
+
+    my $encode_time = Time::HiRes::time() - $start;
+
+    $start = Time::HiRes::time();
+
+    CBOR::Free::encoded_length( $structures{$name}, %opts ) for 1 .. $iterations;
+
+    printf "%10s %10.4f s %10.4f s\n", $name, $encode_time, Time::HiRes::time() - $start;
+}
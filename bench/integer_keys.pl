@@ -0,0 +1,34 @@
+#!/usr/bin/env perl
+
+# Compares string and integer_keys encoding of integer-keyed hashes,
+# then times decoding of maps with integer keys.
+#
+# Usage: perl -Mblib bench/integer_keys.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my $data = [ map { { map { ( $_ * 1_000 + $_ => $_ ) } 1 .. 20 } } 1 .. 5_000 ];
+
+for my $integer_keys ( 0, 1 ) {
+    my $start = Time::HiRes::time();
+
+    my $cbor;
+    $cbor = CBOR::Free::encode( $data, canonical => 1, integer_keys => $integer_keys ) for 1 .. $iterations;
+
+    printf "encode_%-10s %10.4f s %10d bytes\n", ( $integer_keys ? 'integer' : 'string' ), Time::HiRes::time() - $start, length $cbor;
+}
+
+my $cbor = CBOR::Free::encode( [ map { { map { ( $_ => 1 ) } -100 .. 100 } } 1 .. 1_000 ], integer_keys => 1 );
+
+my $start = Time::HiRes::time();
+
+CBOR::Free::decode($cbor) for 1 .. $iterations;
+
+printf "%-17s %10.4f s\n", 'decode', Time::HiRes::time() - $start;
@@ -0,0 +1,30 @@
+#!/usr/bin/env perl
+
+# Measures preserve_references encoding against the number of
+# shared (i.e., multiply-referenced) nodes.
+#
+# Usage: perl -Mblib bench/preserve_references.pl [MAX_NODES]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $max_nodes = $ARGV[0] || 100_000;
+
+printf "%12s %12s %12s\n", 'shared nodes', 'encode (s)', 'CBOR bytes';
+
+for (my $nodes = 1_000; $nodes <= $max_nodes; $nodes *= 10) {
+
+    # Every node appears twice: once in each half of the list.
+    my @nodes = map { [ $_ ] } 1 .. $nodes;
+    my $graph = [ @nodes, reverse @nodes ];
+
+    my $start = Time::HiRes::time();
+    my $cbor = CBOR::Free::encode( $graph, preserve_references => 1 );
+    my $elapsed = Time::HiRes::time() - $start;
+
+    printf "%12d %12.4f %12d\n", $nodes, $elapsed, length $cbor;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env perl
+
+# Compares the “auto” string_encode_mode’s throughput, with each string
+# kernel (e.g., AVX2) that this CPU supports, against the “sv” mode.
+#
+# Usage: perl -Mblib bench/string_auto.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my %data = (
+    short_ascii => [ map { "user$_\@example.com" } 1 .. 200_000 ],
+    long_ascii => [ map { "lorem ipsum dolor sit amet $_ " x 10_000 } 1 .. 50 ],
+    long_binary => [ map { ("lorem ipsum dolor sit amet $_ " x 10_000) . "\xff" } 1 .. 50 ],
+    long_utf8 => [ map { utf8::upgrade( my $s = "caf\xe9 \x{442}\x{435}\x{43a}\x{441}\x{442} $_ " x 10_000 ); $s } 1 .. 50 ],
+);
+
+my @kernels = grep { CBOR::Free::_set_string_kernel($_) } qw( avx2 sse2 scalar );
+
+printf "%-12s %-12s %10s %10s\n", 'data', 'mode', 'MiB/s', 'vs. sv';
+
+for my $name (sort keys %data) {
+    my $bytes = 0;
+    $bytes += do { use bytes; length } for @{ $data{$name} };
+
+    my $sv_rate;
+
+    for my $kernel ( undef, @kernels ) {
+        CBOR::Free::_set_string_kernel($kernel) if $kernel;
+
+        my $mode = $kernel ? 'auto' : 'sv';
+
+        # Warm up, then take the best of 5 runs.
+        CBOR::Free::encode( $data{$name}, string_encode_mode => $mode );
+
+        my $best;
+
+        for (1 .. 5) {
+            my $start = Time::HiRes::time();
+
+            CBOR::Free::encode( $data{$name}, string_encode_mode => $mode ) for 1 .. $iterations;
+
+            my $elapsed = Time::HiRes::time() - $start;
+            $best = $elapsed if !$best || $elapsed < $best;
+        }
+
+        my $rate = $bytes * $iterations / $best / 2**20;
+
+        $sv_rate ||= $rate;
+
+        printf "%-12s %-12s %10.0f %10.2f\n", $name, $kernel ? "auto/$kernel" : 'sv', $rate, $rate / $sv_rate;
+    }
+}
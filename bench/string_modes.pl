@@ -0,0 +1,33 @@
+#!/usr/bin/env perl
+
+# Times encoding of records and of long strings in each string_encode_mode.
+#
+# Usage: perl -Mblib bench/string_modes.pl [ITERATIONS]
+
+use strict;
+use warnings;
+
+use CBOR::Free;
+
+my $iterations = $ARGV[0] || 20;
+
+my %data = (
+    records => [
+        map {
+            { id => $_, name => "name $_", email => "user$_\@example.com", active => 1, score => $_ * 3 }
+        } 1 .. 20_000
+    ],
+    long_ascii => [ map { "lorem ipsum dolor sit amet $_ " x 10_000 } 1 .. 50 ],
+    long_latin1 => [ map { "caf\xe9 cr\xe8me br\xfbl\xe9e $_ " x 10_000 } 1 .. 50 ],
+    long_latin1_upgraded => [ map { utf8::upgrade( my $s = "caf\xe9 cr\xe8me br\xfbl\xe9e $_ " x 10_000 ); $s } 1 .. 50 ],
+);
+
+for my $name (sort keys %data) {
+    for my $mode ( qw( sv encode_text as_text as_binary ) ) {
+        my $start = (times)[0];
+
+        CBOR::Free::encode( $data{$name}, string_encode_mode => $mode ) for 1 .. $iterations;
+
+        printf "%-24s %10.4f s\n", "$name/$mode", (times)[0] - $start;
+    }
+}
@@ -0,0 +1,58 @@
+#!/usr/bin/env perl
+
+# Compares size and speed with and without stringrefs, using records
+# that repeat long strings (URLs, hostnames, enum names).
+#
+# Usage: perl -Mblib bench/stringrefs.pl [RECORDS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+
+my $records = $ARGV[0] || 100_000;
+
+my @hosts = map { "host$_.datacenter.example.com" } 1 .. 20;
+my @states = qw( PROVISIONING RUNNING DEGRADED TERMINATED );
+
+my @data = map {
+    {
+        id => $_,
+        host => $hosts[ $_ % @hosts ],
+        url => "https://api.example.com/v2/instances/" . $hosts[ $_ % @hosts ],
+        state => $states[ $_ % @states ],
+        owner => "user" . ( $_ % 1000 ) . '@example.com',
+    }
+} 1 .. $records;
+
+# Best of 5 runs:
+sub _time {
+    my ($cr) = @_;
+
+    my $best;
+
+    for (1 .. 5) {
+        my $start = Time::HiRes::time();
+        $cr->();
+        my $elapsed = Time::HiRes::time() - $start;
+
+        $best = $elapsed if !$best || $elapsed < $best;
+    }
+
+    return $best;
+}
+
+printf "%-12s %12s %12s %12s\n", 'stringrefs', 'bytes', 'encode (s)', 'decode (s)';
+
+for my $stringrefs ( 0, 1 ) {
+    my $cbor = CBOR::Free::encode( \@data, stringrefs => $stringrefs );
+
+    printf "%-12s %12d %12.4f %12.4f\n",
+        $stringrefs ? 'on' : 'off',
+        length $cbor,
+        _time( sub { CBOR::Free::encode( \@data, stringrefs => $stringrefs ) } ),
+        _time( sub { CBOR::Free::decode($cbor) } ),
+    ;
+}
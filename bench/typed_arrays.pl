@@ -0,0 +1,68 @@
+#!/usr/bin/env perl
+
+# Compares a numeric time series’ encoding & decoding as a CBOR array
+# against RFC 8746 typed arrays in each byte order and decode mode.
+#
+# Usage: perl -Mblib bench/typed_arrays.pl [ELEMENTS]
+
+use strict;
+use warnings;
+
+use Time::HiRes ();
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+
+my $count = $ARGV[0] || 1_000_000;
+
+my @samples = map { sin($_ / 100) * 1000 } 1 .. $count;
+
+my $packed = pack 'd*', @samples;
+
+sub _best_of_5 {
+    my ($cr) = @_;
+
+    $cr->();
+
+    my $best;
+
+    for (1 .. 5) {
+        my $start = Time::HiRes::time();
+        $cr->();
+        my $elapsed = Time::HiRes::time() - $start;
+
+        $best = $elapsed if !$best || $elapsed < $best;
+    }
+
+    return $best;
+}
+
+my %cbor;
+
+printf "%-24s %10s %10s\n", 'encode', 'bytes', 'seconds';
+
+for my $case (
+    [ 'array' => \@samples ],
+    [ 'float64 (native order)' => CBOR::Free::TypedArray->new( 'float64', $packed ) ],
+    [ 'float64be' => CBOR::Free::TypedArray->new( 'float64be', $packed ) ],
+) {
+    my ($name, $data) = @$case;
+
+    my $elapsed = _best_of_5( sub { $cbor{$name} = CBOR::Free::encode($data) } );
+
+    printf "%-24s %10d %10.4f\n", $name, length $cbor{$name}, $elapsed;
+}
+
+print "\n";
+printf "%-24s %10s\n", 'decode', 'seconds';
+
+my $decoder = CBOR::Free::Decoder->new();
+
+printf "%-24s %10.4f\n", 'array', _best_of_5( sub { $decoder->decode( $cbor{'array'} ) } );
+
+for my $mode ( qw( arrays packed objects ) ) {
+    my $setter = "typed_arrays_as_$mode";
+    $decoder->$setter();
+
+    printf "%-24s %10.4f\n", "float64be as $mode", _best_of_5( sub { $decoder->decode( $cbor{'float64be'} ) } );
+}
@@ -1,5 +1,7 @@
 #include "easyxs/init.h"
 
+#include "cbor_free_common.h"
+
 SV *cbf_call_scalar_with_arguments( pTHX_ SV* cb, const U8 count, SV** args ) {
     // --- Almost all copy-paste from “perlcall” … blegh!
     dSP;
@@ -41,3 +43,25 @@ void cbf_die_with_arguments( pTHX_ U8 argslen, SV** args ) {
 
     assert(0);
 }
+
+static HV *raw_stash = NULL;
+
+HV *cbf_get_raw_stash() {
+    if (!raw_stash) {
+        dTHX;
+        raw_stash = gv_stashpv(RAW_CLASS, 1);
+    }
+
+    return raw_stash;
+}
+
+// Creates a CBOR::Free::Raw instance. This takes ownership of cbor.
+SV *cbf_new_raw( pTHX_ SV *cbor, bool embedded ) {
+    AV *raw = newAV();
+
+    av_extend(raw, 1);
+    av_push(raw, cbor);
+    av_push(raw, boolSV(embedded));
+
+    return sv_bless( newRV_noinc((SV *) raw), cbf_get_raw_stash() );
+}
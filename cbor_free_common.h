@@ -11,6 +11,7 @@
 #define CBOR_TRUE       0xf5
 #define CBOR_NULL       0xf6
 #define CBOR_UNDEFINED  0xf7
+#define CBOR_BREAK      0xff
 
 #define CBOR_LENGTH_SMALL       0x18
 #define CBOR_LENGTH_MEDIUM      0x19
@@ -18,10 +19,19 @@
 #define CBOR_LENGTH_HUGE        0x1b
 #define CBOR_LENGTH_INDEFINITE  0x1f
 
+#define CBOR_TAG_ENCODED_CBOR 24
+#define CBOR_TAG_STRINGREF 25
+#define CBOR_TAG_PERL_OBJECT 26
 #define CBOR_TAG_SHAREABLE 28
 #define CBOR_TAG_SHAREDREF 29
+#define CBOR_TAG_STRINGREF_NAMESPACE 256
 #define CBOR_TAG_INDIRECTION 22098
 
+// Unregistered; see the columnar encode option. (0x43424643 is “CBFC”.)
+#define CBOR_TAG_COLUMNAR 0x43424643
+
+#define RAW_CLASS "CBOR::Free::Raw"
+
 #define IS_LITTLE_ENDIAN (BYTEORDER == 0x1234 || BYTEORDER == 0x12345678)
 #define IS_64_BIT        (BYTEORDER > 0x10000)
 
@@ -77,7 +87,21 @@ union anyint {
     _croak(NULL); \
 }
 
+// The stringref extension (tags 25 & 256) indexes a string only if
+// it’s at least this long. That way a reference (i.e., tag 25 and
+// the index) is never longer than the string.
+static inline STRLEN cbf_stringref_min_length( UV index ) {
+    return (index < 24) ? 3
+        : (index < 0x100) ? 4
+        : (index < 0x10000) ? 5
+        : (index <= 0xffffffffU) ? 7
+        : 11;
+}
+
 SV *cbf_call_scalar_with_arguments( pTHX_ SV* cb, const U8 count, SV** args );
 void cbf_die_with_arguments( pTHX_ const U8 count, SV** args );
 
+HV *cbf_get_raw_stash();
+SV *cbf_new_raw( pTHX_ SV *cbor, bool embedded );
+
 #endif
@@ -3,6 +3,7 @@
 
 #include "cbor_free_common.h"
 #include "cbor_free_decode.h"
+#include "cbor_free_typedarray.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -25,6 +26,21 @@
 #define _RETURN_IF_SET_INCOMPLETE(decstate, toreturn) \
     if (decstate->incomplete_by) return toreturn;
 
+// Stringrefs to strings shorter than this get their own copies, which
+// in testing was faster than copy-on-write’s bookkeeping.
+#define STRINGREF_COW_MIN_LENGTH 128
+
+// Outside the core, sv_setsv() only does copy-on-write if asked.
+#ifdef SV_COW_OTHER_PVS
+#   define CBF_SV_COW_FLAGS (SV_COW_SHARED_HASH_KEYS | SV_COW_OTHER_PVS)
+#else
+#   define CBF_SV_COW_FLAGS 0
+#endif
+
+#ifndef SvIsCOW
+#   define SvIsCOW(sv) 0
+#endif
+
 #define SHOULD_VALIDATE_UTF8(decstate, major_type) \
     major_type == CBOR_TYPE_UTF8 \
     || decstate->string_decode_mode == CBF_STRING_DECODE_ALWAYS
@@ -61,14 +77,84 @@ const char *MAJOR_TYPE_DESCRIPTION[] = {
 // Croakers
 
 static const char* UV_TO_STR_TMPL = (sizeof(UV) == 8 ? "%llu" : "%lu");
-static const char* IV_TO_STR_TMPL = (sizeof(UV) == 8 ? "%lld" : "%ld");
+
+// Integer map keys have to become strings, which snprintf() does
+// rather slowly. Instead we count the digits up front then write
+// them backward, two at a time.
+
+static const char DIGIT_PAIRS[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+#if defined(__GNUC__)
+static const uint64_t POW10[] = {
+    0, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+#endif
+
+static inline unsigned _uv_digits_count(UV num) {
+#if defined(__GNUC__)
+    unsigned bits = (sizeof(UV) * 8) - ((sizeof(UV) > sizeof(unsigned long)) ? __builtin_clzll(num | 1) : __builtin_clzl(num | 1));
+
+    // 1233/4096 is just over log10(2).
+    unsigned guess = (bits * 1233) >> 12;
+
+    return guess + 1 - ((uint64_t) num < POW10[guess]);
+#else
+    unsigned count = 1;
+
+    while (num >= 10) {
+        num /= 10;
+        count++;
+    }
+
+    return count;
+#endif
+}
 
 UV _uv_to_str(UV num, char *numstr, const char strlen) {
-    return my_snprintf( numstr, strlen, UV_TO_STR_TMPL, num );
+    unsigned count = _uv_digits_count(num);
+
+    PERL_UNUSED_ARG(strlen);
+    assert(count < (unsigned) strlen);
+
+    char *cur = numstr + count;
+    *cur = '\0';
+
+    while (num >= 100) {
+        unsigned pair = (num % 100) << 1;
+        num /= 100;
+
+        *--cur = DIGIT_PAIRS[pair + 1];
+        *--cur = DIGIT_PAIRS[pair];
+    }
+
+    if (num >= 10) {
+        *--cur = DIGIT_PAIRS[(num << 1) + 1];
+        *--cur = DIGIT_PAIRS[num << 1];
+    }
+    else {
+        *--cur = '0' + num;
+    }
+
+    return count;
 }
 
 UV _iv_to_str(IV num, char *numstr, const char strlen) {
-    return my_snprintf( numstr, strlen, IV_TO_STR_TMPL, num );
+    if (num >= 0) return _uv_to_str( num, numstr, strlen );
+
+    *numstr = '-';
+
+    // This avoids overflow when num is IV_MIN.
+    return 1 + _uv_to_str( (UV) -(num + 1) + 1, numstr + 1, strlen - 1 );
 }
 
 void _free_decode_state_if_not_persistent( pTHX_ decode_ctx* decstate ) {
@@ -211,6 +297,62 @@ void _warn_unhandled_tag( pTHX_ UV tagnum, U8 value_major_type ) {
     warn(tmpl, tagnum, value_major_type, MAJOR_TYPE_DESCRIPTION[value_major_type]);
 }
 
+// Tag 26 (Types::Serialiser’s FREEZE/THAW protocol) tags an array of
+// a class name and that class’s FREEZE returns. We give those to the
+// class’s THAW method, whose return replaces the tagged value.
+// This takes ownership of frozen.
+static SV *_thaw_object( pTHX_ SV *frozen ) {
+    sv_2mortal(frozen);
+
+    AV *array = (SvROK(frozen) && SvTYPE(SvRV(frozen)) == SVt_PVAV) ? (AV *) SvRV(frozen) : NULL;
+
+    if (!array || av_len(array) < 0) {
+        croak("Tag %d must tag a nonempty array!", CBOR_TAG_PERL_OBJECT);
+    }
+
+    SV *class = *av_fetch(array, 0, 0);
+    HV *stash = gv_stashsv(class, 0);
+    GV *method = stash ? gv_fetchmethod_autoload(stash, "THAW", 0) : NULL;
+
+    if (!method) {
+        croak("Cannot thaw %" SVf " object: class has no THAW method!", SVfARG(class));
+    }
+
+    SSize_t count = 1 + av_len(array);
+
+    dSP;
+
+    ENTER;
+    SAVETMPS;
+
+    PUSHMARK(SP);
+    EXTEND(SP, count + 1);
+
+    PUSHs(class);
+    PUSHs( sv_2mortal( newSVpvs("CBOR") ) );
+
+    SSize_t i;
+    for (i=1; i<count; i++) {
+        SV **item = av_fetch(array, i, 0);
+        PUSHs( item ? *item : &PL_sv_undef );
+    }
+
+    PUTBACK;
+
+    call_sv( (SV *) GvCV(method), G_SCALAR );
+
+    SPAGAIN;
+
+    SV *ret = newSVsv(POPs);
+
+    PUTBACK;
+
+    FREETMPS;
+    LEAVE;
+
+    return ret;
+}
+
 //----------------------------------------------------------------------
 
 static inline void _validate_utf8_string_if_needed( pTHX_ decode_ctx* decstate, char *buffer, STRLEN len ) {
@@ -296,6 +438,48 @@ static inline UV _parse_for_uint_len2( pTHX_ decode_ctx* decstate ) {
     return ret;
 }
 
+// Adds str to the current stringref namespace. This takes ownership
+// of str. Copy-on-write needs a spare byte after the trailing NUL;
+// with that, references to a long str can share its buffer.
+static void _add_stringref( pTHX_ decode_ctx* decstate, SV *str ) {
+    if (SvCUR(str) >= STRINGREF_COW_MIN_LENGTH) {
+        SvGROW( str, SvCUR(str) + 2 );
+    }
+
+    av_push( decstate->stringrefs, str );
+}
+
+// Indexes str in the current stringref namespace if it’s long enough.
+// This mirrors the encoder, which indexes the same strings.
+static inline void _note_stringref( pTHX_ decode_ctx* decstate, SV *str ) {
+    if (SvCUR(str) >= cbf_stringref_min_length( 1 + av_len(decstate->stringrefs) )) {
+        _add_stringref( aTHX_ decstate, SvREFCNT_inc(str) );
+    }
+}
+
+// Returns the stringref namespace’s string at the tagged index.
+// Sets incomplete_by.
+static SV *_resolve_stringref( pTHX_ decode_ctx* decstate ) {
+    _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+    uint8_t value_major_type = CONTROL_BYTE_MAJOR_TYPE(*decstate->curbyte);
+
+    if (value_major_type != CBOR_TYPE_UINT) {
+        croak("Stringref index must be uint, not %u (%s)!", value_major_type, MAJOR_TYPE_DESCRIPTION[value_major_type]);
+    }
+
+    UV index = _parse_for_uint_len2( aTHX_ decstate );
+    _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+    SV **str = (index <= (UV) av_len(decstate->stringrefs)) ? av_fetch(decstate->stringrefs, index, 0) : NULL;
+
+    if (!str) {
+        _croak("Missing stringref!");
+    }
+
+    return *str;
+}
+
 //----------------------------------------------------------------------
 
 // Sets incomplete_by.
@@ -398,6 +582,11 @@ bool _decode_str( pTHX_ decode_ctx* decstate, union numbuf_or_sv* string_u ) {
         sv_2mortal(string);
         string_u->sv = string;
 
+        // Stringref namespaces index neither indefinite-length
+        // strings nor their chunks.
+        AV *stringrefs = decstate->stringrefs;
+        decstate->stringrefs = NULL;
+
         while (1) {
             _RETURN_IF_INCOMPLETE( decstate, 1, false );
 
@@ -410,6 +599,8 @@ bool _decode_str( pTHX_ decode_ctx* decstate, union numbuf_or_sv* string_u ) {
 
             SV *cur = cbf_decode_one( aTHX_ decstate );
 
+            // NB: Each document’s decode resets stringrefs, so
+            // there’s no need to restore it here.
             _RETURN_IF_SET_INCOMPLETE( decstate, false );
 
             sv_2mortal(cur);
@@ -417,6 +608,8 @@ bool _decode_str( pTHX_ decode_ctx* decstate, union numbuf_or_sv* string_u ) {
             sv_catsv(string, cur);
         }
 
+        decstate->stringrefs = stringrefs;
+
         SvREFCNT_inc(string);
 
         return true;
@@ -490,10 +683,42 @@ void _decode_hash_entry( pTHX_ decode_ctx* decstate, HV *hash ) {
                 else {
                     keylen = my_key.numbuf.num.uv;
                 }
+
+                if (decstate->stringrefs && my_key.numbuf.num.uv >= cbf_stringref_min_length( 1 + av_len(decstate->stringrefs) )) {
+                    SV *str = newSVpvn( keystr, my_key.numbuf.num.uv );
+                    if (keylen < 0) SvUTF8_on(str);
+
+                    _add_stringref( aTHX_ decstate, str );
+                }
             }
 
             break;
 
+        case CBOR_TYPE_TAG:
+
+            // The only tag that can be a key is a stringref.
+            if (decstate->stringrefs) {
+                char *tag_start = decstate->curbyte;
+
+                UV tagnum = _parse_for_uint_len2( aTHX_ decstate );
+                _RETURN_IF_SET_INCOMPLETE(decstate, );
+
+                if (tagnum == CBOR_TAG_STRINGREF) {
+                    SV *str = _resolve_stringref( aTHX_ decstate );
+                    _RETURN_IF_SET_INCOMPLETE(decstate, );
+
+                    my_key.sv = SvREFCNT_inc(str);
+                    my_key_has_sv = true;
+
+                    break;
+                }
+
+                decstate->curbyte = tag_start;
+            }
+
+            _croak_invalid_map_key( aTHX_ decstate);
+            return; // Silence compiler warning.
+
         default:
             _croak_invalid_map_key( aTHX_ decstate);
             return; // Silence compiler warning.
@@ -508,6 +733,7 @@ void _decode_hash_entry( pTHX_ decode_ctx* decstate, HV *hash ) {
     }
     else if (my_key_has_sv) {
         hv_store_ent(hash, my_key.sv, curval, 0);
+        SvREFCNT_dec( my_key.sv );
     }
     else {
         hv_store(hash, keystr, keylen, curval, 0);
@@ -565,8 +791,7 @@ SV *_decode_map( pTHX_ decode_ctx* decstate ) {
 //----------------------------------------------------------------------
 
 // Taken from RFC 7049:
-double decode_half_float(uint8_t *halfp) {
-    int half = (halfp[0] << 8) + halfp[1];
+static inline double _half_to_double( uint16_t half ) {
     int exp = (half >> 10) & 0x1f;
     int mant = half & 0x3ff;
     double val;
@@ -576,6 +801,10 @@ double decode_half_float(uint8_t *halfp) {
     return half & 0x8000 ? -val : val;
 }
 
+double decode_half_float(uint8_t *halfp) {
+    return _half_to_double( (halfp[0] << 8) + halfp[1] );
+}
+
 static inline float _decode_float_to_host( pTHX_ decode_ctx* decstate, uint8_t *ptr ) {
     *((uint32_t *) decstate->scratch.bytes) = ntohl( *((uint32_t *) ptr) );
 
@@ -595,6 +824,149 @@ static inline double _decode_double_to_le( decode_ctx* decstate, uint8_t *ptr )
     return decstate->scratch.as_double;
 }
 
+//----------------------------------------------------------------------
+// RFC 8746 typed arrays
+
+// Perl has no 128-bit floats, so the array mode leaves those as tags.
+static inline bool _decodes_typed_array( decode_ctx* decstate, UV tagnum ) {
+    return cbf_is_typed_array_tag(tagnum)
+        && decstate->typed_array_decode_mode != CBF_TYPED_ARRAY_DECODE_TAG
+        && !(decstate->typed_array_decode_mode == CBF_TYPED_ARRAY_DECODE_ARRAY && cbf_typed_array_width(tagnum) == 16);
+}
+
+#define _TYPED_ARRAY_TO_AV(elements, src, count, ctype, to_sv) { \
+    ctype val; \
+    SSize_t i; \
+    for (i=0; i<count; i++) { \
+        Copy( src + i * sizeof(ctype), &val, 1, ctype ); \
+        elements[i] = to_sv(val); \
+    } \
+}
+
+#define _HALF_TO_SV(val) newSVnv( _half_to_double(val) )
+
+#if IVSIZE >= 8
+#   define _U64_TO_SV newSVuv
+#   define _I64_TO_SV newSViv
+#else
+#   define _U64_TO_SV(val) newSVnv( (NV) val )
+#   define _I64_TO_SV(val) newSVnv( (NV) val )
+#endif
+
+// Converts packed elements (in our byte order) to a Perl array.
+static SV *_typed_array_to_av( pTHX_ UV tagnum, const U8 *src, SSize_t count ) {
+    AV *array = newAV();
+
+    if (count) {
+        av_extend(array, count - 1);
+
+        SV **elements = AvARRAY(array);
+
+        switch (tagnum & (TYPED_ARRAY_FLOAT_BIT | TYPED_ARRAY_SIGNED_BIT | 3)) {
+            case 0:
+                _TYPED_ARRAY_TO_AV(elements, src, count, uint8_t, newSVuv);
+                break;
+            case 1:
+                _TYPED_ARRAY_TO_AV(elements, src, count, uint16_t, newSVuv);
+                break;
+            case 2:
+                _TYPED_ARRAY_TO_AV(elements, src, count, uint32_t, newSVuv);
+                break;
+            case 3:
+                _TYPED_ARRAY_TO_AV(elements, src, count, uint64_t, _U64_TO_SV);
+                break;
+            case TYPED_ARRAY_SIGNED_BIT:
+                _TYPED_ARRAY_TO_AV(elements, src, count, int8_t, newSViv);
+                break;
+            case TYPED_ARRAY_SIGNED_BIT | 1:
+                _TYPED_ARRAY_TO_AV(elements, src, count, int16_t, newSViv);
+                break;
+            case TYPED_ARRAY_SIGNED_BIT | 2:
+                _TYPED_ARRAY_TO_AV(elements, src, count, int32_t, newSViv);
+                break;
+            case TYPED_ARRAY_SIGNED_BIT | 3:
+                _TYPED_ARRAY_TO_AV(elements, src, count, int64_t, _I64_TO_SV);
+                break;
+            case TYPED_ARRAY_FLOAT_BIT:
+                _TYPED_ARRAY_TO_AV(elements, src, count, uint16_t, _HALF_TO_SV);
+                break;
+            case TYPED_ARRAY_FLOAT_BIT | 1:
+                _TYPED_ARRAY_TO_AV(elements, src, count, float, newSVnv);
+                break;
+            case TYPED_ARRAY_FLOAT_BIT | 2:
+                _TYPED_ARRAY_TO_AV(elements, src, count, double, newSVnv);
+                break;
+
+            default:
+                assert(0);
+        }
+
+        AvFILLp(array) = count - 1;
+    }
+
+    return newRV_noinc( (SV *) array );
+}
+
+// bytes is the typed array’s byte string. Its elements become a Perl
+// array, a packed string, or a CBOR::Free::TypedArray, the latter two
+// in our byte order. This takes ownership of bytes.
+static SV *_decode_typed_array( pTHX_ decode_ctx* decstate, UV tagnum, SV *bytes ) {
+    U8 width = cbf_typed_array_width(tagnum);
+
+    if (SvROK(bytes) || !SvPOK(bytes)) {
+        sv_2mortal(bytes);
+        croak("Tag %" UVuf " must tag a byte string!", tagnum);
+    }
+
+    STRLEN len = SvCUR(bytes);
+
+    if (len % width) {
+        sv_2mortal(bytes);
+        croak("Tag %" UVuf " byte string length (%" UVuf ") must be a multiple of %u!", tagnum, (UV) len, width);
+    }
+
+    bool swap = cbf_typed_array_needs_swap(tagnum);
+
+    // bytes may be in the stringref namespace or share its buffer,
+    // in which case we mustn’t alter it.
+    if ( (swap && (SvREFCNT(bytes) > 1 || SvIsCOW(bytes))) || (SvUTF8(bytes) && SvREFCNT(bytes) > 1) ) {
+        SV *copy = newSV(len);
+
+        if (swap) {
+            cbf_byteswap( (U8 *) SvPVX(copy), (U8 *) SvPVX(bytes), len / width, width );
+        }
+        else {
+            Copy( SvPVX(bytes), SvPVX(copy), len, char );
+        }
+
+        SvCUR_set(copy, len);
+        *SvEND(copy) = 0;
+        SvPOK_on(copy);
+
+        SvREFCNT_dec(bytes);
+        bytes = copy;
+    }
+    else if (swap) {
+        cbf_byteswap( (U8 *) SvPVX(bytes), (U8 *) SvPVX(bytes), len / width, width );
+    }
+
+    switch (decstate->typed_array_decode_mode) {
+        case CBF_TYPED_ARRAY_DECODE_ARRAY: {
+            SV *ret = _typed_array_to_av( aTHX_ tagnum, (U8 *) SvPVX(bytes), len / width );
+            SvREFCNT_dec(bytes);
+            return ret;
+        }
+
+        case CBF_TYPED_ARRAY_DECODE_OBJECT:
+            SvUTF8_off(bytes);
+            return cbf_new_typed_array( aTHX_ tagnum, bytes );
+
+        default:
+            SvUTF8_off(bytes);
+            return bytes;
+    }
+}
+
 //----------------------------------------------------------------------
 
 // Sets incomplete_by.
@@ -610,6 +982,149 @@ static inline SV *_decode_str_to_sv( pTHX_ decode_ctx* decstate ) {
     return newSVpvn( string.numbuf.buffer, string.numbuf.num.uv );
 }
 
+//----------------------------------------------------------------------
+// CBOR_TAG_COLUMNAR (i.e., what the columnar encode option outputs)
+// tags an array of keys then one array of values per row. We decode
+// each row straight into a hash, with each key’s hash computed once.
+
+struct cbf_columnar_key {
+    const char *key;
+    I32 klen;       // negative if UTF-8, as hv_store() expects
+    U32 hash;
+};
+
+static void _croak_invalid_columnar( pTHX ) {
+    croak("Tag %" UVuf " must tag an array of an array of keys then arrays of values!", (UV) CBOR_TAG_COLUMNAR);
+}
+
+// Sets incomplete_by.
+static SV *_decode_columnar( pTHX_ decode_ctx* decstate ) {
+    _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+    if (CONTROL_BYTE_MAJOR_TYPE(*decstate->curbyte) != CBOR_TYPE_ARRAY) {
+        _croak_invalid_columnar(aTHX);
+    }
+
+    // Excludes the keys; negative if indefinite
+    SSize_t rowscount;
+
+    if (CONTROL_BYTE_LENGTH_TYPE(*decstate->curbyte) == CBOR_LENGTH_INDEFINITE) {
+        ++decstate->curbyte;
+        rowscount = -1;
+
+        _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+        if (decstate->curbyte[0] == '\xff') _croak_invalid_columnar(aTHX);
+    }
+    else {
+        rowscount = _parse_for_uint_len2( aTHX_ decstate );
+        _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+        if (!rowscount--) _croak_invalid_columnar(aTHX);
+    }
+
+    SV *keys_sv = cbf_decode_one( aTHX_ decstate );
+    _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+    sv_2mortal(keys_sv);
+
+    if (!SvROK(keys_sv) || SvTYPE(SvRV(keys_sv)) != SVt_PVAV) {
+        _croak_invalid_columnar(aTHX);
+    }
+
+    AV *keys = (AV *) SvRV(keys_sv);
+    SSize_t keyscount = 1 + av_len(keys);
+
+    SV *columns_sv = sv_2mortal( newSV( (1 + keyscount) * sizeof(struct cbf_columnar_key) ) );
+    struct cbf_columnar_key *columns = (struct cbf_columnar_key *) SvPVX(columns_sv);
+
+    SSize_t k;
+
+    for (k=0; k<keyscount; k++) {
+        SV **key = av_fetch(keys, k, 0);
+
+        if (!key || !SvOK(*key) || SvROK(*key)) {
+            croak("Tag %" UVuf " keys must be strings or numbers!", (UV) CBOR_TAG_COLUMNAR);
+        }
+
+        STRLEN klen;
+        columns[k].key = SvPV(*key, klen);
+
+        if (klen > I32_MAX) _croak("key too long!");
+
+        columns[k].klen = SvUTF8(*key) ? -(I32) klen : (I32) klen;
+        PERL_HASH( columns[k].hash, columns[k].key, klen );
+    }
+
+    AV *hashes = newAV();
+    sv_2mortal( (SV *) hashes );
+
+    if (rowscount > 0) av_extend(hashes, rowscount - 1);
+
+    SSize_t r;
+
+    for (r=0; rowscount < 0 || r < rowscount; r++) {
+        _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+        if (rowscount < 0 && decstate->curbyte[0] == '\xff') {
+            ++decstate->curbyte;
+            break;
+        }
+
+        if (CONTROL_BYTE_MAJOR_TYPE(*decstate->curbyte) != CBOR_TYPE_ARRAY) {
+            _croak_invalid_columnar(aTHX);
+        }
+
+        bool indefinite = CONTROL_BYTE_LENGTH_TYPE(*decstate->curbyte) == CBOR_LENGTH_INDEFINITE;
+
+        if (indefinite) {
+            ++decstate->curbyte;
+        }
+        else {
+            SSize_t count = _parse_for_uint_len2( aTHX_ decstate );
+            _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+            if (count != keyscount) {
+                croak("Tag %" UVuf " row %" IVdf " must have %" IVdf " items, not %" IVdf "!", (UV) CBOR_TAG_COLUMNAR, (IV) r, (IV) keyscount, (IV) count);
+            }
+        }
+
+        HV *hash = newHV();
+        av_push( hashes, newRV_noinc( (SV *) hash ) );
+
+        hv_ksplit(hash, keyscount);
+
+        for (k=0; k<keyscount; k++) {
+            if (indefinite) {
+                _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+                if (decstate->curbyte[0] == '\xff') {
+                    croak("Tag %" UVuf " row %" IVdf " must have %" IVdf " items, not %" IVdf "!", (UV) CBOR_TAG_COLUMNAR, (IV) r, (IV) keyscount, (IV) k);
+                }
+            }
+
+            SV *value = cbf_decode_one( aTHX_ decstate );
+            _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+            hv_store( hash, columns[k].key, columns[k].klen, value, columns[k].hash );
+        }
+
+        if (indefinite) {
+            _RETURN_IF_INCOMPLETE( decstate, 1, NULL );
+
+            if (decstate->curbyte[0] != '\xff') {
+                croak("Tag %" UVuf " row %" IVdf " must have %" IVdf " items!", (UV) CBOR_TAG_COLUMNAR, (IV) r, (IV) keyscount);
+            }
+
+            ++decstate->curbyte;
+        }
+    }
+
+    return newRV_inc( (SV *) hashes );
+}
+
+//----------------------------------------------------------------------
+
 // Sets incomplete_by.
 SV *cbf_decode_one( pTHX_ decode_ctx* decstate ) {
     SV *ret = NULL;
@@ -651,6 +1166,10 @@ SV *cbf_decode_one( pTHX_ decode_ctx* decstate ) {
                 if (decstate->string_decode_mode != CBF_STRING_DECODE_NEVER) SvUTF8_on(ret);
             }
 
+            if (decstate->stringrefs && CONTROL_BYTE_LENGTH_TYPE(control_byte) != CBOR_LENGTH_INDEFINITE) {
+                _note_stringref( aTHX_ decstate, ret );
+            }
+
             break;
         case CBOR_TYPE_ARRAY:
             ret = _decode_array( aTHX_ decstate );
@@ -671,7 +1190,8 @@ SV *cbf_decode_one( pTHX_ decode_ctx* decstate ) {
             UV tagnum = _parse_for_uint_len2( aTHX_ decstate );
             _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
 
-            uint8_t value_major_type = CONTROL_BYTE_MAJOR_TYPE(*decstate->curbyte);
+            uint8_t value_control_byte = *decstate->curbyte;
+            uint8_t value_major_type = CONTROL_BYTE_MAJOR_TYPE(value_control_byte);
 
             if (tagnum == CBOR_TAG_SHAREDREF && decstate->reflist) {
                 if (value_major_type != CBOR_TYPE_UINT) {
@@ -690,6 +1210,66 @@ SV *cbf_decode_one( pTHX_ decode_ctx* decstate ) {
                 ret = decstate->reflist[refnum];
                 SvREFCNT_inc(ret);
             }
+            else if (tagnum == CBOR_TAG_ENCODED_CBOR && value_major_type == CBOR_TYPE_BINARY && (decstate->flags & CBF_FLAG_LAZY_EMBEDDED)) {
+                ret = _decode_str_to_sv( aTHX_ decstate );
+                _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+                if (decstate->stringrefs && CONTROL_BYTE_LENGTH_TYPE(value_control_byte) != CBOR_LENGTH_INDEFINITE) {
+                    _note_stringref( aTHX_ decstate, ret );
+                }
+
+                ret = cbf_new_raw( aTHX_ ret, true );
+            }
+            else if (_decodes_typed_array( decstate, tagnum ) && (value_major_type == CBOR_TYPE_BINARY || (value_major_type == CBOR_TYPE_TAG && decstate->stringrefs))) {
+                SV *bytes;
+
+                if (value_major_type == CBOR_TYPE_BINARY) {
+                    bytes = _decode_str_to_sv( aTHX_ decstate );
+                    _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+                    if (decstate->stringrefs && CONTROL_BYTE_LENGTH_TYPE(value_control_byte) != CBOR_LENGTH_INDEFINITE) {
+                        _note_stringref( aTHX_ decstate, bytes );
+                    }
+                }
+                else {
+
+                    // A stringref to an earlier typed array’s bytes
+                    bytes = cbf_decode_one( aTHX_ decstate );
+                    _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+                }
+
+                ret = _decode_typed_array( aTHX_ decstate, tagnum, bytes );
+            }
+            else if (tagnum == CBOR_TAG_STRINGREF && decstate->stringrefs) {
+                SV *str = _resolve_stringref( aTHX_ decstate );
+                _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+
+                // Short strings get a deliberate copy; see STRINGREF_COW_MIN_LENGTH.
+                if (SvCUR(str) < STRINGREF_COW_MIN_LENGTH) {
+                    ret = newSVpvn( SvPVX(str), SvCUR(str) );
+                    if (SvUTF8(str)) SvUTF8_on(ret);
+                }
+                else {
+
+                    // Perl’s copy-on-write lets this share str’s buffer.
+                    ret = newSV(0);
+                    sv_setsv_flags(ret, str, CBF_SV_COW_FLAGS);
+                }
+            }
+            else if (tagnum == CBOR_TAG_COLUMNAR && !(decstate->flags & CBF_FLAG_KEEP_COLUMNAR)) {
+                ret = _decode_columnar( aTHX_ decstate );
+                _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+            }
+            else if (tagnum == CBOR_TAG_STRINGREF_NAMESPACE) {
+                AV *outer = decstate->stringrefs;
+                decstate->stringrefs = (AV *) sv_2mortal( (SV *) newAV() );
+
+                ret = cbf_decode_one( aTHX_ decstate );
+
+                decstate->stringrefs = outer;
+
+                _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
+            }
             else {
                 ret = cbf_decode_one( aTHX_ decstate );
                 _RETURN_IF_SET_INCOMPLETE(decstate, NULL);
@@ -703,7 +1283,9 @@ SV *cbf_decode_one( pTHX_ decode_ctx* decstate ) {
 
                     decstate->reflist[ decstate->reflistlen - 1 ] = (SV *) ret;
                 }
-
+                else if (tagnum == CBOR_TAG_PERL_OBJECT && (decstate->flags & CBF_FLAG_THAW_OBJECTS)) {
+                    ret = _thaw_object( aTHX_ ret );
+                }
                 else if (decstate->tag_handler) {
                     HV *my_tag_handler = decstate->tag_handler;
 
@@ -844,10 +1426,12 @@ decode_ctx* create_decode_state( pTHX_ SV *cbor, HV *tag_handler, UV flags ) {
 
     decode_state->reflist = NULL;
     decode_state->reflistlen = 0;
+    decode_state->stringrefs = NULL;
     decode_state->flags = flags;
     decode_state->incomplete_by = 0;
 
     decode_state->string_decode_mode = CBF_STRING_DECODE_CBOR;
+    decode_state->typed_array_decode_mode = CBF_TYPED_ARRAY_DECODE_TAG;
 
     if (flags & CBF_FLAG_PRESERVE_REFERENCES) {
         ensure_reflist_exists( aTHX_ decode_state );
@@ -889,6 +1473,10 @@ void free_decode_state( pTHX_ decode_ctx* decode_state) {
 }
 
 SV *cbf_decode_document( pTHX_ decode_ctx *decode_state ) {
+
+    // In case an earlier decode failed inside a namespace:
+    decode_state->stringrefs = NULL;
+
     SV *RETVAL = cbf_decode_one( aTHX_ decode_state );
 
     if (decode_state->incomplete_by) {
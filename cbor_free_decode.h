@@ -7,6 +7,9 @@
 #define CBF_FLAG_PRESERVE_REFERENCES 1
 #define CBF_FLAG_NAIVE_UTF8 2
 #define CBF_FLAG_PERSIST_STATE 4
+#define CBF_FLAG_LAZY_EMBEDDED 8
+#define CBF_FLAG_THAW_OBJECTS 16
+#define CBF_FLAG_KEEP_COLUMNAR 32
 
 //----------------------------------------------------------------------
 // Definitions
@@ -17,6 +20,13 @@ enum cbf_string_decode_mode {
     CBF_STRING_DECODE_ALWAYS
 };
 
+enum cbf_typed_array_decode_mode {
+    CBF_TYPED_ARRAY_DECODE_TAG,     // i.e., like any other tag
+    CBF_TYPED_ARRAY_DECODE_ARRAY,
+    CBF_TYPED_ARRAY_DECODE_PACKED,
+    CBF_TYPED_ARRAY_DECODE_OBJECT
+};
+
 typedef struct {
     char* start;
     STRLEN size;
@@ -28,8 +38,14 @@ typedef struct {
     void **reflist;
     UV reflistlen;
 
+    // The current stringref namespace’s strings, in index order,
+    // or NULL outside of any namespace. (This is mortal.)
+    AV *stringrefs;
+
     enum cbf_string_decode_mode string_decode_mode;
 
+    enum cbf_typed_array_decode_mode typed_array_decode_mode;
+
     UV flags;
 
     STRLEN incomplete_by;
@@ -6,19 +6,42 @@
 
 #include "easyxs/init.h"
 
+#include <errno.h>
+#include <float.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 
 #include "cbor_free_encode.h"
+#include "cbor_free_typedarray.h"
+#include "cbor_free_utf8.h"
 
 #define TAGGED_CLASS    "CBOR::Free::Tagged"
 
 #define IS_SCALAR_REFERENCE(value) SvTYPE(SvRV(value)) <= SVt_PVMG
 
+// The per-node encode functions take the options that most affect
+// them as parameters, which each of the encoder variants (see _encode())
+// passes as constants. Forced inlining lets the compiler resolve those
+// options’ checks at compile time. (The variants also exhaust the
+// compiler’s own inlining budget, so the smallest, hottest helpers
+// need forced inlining, too.)
+#if defined(__GNUC__)
+#   define CBF_FORCE_INLINE static inline __attribute__((always_inline))
+#else
+#   define CBF_FORCE_INLINE static inline
+#endif
+
+// A variant’s _encode_value(). The loops that call this are inlined
+// into each variant, so each call is direct.
+typedef void (*value_encoder)( pTHX_ SV *value, encode_ctx *encode_state );
+
 static const unsigned char NUL = 0;
 static const unsigned char CBOR_NULL_U8  = CBOR_NULL;
 static const unsigned char CBOR_FALSE_U8 = CBOR_FALSE;
 static const unsigned char CBOR_TRUE_U8  = CBOR_TRUE;
+static const unsigned char CBOR_BREAK_U8 = CBOR_BREAK;
 
 static const unsigned char CBOR_INF_SHORT[3] = { 0xf9, 0x7c, 0x00 };
 static const unsigned char CBOR_NAN_SHORT[3] = { 0xf9, 0x7e, 0x00 };
@@ -42,11 +65,6 @@ static HV *tagged_stash = NULL;
         _croak_wide_character( aTHX_ encode_state, sv ); \
     }
 
-#define UTF8_DOWNGRADE_IF_NEEDED(encode_state, to_encode) \
-    if (SvUTF8(to_encode)) { \
-        UTF8_DOWNGRADE_OR_CROAK(encode_state, to_encode); \
-    }
-
 #define STORE_PLAIN_HASH_KEY(encode_state, h_entry, key, key_length, major_type) \
     key = HePV(h_entry, key_length); \
     _init_length_buffer( aTHX_ key_length, major_type, encode_state ); \
@@ -54,23 +72,23 @@ static HV *tagged_stash = NULL;
 
 #define STORE_SORTABLE_HASH_KEY(sortables_entry, h_entry, key, key_length, key_is_utf8) \
     key = HePV(h_entry, key_length); \
-    sortables_entry.is_utf8 = key_is_utf8; \
-    sortables_entry.buffer = key; \
-    sortables_entry.length = key_length;
+    sortables_entry->major_type = key_is_utf8 ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY; \
+    sortables_entry->buffer = key; \
+    sortables_entry->length = key_length;
 
 #define STORE_UPGRADED_SORTABLE_HASH_KEY(sortables_entry, h_entry) \
     SV* key_sv; \
     CBF_HeSVKEY_force(h_entry, key_sv); \
     sv_utf8_upgrade(key_sv); \
-    sortables_entry.is_utf8 = true; \
-    sortables_entry.buffer = SvPV(key_sv, sortables_entry.length);
+    sortables_entry->major_type = CBOR_TYPE_UTF8; \
+    sortables_entry->buffer = SvPV(key_sv, sortables_entry->length);
 
 #define STORE_DOWNGRADED_SORTABLE_HASH_KEY(sortables_entry, h_entry, key_is_utf8) \
     SV* key_sv; \
     CBF_HeSVKEY_force(h_entry, key_sv); \
     UTF8_DOWNGRADE_OR_CROAK(encode_state, key_sv); \
-    sortables_entry.is_utf8 = key_is_utf8; \
-    sortables_entry.buffer = SvPV(key_sv, sortables_entry.length);
+    sortables_entry->major_type = key_is_utf8 ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY; \
+    sortables_entry->buffer = SvPV(key_sv, sortables_entry->length);
 
 //----------------------------------------------------------------------
 
@@ -103,10 +121,29 @@ static inline void _u64_to_buffer( UV num, unsigned char *buffer ) {
 //----------------------------------------------------------------------
 // Croakers
 
+static void _rollback_stream( encode_ctx *encode_state );
+static void _return_output_buffer( encode_ctx *encode_state, STRLEN len );
+
+// Streams keep what they’ve already encoded; everything else
+// just frees its state. (encode_into() first gives its output
+// string back as it was.)
+static void _cleanup_after_error( encode_ctx *encode_state ) {
+    if (encode_state->is_stream) {
+        _rollback_stream(encode_state);
+    }
+    else {
+        if (encode_state->output_sv) {
+            _return_output_buffer( encode_state, encode_state->rollback_len );
+        }
+
+        cbf_encode_ctx_free_all(encode_state);
+    }
+}
+
 static inline void _croak_unrecognized(pTHX_ encode_ctx *encode_state, SV *value) {
     char * words[3] = { "Unrecognized", SvPV_nolen(value), NULL };
 
-    cbf_encode_ctx_free_all(encode_state);
+    _cleanup_after_error(encode_state);
 
     _die( G_DISCARD, words );
 }
@@ -117,14 +154,25 @@ static inline void _croak_wide_character(pTHX_ encode_ctx *encode_state, SV *val
         newSVsv(value),
     };
 
-    cbf_encode_ctx_free_all(encode_state);
+    _cleanup_after_error(encode_state);
+
+    cbf_die_with_arguments( aTHX_ 2, args );
+}
+
+static inline void _croak_invalid_utf8(pTHX_ encode_ctx *encode_state, const char *str, STRLEN len) {
+    SV* args[2] = {
+        newSVpvs("InvalidUTF8"),
+        newSVpvn(str, len),
+    };
+
+    _cleanup_after_error(encode_state);
 
     cbf_die_with_arguments( aTHX_ 2, args );
 }
 
 // This has to be a macro because _croak() needs a string literal.
 #define _croak_encode(encode_state, str) \
-    cbf_encode_ctx_free_all(encode_state); \
+    _cleanup_after_error(encode_state); \
     _croak(str);
 
 //----------------------------------------------------------------------
@@ -133,537 +181,3396 @@ static inline void _croak_wide_character(pTHX_ encode_ctx *encode_state, SV *val
 // keys are only byte-sorted if their lengths are identical. Thus,
 // “z” sorts EARLIER than “aa”. (cf. section 3.9 of the RFC)
 
-#define _SORT(x) ((struct sortable_hash_entry *)x)
+// The CBOR RFC defines canonical sorting such that the
+// *encoded* keys are what gets sorted; however, it’s easier to
+// anticipate the sort order algorithmically rather than to
+// create the encoded keys *then* sort those. Since Perl hash keys
+// are always strings (either with or without the UTF8 flag), we
+// only have 2 CBOR types to deal with (text & binary strings) and
+// can sort accordingly: type, then length, then bytes. The bytes
+// comparison mostly happens via the precomputed prefix. (The
+// integer_keys option adds integer keys, which we sort by type,
+// then argument length, then argument; see struct
+// sortable_hash_entry.)
 
-int _sort_map_keys( const void* a, const void* b ) {
+#define SORTABLES_INSERTION_SORT_MAX 16
 
-    // The CBOR RFC defines canonical sorting such that the
-    // *encoded* keys are what gets sorted; however, it’s easier to
-    // anticipate the sort order algorithmically rather than to
-    // create the encoded keys *then* sort those. Since Perl hash keys
-    // are always strings (either with or without the UTF8 flag), we
-    // only have 2 CBOR types to deal with (text & binary strings) and
-    // can sort accordingly.
+static inline int _cmp_sortables( const struct sortable_hash_entry *a, const struct sortable_hash_entry *b ) {
+    if (a->major_type != b->major_type) return a->major_type < b->major_type ? -1 : 1;
+    if (a->length != b->length) return a->length < b->length ? -1 : 1;
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
 
-    return (
-        _SORT(a)->is_utf8 < _SORT(b)->is_utf8 ? -1
-        : _SORT(a)->is_utf8 > _SORT(b)->is_utf8 ? 1
-        : _SORT(a)->length < _SORT(b)->length ? -1
-        : _SORT(a)->length > _SORT(b)->length ? 1
-        : memcmp( _SORT(a)->buffer, _SORT(b)->buffer, _SORT(a)->length )
-    );
+    if (a->length <= sizeof(a->prefix)) return 0;
+
+    return memcmp( a->buffer + sizeof(a->prefix), b->buffer + sizeof(b->prefix), a->length - sizeof(a->prefix) );
 }
 
-//----------------------------------------------------------------------
+static inline uint64_t _sortable_prefix( const char *buffer, STRLEN length ) {
+    uint64_t prefix = 0;
 
-static inline HV *_get_tagged_stash() {
-    if (!tagged_stash) {
-        dTHX;
-        tagged_stash = gv_stashpv(TAGGED_CLASS, 1);
+    STRLEN i;
+    for (i=0; i<sizeof(prefix); i++) {
+        prefix <<= 8;
+        if (i < length) prefix |= (uint8_t) buffer[i];
     }
 
-    return tagged_stash;
+    return prefix;
 }
 
-static inline void _COPY_INTO_ENCODE( encode_ctx *encode_state, const unsigned char *hdr, STRLEN len) {
-    if ( (len + encode_state->len) > encode_state->buflen ) {
-        Renew( encode_state->buffer, encode_state->buflen + len + ENCODE_ALLOC_CHUNK_SIZE, char );
-        encode_state->buflen += len + ENCODE_ALLOC_CHUNK_SIZE;
-    }
+#define _SWAP_SORTABLES(a, b) STMT_START { \
+    struct sortable_hash_entry tmp = a;     \
+    a = b;                                  \
+    b = tmp;                                \
+} STMT_END
 
-    Copy( hdr, encode_state->buffer + encode_state->len, len, char );
-    encode_state->len += len;
-}
+static void _insertion_sort_sortables( struct sortable_hash_entry *entries, STRLEN count ) {
+    STRLEN i, j;
 
-// TODO? This could be a macro … it’d just be kind of unwieldy as such.
-static inline void _init_length_buffer( pTHX_ UV num, enum CBOR_TYPE major_type, encode_ctx *encode_state ) {
-    uint8_t* control_byte_p = (void *) encode_state->scratch;
-    *control_byte_p = major_type << CONTROL_BYTE_MAJOR_TYPE_SHIFT;
+    for (i=1; i<count; i++) {
+        struct sortable_hash_entry cur = entries[i];
 
-    if ( num < CBOR_LENGTH_SMALL ) {
-        *control_byte_p |= (uint8_t) num;
+        for (j=i; j > 0 && _cmp_sortables(&cur, entries + j - 1) < 0; j--) {
+            entries[j] = entries[j - 1];
+        }
 
-        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 1);
+        entries[j] = cur;
     }
-    else if ( num <= 0xff ) {
-        *control_byte_p |= CBOR_LENGTH_SMALL;
-        encode_state->scratch[1] = (uint8_t) num;
+}
 
-        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 2);
-    }
-    else if ( num <= 0xffff ) {
-        *control_byte_p |= CBOR_LENGTH_MEDIUM;
+static void _sift_down_sortables( struct sortable_hash_entry *entries, STRLEN root, STRLEN count ) {
+    STRLEN child;
+
+    while ( (child = 2 * root + 1) < count ) {
+        if (child + 1 < count && _cmp_sortables(entries + child, entries + child + 1) < 0) {
+            child++;
+        }
 
-        _u16_to_buffer( num, 1 + encode_state->scratch );
+        if (_cmp_sortables(entries + root, entries + child) >= 0) return;
 
-        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 3);
+        _SWAP_SORTABLES( entries[root], entries[child] );
+        root = child;
     }
-    else if ( num <= 0xffffffffU ) {
-        *control_byte_p |= CBOR_LENGTH_LARGE;
+}
 
-        _u32_to_buffer( num, 1 + encode_state->scratch );
+static void _heap_sort_sortables( struct sortable_hash_entry *entries, STRLEN count ) {
+    STRLEN i;
 
-        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 5);
+    for (i = count / 2; i > 0; i--) {
+        _sift_down_sortables( entries, i - 1, count );
     }
-    else {
-        *control_byte_p |= CBOR_LENGTH_HUGE;
-
-        _u64_to_buffer( num, 1 + encode_state->scratch );
 
-        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 9);
+    for (i = count - 1; i > 0; i--) {
+        _SWAP_SORTABLES( entries[0], entries[i] );
+        _sift_down_sortables( entries, 0, i );
     }
 }
 
-void _encode( pTHX_ SV *value, encode_ctx *encode_state );
-static inline void _encode_tag( pTHX_ IV tagnum, SV *value, encode_ctx *encode_state );
+// An introsort: quicksort (median-of-three, Hoare partition) that
+// falls back to heapsort if it recurses too deeply, with insertion
+// sort for small ranges. Unlike qsort() the comparison is inlined.
+static void _introsort_sortables( struct sortable_hash_entry *entries, STRLEN count, unsigned depth_limit ) {
+    while (count > SORTABLES_INSERTION_SORT_MAX) {
+        if (!depth_limit) {
+            _heap_sort_sortables( entries, count );
+            return;
+        }
 
-// Return indicates to encode the actual value.
-bool _check_reference( pTHX_ SV *varref, encode_ctx *encode_state ) {
-    if ( SvREFCNT(varref) > 1 ) {
-        void *this_ref;
+        depth_limit--;
 
-        IV r = 0;
+        STRLEN mid = count / 2;
 
-        while ( (this_ref = encode_state->reftracker[r++]) ) {
-            if (this_ref == varref) {
-                _init_length_buffer( aTHX_ CBOR_TAG_SHAREDREF, CBOR_TYPE_TAG, encode_state );
-                _init_length_buffer( aTHX_ r - 1, CBOR_TYPE_UINT, encode_state );
-                return false;
-            }
+        if (_cmp_sortables(entries + mid, entries) < 0) _SWAP_SORTABLES( entries[0], entries[mid] );
+        if (_cmp_sortables(entries + count - 1, entries) < 0) _SWAP_SORTABLES( entries[0], entries[count - 1] );
+        if (_cmp_sortables(entries + count - 1, entries + mid) < 0) _SWAP_SORTABLES( entries[mid], entries[count - 1] );
+
+        struct sortable_hash_entry pivot = entries[mid];
+
+        SSize_t i = -1;
+        SSize_t j = count;
+
+        while (1) {
+            do { i++; } while (_cmp_sortables(entries + i, &pivot) < 0);
+            do { j--; } while (_cmp_sortables(&pivot, entries + j) < 0);
+
+            if (i >= j) break;
+
+            _SWAP_SORTABLES( entries[i], entries[j] );
         }
 
-        Renew( encode_state->reftracker, 1 + r, void * );
-        encode_state->reftracker[r - 1] = varref;
-        encode_state->reftracker[r] = NULL;
+        // Recurse into the smaller side; loop on the larger.
+        STRLEN left_count = j + 1;
 
-        _init_length_buffer( aTHX_ CBOR_TAG_SHAREABLE, CBOR_TYPE_TAG, encode_state );
+        if (left_count < count - left_count) {
+            _introsort_sortables( entries, left_count, depth_limit );
+            entries += left_count;
+            count -= left_count;
+        }
+        else {
+            _introsort_sortables( entries + left_count, count - left_count, depth_limit );
+            count = left_count;
+        }
     }
 
-    return true;
+    _insertion_sort_sortables( entries, count );
+}
+
+static void _sort_sortables( struct sortable_hash_entry *entries, STRLEN count ) {
+    unsigned depth_limit = 0;
+
+    STRLEN i;
+    for (i=0; i<count; i++) {
+        if (entries[i].major_type > CBOR_TYPE_NEGINT) {
+            entries[i].prefix = _sortable_prefix( entries[i].buffer, entries[i].length );
+        }
+    }
+
+    for (i=count; i; i >>= 1) depth_limit += 2;
+
+    _introsort_sortables( entries, count, depth_limit );
 }
 
-static inline I32 _magic_safe_hv_iterinit( pTHX_ HV* hash ) {
-    I32 count;
+// Reserves count entries in the sortables arena and returns the
+// offset of the first. Return the space via _release_sortables().
+static inline STRLEN _reserve_sortables( encode_ctx *encode_state, STRLEN count ) {
+    STRLEN base = encode_state->sortables_used;
 
-    if (SvMAGICAL(hash)) {
-        count = 0;
+    if (base + count > encode_state->sortables_size) {
+        STRLEN newsize = encode_state->sortables_size << 1;
 
-        while (hv_iternext(hash)) count++;
+        if (newsize < base + count) newsize = base + count;
 
-        hv_iterinit(hash);
+        Renew( encode_state->sortables, newsize, struct sortable_hash_entry );
+        encode_state->sortables_size = newsize;
     }
-    else {
-        count = hv_iterinit(hash);
+
+    encode_state->sortables_used += count;
+
+    return base;
+}
+
+static inline void _release_sortables( encode_ctx *encode_state, STRLEN base ) {
+    encode_state->sortables_used = base;
+}
+
+// A TO_CBOR method (for example) can delete a hash’s entries before
+// we encode them, which would free their values and keys. So sorted
+// and shaped frames hold references to their values, and sorted
+// frames copy their keys. _release_values() drops the references.
+static void _hold_values( pTHX_ encode_ctx *encode_state, cbf_encode_frame *frame ) {
+    struct sortable_hash_entry *entries = encode_state->sortables + frame->sortables_base;
+    SSize_t i;
+
+    for (i=0; i<frame->count; i++) {
+        SvREFCNT_inc_simple_void( entries[i].value );
     }
+}
 
-    return count;
+static void _release_values( pTHX_ encode_ctx *encode_state, cbf_encode_frame *frame ) {
+    struct sortable_hash_entry *entries = encode_state->sortables + frame->sortables_base;
+    SSize_t i;
+
+    for (i=0; i<frame->count; i++) {
+        SvREFCNT_dec( entries[i].value );
+    }
 }
 
-static inline void _encode_string_sv( pTHX_ encode_ctx* encode_state, SV* value ) {
-    char *val = SvPOK(value) ? SvPVX(value) : SvPV_nolen(value);
+// HEK copies in the key-copies arena start at multiples of this.
+#define KEY_COPY_ALIGN sizeof(U32)
 
-    STRLEN len = SvCUR(value);
+// Reserves size bytes in the key-copies arena for the frame, which
+// returns them when it pops. The space starts at frame->keys_base,
+// which is suitably aligned for a HEK.
+static char *_reserve_key_copies( encode_ctx *encode_state, cbf_encode_frame *frame, STRLEN size ) {
+    STRLEN base = (encode_state->key_copies_used + KEY_COPY_ALIGN - 1) & ~(KEY_COPY_ALIGN - 1);
 
-    bool encode_as_text = !!SvUTF8(value);
+    if (base + size > encode_state->key_copies_size) {
+        STRLEN newsize = encode_state->key_copies_size << 1;
 
-    /*
-    if (!encode_as_text) {
-        STRLEN i;
-        for (i=0; i<len; i++) {
-            if (val[i] & 0x80) break;
-        }
+        if (newsize < base + size) newsize = base + size;
 
-        // Encode as text if there were no high-bit octets.
-        encode_as_text = (i == len);
+        Renew( encode_state->key_copies, newsize, char );
+        encode_state->key_copies_size = newsize;
     }
-    */
 
-    _init_length_buffer( aTHX_
-        len,
-        (encode_as_text ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY),
-        encode_state
-    );
+    encode_state->key_copies_used = base + size;
+    frame->keys_base = frame->key_offset = base;
 
-    _COPY_INTO_ENCODE( encode_state, (unsigned char *) val, len );
+    return encode_state->key_copies + base;
 }
 
-static inline void _encode_string_unicode( pTHX_ encode_ctx* encode_state, SV* value ) {
-    SV *to_encode;
+// Copies the sorted frame’s string keys, in order, into the
+// key-copies arena, whence _encode_sortable_key() reads them.
+static void _copy_sorted_keys( encode_ctx *encode_state, cbf_encode_frame *frame ) {
+    struct sortable_hash_entry *entries = encode_state->sortables + frame->sortables_base;
+    STRLEN size = 0;
+    SSize_t i;
 
-    if (SvUTF8(value)) {
-        to_encode = value;
+    for (i=0; i<frame->count; i++) {
+        if (entries[i].major_type > CBOR_TYPE_NEGINT) size += entries[i].length;
     }
-    else {
-        to_encode = newSVsv(value);
-        sv_2mortal(to_encode);
 
-        sv_utf8_upgrade(to_encode);
+    char *dest = _reserve_key_copies( encode_state, frame, size );
+
+    for (i=0; i<frame->count; i++) {
+        if (entries[i].major_type > CBOR_TYPE_NEGINT) {
+            Copy( entries[i].buffer, dest, entries[i].length, char );
+            dest += entries[i].length;
+        }
     }
+}
+
+// The space that a copy of the HEK takes in the key-copies arena.
+// (A HEK’s flags follow its key’s trailing NUL.)
+static inline STRLEN _hek_copy_size( const HEK *hek ) {
+    STRLEN size = STRUCT_OFFSET(HEK, hek_key) + HEK_LEN(hek) + 2;
 
-    _encode_string_sv( aTHX_ encode_state, to_encode );
+    return (size + KEY_COPY_ALIGN - 1) & ~(KEY_COPY_ALIGN - 1);
 }
 
-static inline void _encode_string_utf8( pTHX_ encode_ctx* encode_state, SV* value ) {
-    SV *to_encode = newSVsv(value);
-    sv_2mortal(to_encode);
+// Copies the columnar frame’s keys’ HEKs, in column order, into the
+// key-copies arena. The frame looks up each row’s values by these
+// rather than by the first row’s entries, which a TO_CBOR method
+// (for example) can delete.
+static void _copy_columnar_keys( encode_ctx *encode_state, cbf_encode_frame *frame ) {
+    struct sortable_hash_entry *keys = encode_state->sortables + frame->sortables_base;
+    STRLEN size = 0;
+    SSize_t k;
+
+    for (k=0; k<frame->columns; k++) {
+        size += _hek_copy_size( HeKEY_hek(keys[k].h_entry) );
+    }
 
-    UTF8_DOWNGRADE_IF_NEEDED(encode_state, to_encode);
+    char *dest = _reserve_key_copies( encode_state, frame, size );
 
-    SvUTF8_on(to_encode);
+    for (k=0; k<frame->columns; k++) {
+        const HEK *hek = HeKEY_hek(keys[k].h_entry);
 
-    _encode_string_sv( aTHX_ encode_state, to_encode );
+        Copy( hek, dest, STRUCT_OFFSET(HEK, hek_key) + HEK_LEN(hek) + 2, char );
+        dest += _hek_copy_size(hek);
+    }
 }
 
-static inline void _encode_string_octets( pTHX_ encode_ctx* encode_state, SV* value ) {
-    SV *to_encode = newSVsv(value);
-    sv_2mortal(to_encode);
+// Pops all frames, releasing whatever they hold. This is for when
+// an encode fails, so it writes nothing.
+static void _unwind_stack( encode_ctx *encode_state ) {
+    dTHX;
 
-    UTF8_DOWNGRADE_IF_NEEDED(encode_state, to_encode);
+    while (encode_state->stack_used) {
+        cbf_encode_frame *frame = encode_state->stack + --encode_state->stack_used;
 
-    _encode_string_sv( aTHX_ encode_state, to_encode );
-}
+        switch (frame->type) {
+            case CBF_FRAME_SHAPED_HASH:
+                ((cbf_shape *) frame->container)->busy--;
 
-static inline void _upgrade_and_store_hash_key( pTHX_ HE* h_entry, encode_ctx *encode_state ) {
-    SV* key_sv;
-    CBF_HeSVKEY_force(h_entry, key_sv);
-    sv_utf8_upgrade(key_sv);
-    _encode_string_sv( aTHX_ encode_state, key_sv );
-}
+                // fall through
 
-static inline void _downgrade_and_store_hash_key( pTHX_ HE* h_entry, encode_ctx *encode_state, enum CBOR_TYPE string_type ) {
-    SV* key_sv;
-    CBF_HeSVKEY_force(h_entry, key_sv);
-    UTF8_DOWNGRADE_OR_CROAK(encode_state, key_sv);
+            case CBF_FRAME_SORTED_HASH:
+                _release_values( aTHX_ encode_state, frame );
+                break;
+
+            default:
+                break;
+        }
 
-    // We can do this without altering h_entry itself because
-    // key_sv is just a mortal copy of the key.
-    if (string_type == CBOR_TYPE_UTF8) SvUTF8_on(key_sv);
+        if (frame->type != CBF_FRAME_SHAPED_HASH) {
+            SvREFCNT_dec( (SV *) frame->container );
+        }
+    }
 
-    _encode_string_sv( aTHX_ encode_state, key_sv );
+    encode_state->sortables_used = 0;
+    encode_state->key_copies_used = 0;
 }
 
-void _encode( pTHX_ SV *value, encode_ctx *encode_state ) {
-    ++encode_state->recurse_count;
+//----------------------------------------------------------------------
+
+static inline HV *_get_tagged_stash() {
+    if (!tagged_stash) {
+        dTHX;
+        tagged_stash = gv_stashpv(TAGGED_CLASS, 1);
+    }
 
-    if (encode_state->recurse_count > MAX_ENCODE_RECURSE) {
+    return tagged_stash;
+}
 
-        // call_pv() killed the process in Win32; this seems to fix that.
-        static char * words[] = { NULL };
-        call_argv("CBOR::Free::_die_recursion", G_EVAL|G_DISCARD, words);
+// Grow geometrically so that large documents need only O(log n)
+// reallocations rather than one per ENCODE_ALLOC_CHUNK_SIZE.
+static void _grow_encode_buffer( encode_ctx *encode_state, STRLEN needed ) {
+    STRLEN newlen = encode_state->buflen << 1;
 
-        _croak_encode( encode_state, NULL );
+    if (newlen < encode_state->len + needed) {
+        newlen = encode_state->len + needed + ENCODE_ALLOC_CHUNK_SIZE;
     }
 
-    SvGETMAGIC(value);
+    Renew( encode_state->buffer, newlen, char );
+    encode_state->buflen = newlen;
+}
 
-    if (!SvROK(value)) {
+static void _write_to_output( encode_ctx *encode_state, const char *buf, STRLEN len ) {
+    if (encode_state->counting) {
+        encode_state->flushed_len += len;
+        return;
+    }
 
-        if (SvIOK(value)) {
-            IV val = SvIVX(value);
+    dTHX;
 
-            // In testing, Perl’s (0 + ~0) evaluated as < 0 here,
-            // but the SvUOK() check fixes that.
-            if (val < 0 && !SvUOK(value)) {
-                _init_length_buffer( aTHX_ -(++val), CBOR_TYPE_NEGINT, encode_state );
-            }
-            else {
-                // NB: SvUOK doesn’t work to identify nonnegatives … ?
-                _init_length_buffer( aTHX_ val, CBOR_TYPE_UINT, encode_state );
-            }
+    if (encode_state->output_fh) {
+        if (PerlIO_write( encode_state->output_fh, buf, len ) != (SSize_t) len) {
+            int err = errno;
+
+            cbf_encode_ctx_free_all(encode_state);
+            croak("Failed to write CBOR to filehandle: %s", strerror(err));
         }
-        else if (SvNOK(value)) {
-            NV val_nv = SvNVX(value);
+    }
+    else {
+        dSP;
 
-            if (Perl_isnan(val_nv)) {
-                _COPY_INTO_ENCODE(encode_state, CBOR_NAN_SHORT, 3);
-            }
-            else if (Perl_isinf(val_nv)) {
-                if (val_nv > 0) {
-                    _COPY_INTO_ENCODE(encode_state, CBOR_INF_SHORT, 3);
-                }
-                else {
-                    _COPY_INTO_ENCODE(encode_state, CBOR_NEGINF_SHORT, 3);
-                }
-            }
-            else {
+        ENTER;
+        SAVETMPS;
 
-                // Typecast to a double to accommodate long-double perls.
-                double val = (double) val_nv;
+        PUSHMARK(SP);
+        XPUSHs( sv_2mortal( newSVpvn(buf, len) ) );
+        PUTBACK;
 
-                char *valptr = (char *) &val;
+        call_sv( encode_state->output_cb, G_DISCARD | G_EVAL );
 
-#if IS_LITTLE_ENDIAN
-                encode_state->scratch[0] = CBOR_DOUBLE;
-                encode_state->scratch[1] = valptr[7];
-                encode_state->scratch[2] = valptr[6];
-                encode_state->scratch[3] = valptr[5];
-                encode_state->scratch[4] = valptr[4];
-                encode_state->scratch[5] = valptr[3];
-                encode_state->scratch[6] = valptr[2];
-                encode_state->scratch[7] = valptr[1];
-                encode_state->scratch[8] = valptr[0];
-
-                _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 9);
-#else
-                unsigned char bytes[9] = { CBOR_DOUBLE, valptr[0], valptr[1], valptr[2], valptr[3], valptr[4], valptr[5], valptr[6], valptr[7] };
-                _COPY_INTO_ENCODE(encode_state, bytes, 9);
-#endif
-            }
-        }
-        else if (!SvOK(value)) {
-            _COPY_INTO_ENCODE(encode_state, &CBOR_NULL_U8, 1);
-        }
-        else {
-            switch (encode_state->string_encode_mode) {
-                case CBF_STRING_ENCODE_SV:
-                    _encode_string_sv( aTHX_ encode_state, value );
-                    break;
-                case CBF_STRING_ENCODE_UNICODE:
-                    _encode_string_unicode( aTHX_ encode_state, value );
-                    break;
-                case CBF_STRING_ENCODE_UTF8:
-                    _encode_string_utf8( aTHX_ encode_state, value );
-                    break;
-                case CBF_STRING_ENCODE_OCTETS:
-                    _encode_string_octets( aTHX_ encode_state, value );
-                    break;
+        FREETMPS;
+        LEAVE;
 
-                default:
-                    assert(0);
-            }
+        if (SvTRUE(ERRSV)) {
+            cbf_encode_ctx_free_all(encode_state);
+            _croak(NULL);
         }
     }
-    else if (sv_isobject(value)) {
-        HV *stash = SvSTASH( SvRV(value) );
 
-        if (_get_tagged_stash() == stash) {
-            AV *array = (AV *)SvRV(value);
-            SV **tag = av_fetch(array, 0, 0);
-            IV tagnum = SvIV(*tag);
+    encode_state->flushed_len += len;
+}
 
-            _encode_tag( aTHX_ tagnum, *(av_fetch(array, 1, 0)), encode_state );
-        }
-        else if (cbf_get_boolean_stash() == stash) {
-            _COPY_INTO_ENCODE(
-                encode_state,
-                SvTRUE(SvRV(value)) ? &CBOR_TRUE_U8 : &CBOR_FALSE_U8,
-                1
-            );
-        }
+static inline void _flush_encode_buffer( encode_ctx *encode_state ) {
+    if (encode_state->len) {
+        _write_to_output( encode_state, encode_state->buffer, encode_state->len );
+        encode_state->len = 0;
+    }
+}
+
+// Whether the output so far can leave the buffer. It can’t while a
+// length header awaits its back-patch or while stringrefs mode needs
+// to see the string that’s being output.
+static inline bool _can_cut_buffer( encode_ctx *encode_state ) {
+    return !encode_state->pending_patches && !encode_state->pin_buffer;
+}
+
+// Whether to flush (rather than grow) a full buffer.
+static inline bool _can_flush( encode_ctx *encode_state ) {
+    return (encode_state->output_fh || encode_state->output_cb || encode_state->counting) && _can_cut_buffer(encode_state);
+}
 
-        // TODO: Support TO_JSON() or TO_CBOR() method?
+// Returns true if hdr was written out directly, which happens
+// when we stream output and hdr is bigger than the buffer.
+static bool _make_room_to_encode( encode_ctx *encode_state, const unsigned char *hdr, STRLEN len ) {
+    if (_can_flush(encode_state)) {
+        _flush_encode_buffer(encode_state);
 
-        else _croak_unrecognized(aTHX_ encode_state, value);
+        if (len > encode_state->buflen) {
+            _write_to_output( encode_state, (const char *) hdr, len );
+            return true;
+        }
+    }
+    else {
+        _grow_encode_buffer( encode_state, len );
     }
-    else if (SVt_PVAV == SvTYPE(SvRV(value))) {
-        AV *array = (AV *)SvRV(value);
 
-        if (!encode_state->reftracker || _check_reference( aTHX_ (SV *)array, encode_state )) {
-            SSize_t len;
-            len = 1 + av_len(array);
+    return false;
+}
 
-            _init_length_buffer( aTHX_ len, CBOR_TYPE_ARRAY, encode_state );
+CBF_FORCE_INLINE void _COPY_INTO_ENCODE( encode_ctx *encode_state, const unsigned char *hdr, STRLEN len) {
+    if ( (len + encode_state->len) > encode_state->buflen ) {
+        if (_make_room_to_encode( encode_state, hdr, len )) return;
+    }
 
-            SSize_t i;
+    Copy( hdr, encode_state->buffer + encode_state->len, len, char );
+    encode_state->len += len;
+}
 
-            SV **cur;
-            for (i=0; i<len; i++) {
-                cur = av_fetch(array, i, 0);
-                _encode( aTHX_ *cur, encode_state );
-            }
-        }
+//----------------------------------------------------------------------
+// encode_iov()
+//
+// Rather than copy a long string into the buffer, encode_iov() ends
+// the current segment with the string’s head and makes the string a
+// segment of its own: a copy-on-write copy of the string’s SV, which
+// shares that SV’s buffer.
+
+// Moves the buffer’s contents to a new segment.
+static void _end_iov_segment( pTHX_ encode_ctx *encode_state ) {
+    if (encode_state->len) {
+        av_push( encode_state->iov, newSVpvn( encode_state->buffer, encode_state->len ) );
+        encode_state->len = 0;
     }
-    else if (SVt_PVHV == SvTYPE(SvRV(value))) {
-        HV *hash = (HV *)SvRV(value);
+}
 
-        if (!encode_state->reftracker || _check_reference( aTHX_ (SV *)hash, encode_state)) {
-            char *key;
-            STRLEN key_length;
+// sv_setsv() only copies on write by default in the Perl core.
+#ifdef SV_COW_OTHER_PVS
+#   define CBF_SV_COW_FLAGS (SV_COW_SHARED_HASH_KEYS | SV_COW_OTHER_PVS)
+#else
+#   define CBF_SV_COW_FLAGS 0
+#endif
 
-            HE* h_entry;
-            bool heutf8;
+static void _add_iov_string( pTHX_ encode_ctx *encode_state, SV *value ) {
+    _end_iov_segment( aTHX_ encode_state );
 
-            I32 keyscount = _magic_safe_hv_iterinit(aTHX_ hash);
+    SV *segment = newSV(0);
 
-            _init_length_buffer( aTHX_ keyscount, CBOR_TYPE_MAP, encode_state );
+    // Not SvSetSV(), which would take a temp’s buffer from it.
+    sv_setsv_flags( segment, value, SV_NOSTEAL | CBF_SV_COW_FLAGS );
 
-            if (encode_state->is_canonical) {
-                I32 curkey = 0;
-
-                struct sortable_hash_entry sortables[keyscount];
-
-                while ( (h_entry = hv_iternext(hash)) ) {
-                    heutf8 = HeUTF8(h_entry);
-
-                    switch (encode_state->string_encode_mode) {
-                        case CBF_STRING_ENCODE_SV:
-                            if (heutf8 || !CBF_HeUTF8(h_entry)) {
-                                STORE_SORTABLE_HASH_KEY( sortables[curkey], h_entry, key, key_length, heutf8 );
-                            }
-                            else {
-                                STORE_UPGRADED_SORTABLE_HASH_KEY(sortables[curkey], h_entry);
-                            }
-
-                            break;
-
-                        case CBF_STRING_ENCODE_UNICODE:
-                            if (heutf8) {
-                                STORE_SORTABLE_HASH_KEY( sortables[curkey], h_entry, key, key_length, true );
-                            }
-                            else {
-                                STORE_UPGRADED_SORTABLE_HASH_KEY(sortables[curkey], h_entry);
-                            }
-                            break;
-
-                        case CBF_STRING_ENCODE_UTF8:
-                        case CBF_STRING_ENCODE_OCTETS:
-                            if (heutf8) {
-                                STORE_DOWNGRADED_SORTABLE_HASH_KEY(sortables[curkey], h_entry, encode_state->string_encode_mode == CBF_STRING_ENCODE_UTF8);
-                            }
-                            else {
-                                STORE_SORTABLE_HASH_KEY( sortables[curkey], h_entry, key, key_length, encode_state->string_encode_mode == CBF_STRING_ENCODE_UTF8 );
-                            }
-                            break;
-
-                        default:
-                            assert(0);
-                    }
+    // The segment is just bytes, whatever value was.
+    SvPOK_only(segment);
 
-                    sortables[curkey].value = hv_iterval(hash, h_entry);
+    av_push( encode_state->iov, segment );
+}
 
-                    curkey++;
-                }
+// Outputs the len bytes at str, which must be value’s string.
+CBF_FORCE_INLINE void _COPY_SV_STRING_INTO_ENCODE( pTHX_ encode_ctx *encode_state, SV *value, const unsigned char *str, STRLEN len ) {
+    if (encode_state->iov
+        && len >= encode_state->iov_threshold
+        && _can_cut_buffer(encode_state)
+        && SvPOK(value) && (const char *) str == SvPVX(value) && len == SvCUR(value)
+    ) {
+        _add_iov_string( aTHX_ encode_state, value );
+        return;
+    }
 
-                qsort(sortables, keyscount, sizeof(struct sortable_hash_entry), _sort_map_keys);
+    _COPY_INTO_ENCODE( encode_state, str, len );
+}
 
-                for (curkey=0; curkey < keyscount; ++curkey) {
-                    _init_length_buffer( aTHX_ sortables[curkey].length, sortables[curkey].is_utf8 ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY, encode_state );
-                    _COPY_INTO_ENCODE( encode_state, (unsigned char *) sortables[curkey].buffer, sortables[curkey].length );
+// TODO? This could be a macro … it’d just be kind of unwieldy as such.
+// Writes a CBOR head (i.e., control byte plus argument) into dest and
+// returns its length, which is never more than 9.
+static inline STRLEN _write_length_header( uint8_t *dest, UV num, enum CBOR_TYPE major_type ) {
+    *dest = major_type << CONTROL_BYTE_MAJOR_TYPE_SHIFT;
 
-                    _encode( aTHX_ sortables[curkey].value, encode_state );
-                }
-            }
-            else {
-                while ( (h_entry = hv_iternext(hash)) ) {
-
-                    /*
-                    fprintf(stderr, "HeSVKEY: %p\n", HeSVKEY(h_entry));
-                    fprintf(stderr, "HeUTF8: %d\n", HeUTF8(h_entry));
-                    fprintf(stderr, "CBF_HeUTF8: %d\n", CBF_HeUTF8(h_entry));
-                    */
-
-                    switch (encode_state->string_encode_mode) {
-                        case CBF_STRING_ENCODE_SV:
-                            if (HeUTF8(h_entry) || !CBF_HeUTF8(h_entry)) {
-                                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, HeUTF8(h_entry) ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY );
-                            }
-                            else {
-                                _upgrade_and_store_hash_key( aTHX_ h_entry, encode_state);
-                            }
-                            break;
-
-                        case CBF_STRING_ENCODE_UNICODE:
-                            if (HeUTF8(h_entry)) {
-                                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_UTF8 );
-                            }
-                            else {
-                                _upgrade_and_store_hash_key( aTHX_ h_entry, encode_state);
-
-                            }
-                            break;
-
-                        case CBF_STRING_ENCODE_UTF8:
-                            if (HeUTF8(h_entry)) {
-                                _downgrade_and_store_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_UTF8 );
-                            }
-                            else {
-                                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_UTF8 );
-                            }
-
-                            break;
-
-                        case CBF_STRING_ENCODE_OCTETS:
-                            if (HeUTF8(h_entry)) {
-                                _downgrade_and_store_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_BINARY );
-                            }
-                            else {
-                                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_BINARY );
-                            }
-
-                            break;
-
-                        default:
-                            assert(0);
-                    }
+    if ( num < CBOR_LENGTH_SMALL ) {
+        *dest |= (uint8_t) num;
+        return 1;
+    }
 
-                    _encode( aTHX_ hv_iterval(hash, h_entry), encode_state );
-                }
-            }
-        }
+    if ( num <= 0xff ) {
+        *dest |= CBOR_LENGTH_SMALL;
+        dest[1] = (uint8_t) num;
+        return 2;
     }
-    else if (encode_state->encode_scalar_refs && IS_SCALAR_REFERENCE(value)) {
-        SV *referent = SvRV(value);
 
-        if (!encode_state->reftracker || _check_reference( aTHX_ referent, encode_state)) {
-            _encode_tag( aTHX_ CBOR_TAG_INDIRECTION, referent, encode_state );
-        }
+    if ( num <= 0xffff ) {
+        *dest |= CBOR_LENGTH_MEDIUM;
+        _u16_to_buffer( num, 1 + dest );
+        return 3;
     }
-    else {
-        _croak_unrecognized(aTHX_ encode_state, value);
+
+    if ( num <= 0xffffffffU ) {
+        *dest |= CBOR_LENGTH_LARGE;
+        _u32_to_buffer( num, 1 + dest );
+        return 5;
     }
 
-    --encode_state->recurse_count;
+    *dest |= CBOR_LENGTH_HUGE;
+    _u64_to_buffer( num, 1 + dest );
+    return 9;
 }
 
-static inline void _encode_tag( pTHX_ IV tagnum, SV *value, encode_ctx *encode_state ) {
-    _init_length_buffer( aTHX_ tagnum, CBOR_TYPE_TAG, encode_state );
-    _encode( aTHX_ value, encode_state );
+CBF_FORCE_INLINE void _init_length_buffer( pTHX_ UV num, enum CBOR_TYPE major_type, encode_ctx *encode_state ) {
+    STRLEN hdrlen = _write_length_header( encode_state->scratch, num, major_type );
+
+    _COPY_INTO_ENCODE(encode_state, encode_state->scratch, hdrlen);
 }
 
-//----------------------------------------------------------------------
+static inline void _init_indefinite_header( enum CBOR_TYPE major_type, encode_ctx *encode_state ) {
+    encode_state->scratch[0] = (major_type << CONTROL_BYTE_MAJOR_TYPE_SHIFT) | CBOR_LENGTH_INDEFINITE;
+
+    _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 1);
+}
+
+void _encode( pTHX_ SV *value, encode_ctx *encode_state );
+static inline void _encode_tag( pTHX_ IV tagnum, SV *value, encode_ctx *encode_state );
+
+static inline UV _reftracker_slot( void *ref, UV size ) {
+
+    // Referents are aligned, so discard the low bits, then use
+    // Fibonacci hashing to spread the rest across the table.
+    UV hash = (UV) PTR2nat(ref) >> 3;
 
-encode_ctx cbf_encode_ctx_create(uint8_t flags, enum cbf_string_encode_mode string_encode_mode) {
-    encode_ctx encode_state;
+#if IS_64_BIT
+    hash *= (UV) 0x9e3779b97f4a7c15ULL;
+    hash >>= 32;
+#else
+    hash *= (UV) 0x9e3779b9U;
+    hash >>= 16;
+#endif
 
-    encode_state.buffer = NULL;
-    Newx( encode_state.buffer, ENCODE_ALLOC_CHUNK_SIZE, char );
+    return hash & (size - 1);
+}
 
-    encode_state.buflen = ENCODE_ALLOC_CHUNK_SIZE;
-    encode_state.len = 0;
-    encode_state.recurse_count = 0;
+static void _reftracker_grow( cbf_reftracker *reftracker ) {
+    struct cbf_reftracker_entry *old_entries = reftracker->entries;
+    UV old_size = reftracker->size;
 
-    encode_state.is_canonical = !!(flags & ENCODE_FLAG_CANONICAL);
+    UV new_size = old_size ? (old_size << 1) : ENCODE_REFTRACKER_INITIAL_SIZE;
 
-    encode_state.text_keys = !!(flags & ENCODE_FLAG_TEXT_KEYS);
+    Newxz( reftracker->entries, new_size, struct cbf_reftracker_entry );
+    reftracker->size = new_size;
 
-    encode_state.encode_scalar_refs = !!(flags & ENCODE_FLAG_SCALAR_REFS);
+    UV i, slot;
+    for (i=0; i<old_size; i++) {
+        if (old_entries[i].ref) {
+            slot = _reftracker_slot( old_entries[i].ref, new_size );
 
-    if (flags & ENCODE_FLAG_PRESERVE_REFS) {
-        Newxz( encode_state.reftracker, 1, void * );
-    }
-    else {
-        encode_state.reftracker = NULL;
-    }
+            while (reftracker->entries[slot].ref) {
+                slot = (slot + 1) & (new_size - 1);
+            }
 
-    encode_state.string_encode_mode = string_encode_mode;
+            reftracker->entries[slot] = old_entries[i];
+        }
+    }
 
-    return encode_state;
+    Safefree(old_entries);
 }
 
-void cbf_encode_ctx_free_reftracker(encode_ctx* encode_state) {
-    Safefree( encode_state->reftracker );
+// Empties the table. This leaves index_base alone: new entries’
+// indexes start at whatever the caller sets it to.
+static inline void _reftracker_clear( cbf_reftracker *reftracker ) {
+    if (reftracker->count) {
+        Zero( reftracker->entries, reftracker->size, struct cbf_reftracker_entry );
+        reftracker->count = 0;
+    }
 }
 
-void cbf_encode_ctx_free_all(encode_ctx* encode_state) {
-    cbf_encode_ctx_free_reftracker(encode_state);
-    Safefree( encode_state->buffer );
+// Returns the entry for ref. If the returned entry’s ref is NULL,
+// then ref isn’t in the table, and the caller may store it there.
+static inline struct cbf_reftracker_entry* _reftracker_find( cbf_reftracker *reftracker, void *ref ) {
+
+    // Keep the load factor under 1/2.
+    if ( (reftracker->count << 1) >= reftracker->size ) {
+        _reftracker_grow(reftracker);
+    }
+
+    UV slot = _reftracker_slot( ref, reftracker->size );
+
+    while (reftracker->entries[slot].ref && reftracker->entries[slot].ref != ref) {
+        slot = (slot + 1) & (reftracker->size - 1);
+    }
+
+    return reftracker->entries + slot;
 }
 
-SV *cbf_encode( pTHX_ SV *value, encode_ctx *encode_state, SV *RETVAL ) {
-    _encode(aTHX_ value, encode_state);
+// Return indicates to encode the actual value.
+bool _check_reference( pTHX_ SV *varref, encode_ctx *encode_state ) {
+    if ( SvREFCNT(varref) > 1 ) {
+        cbf_reftracker *reftracker = encode_state->reftracker;
 
-    // Ensure that there’s a trailing NUL:
-    _COPY_INTO_ENCODE( encode_state, &NUL, 1 );
+        struct cbf_reftracker_entry *entry = _reftracker_find( reftracker, varref );
 
-    return RETVAL;
+        if (entry->ref) {
+            _init_length_buffer( aTHX_ CBOR_TAG_SHAREDREF, CBOR_TYPE_TAG, encode_state );
+            _init_length_buffer( aTHX_ entry->index, CBOR_TYPE_UINT, encode_state );
+            return false;
+        }
+
+        entry->ref = varref;
+        entry->index = reftracker->index_base + reftracker->count++;
+
+        _init_length_buffer( aTHX_ CBOR_TAG_SHAREABLE, CBOR_TYPE_TAG, encode_state );
+    }
+
+    return true;
+}
+
+CBF_FORCE_INLINE void _encode_string_sv( pTHX_ encode_ctx* encode_state, SV* value ) {
+    char *val = SvPOK(value) ? SvPVX(value) : SvPV_nolen(value);
+
+    STRLEN len = SvCUR(value);
+
+    bool encode_as_text = !!SvUTF8(value);
+
+    _init_length_buffer( aTHX_
+        len,
+        (encode_as_text ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY),
+        encode_state
+    );
+
+    _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, value, (unsigned char *) val, len );
+}
+
+//----------------------------------------------------------------------
+// Direct string transcoding
+//
+// The string_encode_mode options that convert strings write the
+// converted string straight into the output buffer rather than
+// converting a copy. ASCII runs, which are the same either way,
+// we scan for (see cbor_free_utf8.c) and copy a word at a time.
+
+// i.e., how many more bytes src will need once UTF-8-upgraded
+static inline STRLEN _count_high_bytes( const U8 *src, STRLEN len ) {
+    const U8 *cur = src;
+    const U8 *end = src + len;
+    STRLEN count = 0;
+    UV word;
+
+    while ( (STRLEN) (end - cur) >= sizeof(UV) ) {
+        Copy( cur, &word, 1, UV );
+
+        // Sum the high bits into the top byte.
+        count += (((word & WORD_HIGH_BITS) >> 7) * WORD_LOW_BITS) >> ((sizeof(UV) - 1) * 8);
+        cur += sizeof(UV);
+    }
+
+    while (cur < end) count += *cur++ >> 7;
+
+    return count;
+}
+
+// Given a word from a string with some high bits set (i.e., highbits),
+// returns the number of ASCII bytes that precede the first non-ASCII one.
+static inline unsigned _leading_ascii_bytes( UV highbits ) {
+#if defined(__GNUC__) && IS_LITTLE_ENDIAN
+    return ((sizeof(UV) > sizeof(unsigned long)) ? __builtin_ctzll(highbits) : __builtin_ctzl(highbits)) >> 3;
+#elif defined(__GNUC__)
+    return ((sizeof(UV) > sizeof(unsigned long)) ? __builtin_clzll(highbits) : __builtin_clzl(highbits)) >> 3;
+#else
+    const U8 *bytes = (const U8 *) &highbits;
+    unsigned count = 0;
+    while (!bytes[count]) count++;
+    return count;
+#endif
+}
+
+// Returns src’s length once UTF-8-downgraded, or -1 if src
+// contains a wide (i.e., >0xff) character.
+static SSize_t _downgraded_length( const U8 *src, STRLEN len ) {
+    const U8 *end = src + len;
+    STRLEN leads = 0;
+    UV word, highbits;
+
+    while (src < end) {
+        if ( (STRLEN) (end - src) >= sizeof(UV) ) {
+            Copy( src, &word, 1, UV );
+
+            highbits = word & WORD_HIGH_BITS;
+
+            if (!highbits) {
+                src += sizeof(UV);
+                continue;
+            }
+
+            src += _leading_ascii_bytes(highbits);
+        }
+        else if (!(*src & 0x80)) {
+            src++;
+            continue;
+        }
+
+        if ((*src & 0xfe) != 0xc2 || (src + 1) == end) return -1;
+
+        leads++;
+        src += 2;
+    }
+
+    return len - leads;
+}
+
+// Writes one Latin-1 byte as UTF-8.
+#define UPGRADE_BYTE(cur, src) STMT_START {         \
+    U8 byte = *src++;                               \
+    if (byte & 0x80) {                              \
+        *cur++ = 0xc0 | (byte >> 6);                \
+        *cur++ = 0x80 | (byte & 0x3f);              \
+    }                                               \
+    else {                                          \
+        *cur++ = byte;                              \
+    }                                               \
+} STMT_END
+
+// Copies all-ASCII words as-is and converts other words byte by byte.
+static STRLEN _upgrade_latin1( U8 *dest, const U8 *src, STRLEN len ) {
+    U8 *cur = dest;
+    const U8 *end = src + len;
+    UV word;
+    unsigned i;
+
+    while ( (STRLEN) (end - src) >= sizeof(UV) ) {
+        Copy( src, &word, 1, UV );
+
+        if (word & WORD_HIGH_BITS) {
+            for (i=0; i<sizeof(UV); i++) UPGRADE_BYTE(cur, src);
+        }
+        else {
+            Copy( &word, cur, 1, UV );
+            src += sizeof(UV);
+            cur += sizeof(UV);
+        }
+    }
+
+    while (src < end) UPGRADE_BYTE(cur, src);
+
+    return cur - dest;
+}
+
+// Copies each word as-is, then overwrites whatever follows the word’s
+// first non-ASCII byte. Thus, dest needs room for as many bytes as src
+// contains. Returns the downgraded length, or -1 if src contains a wide
+// character.
+static SSize_t _downgrade_utf8( U8 *dest, const U8 *src, STRLEN len ) {
+    U8 *cur = dest;
+    const U8 *end = src + len;
+    UV word, highbits;
+    unsigned ascii;
+
+    // Only U+0080 through U+00FF, i.e., 0xc2 or 0xc3 then a
+    // continuation byte, can be downgraded.
+    while (src < end) {
+        if ( (STRLEN) (end - src) >= sizeof(UV) ) {
+            Copy( src, &word, 1, UV );
+            Copy( &word, cur, 1, UV );
+
+            highbits = word & WORD_HIGH_BITS;
+
+            if (!highbits) {
+                src += sizeof(UV);
+                cur += sizeof(UV);
+                continue;
+            }
+
+            ascii = _leading_ascii_bytes(highbits);
+            src += ascii;
+            cur += ascii;
+        }
+        else if (!(*src & 0x80)) {
+            *cur++ = *src++;
+            continue;
+        }
+
+        if ((*src & 0xfe) != 0xc2 || (src + 1) == end) return -1;
+
+        *cur++ = ((src[0] & 0x03) << 6) | (src[1] & 0x3f);
+        src += 2;
+    }
+
+    return cur - dest;
+}
+
+// Returns where to write len more bytes of output, or NULL if we
+// stream output and len won’t fit into the buffer.
+static inline char *_reserve_output( encode_ctx *encode_state, STRLEN len ) {
+    if (len > encode_state->buflen - encode_state->len) {
+        if (_can_flush(encode_state)) {
+            _flush_encode_buffer(encode_state);
+
+            if (len > encode_state->buflen) return NULL;
+        }
+        else {
+            _grow_encode_buffer( encode_state, len );
+        }
+    }
+
+    return encode_state->buffer + encode_state->len;
+}
+
+#define TRANSCODE_PIECE_SIZE 512
+
+// Outputs src, either upgraded from Latin-1 or downgraded from UTF-8.
+// converted_length is the result’s length, so a downgrade can’t fail.
+static void _output_transcoded( encode_ctx *encode_state, const U8 *src, STRLEN len, STRLEN converted_length, bool upgrade ) {
+    // Downgrading writes up to len bytes; see above.
+    char *dest = _reserve_output( encode_state, upgrade ? converted_length : len );
+
+    if (dest) {
+        encode_state->len += upgrade
+            ? _upgrade_latin1( (U8 *) dest, src, len )
+            : (STRLEN) _downgrade_utf8( (U8 *) dest, src, len );
+
+        return;
+    }
+
+    // We’re streaming output, and the string is too big for the
+    // buffer, so convert it piecewise … unless we’re just counting.
+    if (encode_state->counting) {
+        encode_state->flushed_len += converted_length;
+        return;
+    }
+
+    U8 piece[TRANSCODE_PIECE_SIZE];
+    STRLEN take;
+
+    while (len) {
+        if (upgrade) {
+            take = (len < (TRANSCODE_PIECE_SIZE / 2)) ? len : (TRANSCODE_PIECE_SIZE / 2);
+            _COPY_INTO_ENCODE( encode_state, piece, _upgrade_latin1( piece, src, take ) );
+        }
+        else {
+            take = (len < TRANSCODE_PIECE_SIZE) ? len : TRANSCODE_PIECE_SIZE;
+
+            // Don’t split a character.
+            if (take < len && (src[take - 1] & 0xc0) == 0xc0) take--;
+
+            _COPY_INTO_ENCODE( encode_state, piece, (STRLEN) _downgrade_utf8( piece, src, take ) );
+        }
+
+        src += take;
+        len -= take;
+    }
+}
+
+CBF_FORCE_INLINE void _encode_string_unicode( pTHX_ encode_ctx* encode_state, SV* value ) {
+    if (SvUTF8(value)) {
+        _encode_string_sv( aTHX_ encode_state, value );
+        return;
+    }
+
+    STRLEN len;
+    const U8 *src = (const U8 *) SvPV_nomg(value, len);
+
+    STRLEN ascii = cbf_ascii_prefix_length( src, len );
+    STRLEN converted_length = len + _count_high_bytes( src + ascii, len - ascii );
+
+    _init_length_buffer( aTHX_ converted_length, CBOR_TYPE_UTF8, encode_state );
+
+    if (converted_length == len) {
+        _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, value, src, len );
+    }
+    else {
+        _COPY_INTO_ENCODE( encode_state, src, ascii );
+        _output_transcoded( encode_state, src + ascii, len - ascii, converted_length - ascii, true );
+    }
+}
+
+static inline void _encode_downgraded_string( pTHX_ encode_ctx* encode_state, SV* value, enum CBOR_TYPE string_type ) {
+    STRLEN len;
+    const U8 *src = (const U8 *) SvPV_nomg(value, len);
+
+    STRLEN ascii = SvUTF8(value) ? cbf_ascii_prefix_length( src, len ) : len;
+
+    if (ascii == len) {
+        _init_length_buffer( aTHX_ len, string_type, encode_state );
+        _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, value, src, len );
+        return;
+    }
+
+    // Downgrading never lengthens a string, so unless we stream output
+    // we can downgrade straight into the buffer in one pass. The head
+    // goes in front once we know the length.
+    STRLEN max_hdrlen = _write_length_header( encode_state->scratch, len, string_type );
+
+    U8 *dest = (U8 *) _reserve_output( encode_state, max_hdrlen + len );
+
+    if (dest) {
+        U8 *body = dest + max_hdrlen;
+
+        SSize_t converted_length = _downgrade_utf8( body + ascii, src + ascii, len - ascii );
+
+        if (converted_length < 0) {
+            _croak_wide_character( aTHX_ encode_state, value );
+        }
+
+        Copy( src, body, ascii, U8 );
+        converted_length += ascii;
+
+        STRLEN hdrlen = _write_length_header( dest, converted_length, string_type );
+
+        if (hdrlen < max_hdrlen) {
+            Move( body, dest + hdrlen, converted_length, U8 );
+        }
+
+        encode_state->len += hdrlen + converted_length;
+
+        return;
+    }
+
+    SSize_t converted_length = _downgraded_length( src + ascii, len - ascii );
+
+    if (converted_length < 0) {
+        _croak_wide_character( aTHX_ encode_state, value );
+    }
+
+    _init_length_buffer( aTHX_ ascii + converted_length, string_type, encode_state );
+
+    _COPY_INTO_ENCODE( encode_state, src, ascii );
+    _output_transcoded( encode_state, src + ascii, len - ascii, converted_length, false );
+}
+
+CBF_FORCE_INLINE void _encode_string_utf8( pTHX_ encode_ctx* encode_state, SV* value ) {
+    _encode_downgraded_string( aTHX_ encode_state, value, CBOR_TYPE_UTF8 );
+}
+
+CBF_FORCE_INLINE void _encode_string_octets( pTHX_ encode_ctx* encode_state, SV* value ) {
+    _encode_downgraded_string( aTHX_ encode_state, value, CBOR_TYPE_BINARY );
+}
+
+// For the “auto” mode: UTF8-flagged strings must be valid UTF-8 and
+// become text. Other strings become text if they’re all ASCII, or
+// binary otherwise.
+CBF_FORCE_INLINE bool _auto_string_is_text( pTHX_ encode_ctx* encode_state, const char *str, STRLEN len, bool is_utf8 ) {
+    if (is_utf8) {
+        if (!cbf_is_strict_utf8( (const U8 *) str, len )) {
+            _croak_invalid_utf8( aTHX_ encode_state, str, len );
+        }
+
+        return true;
+    }
+
+    return cbf_is_ascii( (const U8 *) str, len );
+}
+
+CBF_FORCE_INLINE void _encode_string_auto( pTHX_ encode_ctx* encode_state, SV* value ) {
+    STRLEN len;
+    const char *str = SvPV_nomg(value, len);
+
+    _init_length_buffer( aTHX_
+        len,
+        _auto_string_is_text( aTHX_ encode_state, str, len, !!SvUTF8(value) ) ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY,
+        encode_state
+    );
+
+    _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, value, (unsigned char *) str, len );
+}
+
+static inline void _encode_double( pTHX_ double val, encode_ctx *encode_state ) {
+    char *valptr = (char *) &val;
+
+#if IS_LITTLE_ENDIAN
+    encode_state->scratch[0] = CBOR_DOUBLE;
+    encode_state->scratch[1] = valptr[7];
+    encode_state->scratch[2] = valptr[6];
+    encode_state->scratch[3] = valptr[5];
+    encode_state->scratch[4] = valptr[4];
+    encode_state->scratch[5] = valptr[3];
+    encode_state->scratch[6] = valptr[2];
+    encode_state->scratch[7] = valptr[1];
+    encode_state->scratch[8] = valptr[0];
+
+    _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 9);
+#else
+    unsigned char bytes[9] = { CBOR_DOUBLE, valptr[0], valptr[1], valptr[2], valptr[3], valptr[4], valptr[5], valptr[6], valptr[7] };
+    _COPY_INTO_ENCODE(encode_state, bytes, 9);
+#endif
+}
+
+// Converts a finite double to IEEE 754 half precision if that
+// loses nothing. Returns whether it did so.
+static inline bool _double_to_exact_half( double val, uint16_t *half ) {
+    uint16_t sign = signbit(val) ? 0x8000 : 0;
+    double abs = fabs(val);
+
+    if (abs == 0) {
+        *half = sign;
+        return true;
+    }
+
+    int exp;
+    double mant = frexp(abs, &exp);     // abs = mant * 2**exp, mant in [0.5, 1)
+
+    // A half’s normal range is 2**-14 to just under 2**16.
+    if (exp > 16) return false;
+
+    double scaled;
+
+    if (exp >= -13) {
+
+        // 11 significant bits, including the implicit leading 1:
+        scaled = ldexp(mant, 11);
+        if (scaled != floor(scaled)) return false;
+
+        *half = sign | ((exp + 14) << 10) | ((uint16_t) scaled - 0x400);
+    }
+    else {
+
+        // Subnormal: multiples of 2**-24.
+        scaled = ldexp(abs, 24);
+        if (scaled != floor(scaled) || scaled >= 0x400) return false;
+
+        *half = sign | (uint16_t) scaled;
+    }
+
+    return true;
+}
+
+// Encodes a finite NV as an integer if it’s integral, or else as the
+// narrowest float that holds it exactly.
+static void _encode_compact_float( pTHX_ double val, encode_ctx *encode_state ) {
+    if (val == floor(val) && !(val == 0 && signbit(val))) {
+        if (val >= 0) {
+            if (val < UV_MAX_P1) {
+                _init_length_buffer( aTHX_ (UV) val, CBOR_TYPE_UINT, encode_state );
+                return;
+            }
+        }
+        else if (val >= (double) IV_MIN) {
+            IV ival = (IV) val;
+            _init_length_buffer( aTHX_ -(++ival), CBOR_TYPE_NEGINT, encode_state );
+            return;
+        }
+    }
+
+    uint16_t half;
+
+    if (_double_to_exact_half(val, &half)) {
+        encode_state->scratch[0] = CBOR_HALF_FLOAT;
+        _u16_to_buffer( half, 1 + encode_state->scratch );
+
+        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 3);
+        return;
+    }
+
+    if (fabs(val) <= FLT_MAX && (double) (float) val == val) {
+        union {
+            float f;
+            uint32_t u32;
+        } single = { (float) val };
+
+        encode_state->scratch[0] = CBOR_FLOAT;
+        _u32_to_buffer( single.u32, 1 + encode_state->scratch );
+
+        _COPY_INTO_ENCODE(encode_state, encode_state->scratch, 5);
+        return;
+    }
+
+    _encode_double( aTHX_ val, encode_state );
+}
+
+//----------------------------------------------------------------------
+// Canonical key-order (“shape”) cache
+
+#define CBF_SHAPE_HEK_FLAGS (HVhek_UTF8 | HVhek_WASUTF8)
+
+static inline bool _shape_is_cacheable( HV *hash, I32 keyscount ) {
+    return keyscount > 1 && keyscount <= ENCODE_SHAPE_MAX_KEYS && !SvMAGICAL((SV *)hash) && HvARRAY(hash);
+}
+
+// An order-independent digest of a hash’s key set. Equal key sets
+// always give equal fingerprints; the converse is verified on lookup.
+static uint64_t _shape_fingerprint( pTHX_ HV *hash, I32 keyscount ) {
+    HE **buckets = HvARRAY(hash);
+    STRLEN max = HvMAX(hash);
+    uint64_t fingerprint = keyscount;
+
+    STRLEN b;
+    HE *h_entry;
+
+    for (b=0; b <= max; b++) {
+        for (h_entry = buckets[b]; h_entry; h_entry = HeNEXT(h_entry)) {
+            if (HeVAL(h_entry) == &PL_sv_placeholder) continue;
+
+            // A 64-bit finalizer (from MurmurHash3) so that
+            // the sum doesn’t collide easily.
+            uint64_t x = ((uint64_t) HeHASH(h_entry) << 8) | (HeKFLAGS(h_entry) & CBF_SHAPE_HEK_FLAGS);
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+
+            fingerprint += x;
+        }
+    }
+
+    return fingerprint;
+}
+
+static void _free_shape( cbf_shape *shape ) {
+    Safefree( shape->keys );
+    Safefree( shape->key_bytes );
+    Safefree( shape->encoded );
+
+    shape->keys = NULL;
+    shape->key_bytes = NULL;
+    shape->encoded = NULL;
+    shape->keyscount = 0;
+}
+
+// Writes a sorted key’s CBOR head to dest. Returns the length of
+// the key’s CBOR (i.e., the head plus any string).
+static inline STRLEN _sortable_key_encoded_length( struct sortable_hash_entry *entry, uint8_t *dest ) {
+    if (entry->major_type <= CBOR_TYPE_NEGINT) {
+        return _write_length_header( dest, entry->prefix, entry->major_type );
+    }
+
+    return entry->length + _write_length_header( dest, entry->length, entry->major_type );
+}
+
+// Caches the key order of a just-sorted hash, but only once we’ve seen
+// its shape twice, so that one-off hashes don’t churn the cache.
+static void _shape_cache_store( encode_ctx *encode_state, uint64_t fingerprint, I32 keyscount, struct sortable_hash_entry *sorted ) {
+    if (!encode_state->shapes) {
+        Newxz( encode_state->shapes, ENCODE_SHAPE_CACHE_SIZE, cbf_shape );
+    }
+
+    cbf_shape *shape = encode_state->shapes + (fingerprint & (ENCODE_SHAPE_CACHE_SIZE - 1));
+
+    if (shape->busy) return;
+
+    if (shape->pending_fingerprint != fingerprint) {
+        shape->pending_fingerprint = fingerprint;
+        return;
+    }
+
+    _free_shape(shape);
+
+    STRLEN key_bytes_len = 0;
+    STRLEN encoded_len = 0;
+
+    uint8_t header[9];
+
+    I32 k;
+
+    for (k=0; k<keyscount; k++) {
+        key_bytes_len += HeKLEN(sorted[k].h_entry);
+        encoded_len += _sortable_key_encoded_length( sorted + k, header );
+    }
+
+    Newx( shape->keys, keyscount, struct cbf_shape_key );
+    Newx( shape->key_bytes, key_bytes_len, char );
+    Newx( shape->encoded, encoded_len, unsigned char );
+
+    char *key_bytes = shape->key_bytes;
+    unsigned char *encoded = shape->encoded;
+
+    for (k=0; k<keyscount; k++) {
+        HE *h_entry = sorted[k].h_entry;
+        struct cbf_shape_key *key = shape->keys + k;
+
+        key->klen = HeKLEN(h_entry);
+        key->hash = HeHASH(h_entry);
+        key->hek_flags = HeKFLAGS(h_entry) & CBF_SHAPE_HEK_FLAGS;
+        key->key = key_bytes;
+
+        Copy( HeKEY(h_entry), key_bytes, key->klen, char );
+        key_bytes += key->klen;
+
+        key->encoded_length = _sortable_key_encoded_length( sorted + k, encoded );
+
+        if (sorted[k].major_type > CBOR_TYPE_NEGINT) {
+            Copy( sorted[k].buffer, encoded + key->encoded_length - sorted[k].length, sorted[k].length, char );
+        }
+
+        encoded += key->encoded_length;
+    }
+
+    shape->fingerprint = fingerprint;
+    shape->keyscount = keyscount;
+}
+
+//----------------------------------------------------------------------
+// stringrefs
+//
+// Each document is a stringref namespace (tag 256). Every string in it
+// that’s long enough gets the next index, in output order; a repeat of
+// an indexed string becomes a reference (tag 25) to that index. The
+// decoder indexes the same strings, so it can resolve the references.
+
+static const unsigned char CBOR_STRINGREF_NAMESPACE[3] = { 0xd9, 0x01, 0x00 };
+
+static inline STRLEN _head_length( U8 control_byte ) {
+    switch (CONTROL_BYTE_LENGTH_TYPE(control_byte)) {
+        case CBOR_LENGTH_SMALL: return 2;
+        case CBOR_LENGTH_MEDIUM: return 3;
+        case CBOR_LENGTH_LARGE: return 5;
+        case CBOR_LENGTH_HUGE: return 9;
+    }
+
+    return 1;
+}
+
+static void _stringref_table_clear( cbf_stringref_table *table ) {
+    if (table->count) {
+        Zero( table->entries, table->size, struct cbf_stringref_entry );
+        table->count = 0;
+        table->bytes_len = 0;
+    }
+}
+
+static void _stringref_table_free( cbf_stringref_table *table ) {
+    if (table) {
+        Safefree( table->entries );
+        Safefree( table->bytes );
+        Safefree( table );
+    }
+}
+
+static void _stringref_table_grow( cbf_stringref_table *table ) {
+    UV oldsize = table->size;
+    struct cbf_stringref_entry *old = table->entries;
+
+    table->size = oldsize ? (oldsize << 1) : ENCODE_STRINGREF_INITIAL_SIZE;
+    Newxz( table->entries, table->size, struct cbf_stringref_entry );
+
+    UV mask = table->size - 1;
+    UV i;
+
+    for (i=0; i<oldsize; i++) {
+        if (old[i].length) {
+            UV slot = old[i].hash & mask;
+            while (table->entries[slot].length) slot = (slot + 1) & mask;
+
+            table->entries[slot] = old[i];
+        }
+    }
+
+    Safefree(old);
+}
+
+static void _stringref_table_add( cbf_stringref_table *table, U32 hash, U8 major_type, const char *str, STRLEN length ) {
+    if ( (table->count + 1) << 1 > table->size ) {
+        _stringref_table_grow(table);
+    }
+
+    if (table->bytes_len + length > table->bytes_size) {
+        table->bytes_size = (table->bytes_size << 1) + length;
+        Renew( table->bytes, table->bytes_size, char );
+    }
+
+    UV mask = table->size - 1;
+    UV slot = hash & mask;
+    while (table->entries[slot].length) slot = (slot + 1) & mask;
+
+    struct cbf_stringref_entry *entry = table->entries + slot;
+
+    entry->hash = hash;
+    entry->major_type = major_type;
+    entry->length = length;
+    entry->offset = table->bytes_len;
+    entry->index = table->count++;
+
+    Copy( str, table->bytes + table->bytes_len, length, char );
+    table->bytes_len += length;
+}
+
+// Looks at the string that was just output, starting at start: if
+// the namespace has already indexed it, this replaces it with a
+// reference; otherwise this indexes it if it’s long enough.
+static void _finish_stringref( pTHX_ encode_ctx *encode_state, STRLEN start ) {
+    encode_state->pin_buffer = false;
+
+    U8 *head = (U8 *) encode_state->buffer + start;
+    STRLEN hdrlen = _head_length(*head);
+    STRLEN length = encode_state->len - start - hdrlen;
+
+    if (length < cbf_stringref_min_length(0)) return;
+
+    cbf_stringref_table *table = encode_state->stringref_table;
+
+    const char *str = (char *) head + hdrlen;
+    U8 major_type = CONTROL_BYTE_MAJOR_TYPE(*head);
+
+    U32 hash;
+    PERL_HASH(hash, str, length);
+
+    if (table->count) {
+        UV mask = table->size - 1;
+        UV slot = hash & mask;
+
+        struct cbf_stringref_entry *entry;
+
+        while ( (entry = table->entries + slot)->length ) {
+            if (entry->hash == hash
+                && entry->length == length
+                && entry->major_type == major_type
+                && memEQ( table->bytes + entry->offset, str, length )
+            ) {
+
+                // The reference is shorter, so this can’t reallocate.
+                encode_state->len = start;
+                _init_length_buffer( aTHX_ CBOR_TAG_STRINGREF, CBOR_TYPE_TAG, encode_state );
+                _init_length_buffer( aTHX_ entry->index, CBOR_TYPE_UINT, encode_state );
+
+                return;
+            }
+
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    if (length >= cbf_stringref_min_length(table->count)) {
+        _stringref_table_add( table, hash, major_type, str, length );
+    }
+}
+
+// Bracket each string’s output with these.
+static inline STRLEN _begin_string( encode_ctx *encode_state ) {
+    if (encode_state->stringrefs) encode_state->pin_buffer = true;
+
+    return encode_state->len;
+}
+
+static inline void _end_string( pTHX_ encode_ctx *encode_state, STRLEN start ) {
+    if (encode_state->stringrefs) _finish_stringref( aTHX_ encode_state, start );
+}
+
+// Starts a new namespace, if needed.
+static inline void _begin_document( encode_ctx *encode_state ) {
+    if (encode_state->stringrefs) {
+        if (encode_state->stringref_table) {
+            _stringref_table_clear( encode_state->stringref_table );
+        }
+        else {
+            Newxz( encode_state->stringref_table, 1, cbf_stringref_table );
+        }
+
+        _COPY_INTO_ENCODE( encode_state, CBOR_STRINGREF_NAMESPACE, sizeof(CBOR_STRINGREF_NAMESPACE) );
+    }
+}
+
+//----------------------------------------------------------------------
+// The encode stack
+//
+// Rather than recursing into containers, _encode() keeps a stack of
+// containers that it’s in the middle of. Each frame yields its
+// children one at a time; for maps, yielding a value also outputs
+// that value’s key.
+
+static void _die_recursion( pTHX_ encode_ctx *encode_state ) {
+    char max_depth[24];
+    my_snprintf( max_depth, sizeof(max_depth), "%" UVuf, (UV) encode_state->max_depth );
+
+    // call_pv() killed the process in Win32; this seems to fix that.
+    char * words[] = { max_depth, NULL };
+    call_argv("CBOR::Free::_die_recursion", G_EVAL|G_DISCARD, words);
+
+    _croak_encode( encode_state, NULL );
+}
+
+static void _grow_stack( pTHX_ encode_ctx *encode_state ) {
+    if (encode_state->stack_used >= encode_state->max_depth) {
+        _die_recursion( aTHX_ encode_state );
+    }
+
+    encode_state->stack_size = encode_state->stack_size ? (encode_state->stack_size << 1) : ENCODE_STACK_INITIAL_SIZE;
+
+    if (encode_state->stack_size > encode_state->max_depth) {
+        encode_state->stack_size = encode_state->max_depth;
+    }
+
+    Renew( encode_state->stack, encode_state->stack_size, cbf_encode_frame );
+}
+
+static inline cbf_encode_frame *_push_frame( pTHX_ encode_ctx *encode_state, enum cbf_encode_frame_type type, void *container, SSize_t count ) {
+
+    // The stack never outgrows max_depth, so this also
+    // enforces that limit.
+    if (encode_state->stack_used == encode_state->stack_size) {
+        _grow_stack( aTHX_ encode_state );
+    }
+
+    cbf_encode_frame *frame = encode_state->stack + encode_state->stack_used++;
+
+    frame->type = type;
+    frame->container = container;
+    frame->next = 0;
+    frame->count = count;
+    frame->length_type = CBF_LENGTH_DEFINITE;
+
+    // Perl code that runs mid-encode (e.g., a TO_CBOR method) mustn’t
+    // free a container that we’re in the middle of.
+    if (type != CBF_FRAME_SHAPED_HASH) {
+        SvREFCNT_inc_simple_void_NN( (SV *) container );
+    }
+
+    return frame;
+}
+
+// The longest length header, which _reserve_length_header() reserves.
+#define MAX_LENGTH_HEADER 9
+
+// Reserves space for the frame’s length header, which
+// _patch_length_header() will write once we know the length.
+static inline void _reserve_length_header( encode_ctx *encode_state, cbf_encode_frame *frame ) {
+    static const unsigned char placeholder[MAX_LENGTH_HEADER] = { 0 };
+
+    // This must precede the write so that the write can’t flush.
+    encode_state->pending_patches++;
+
+    _COPY_INTO_ENCODE( encode_state, placeholder, MAX_LENGTH_HEADER );
+
+    frame->length_type = CBF_LENGTH_BACKPATCH;
+    frame->header_offset = encode_state->len - MAX_LENGTH_HEADER;
+}
+
+// Writes the frame’s length (i.e., its count of children) into the
+// space that _reserve_length_header() reserved. If the header needs
+// less than all of that space, the frame’s contents move down.
+static void _patch_length_header( encode_ctx *encode_state, cbf_encode_frame *frame, enum CBOR_TYPE major_type ) {
+    char *header = encode_state->buffer + frame->header_offset;
+    char *body = header + MAX_LENGTH_HEADER;
+
+    STRLEN hdrlen = _write_length_header( (uint8_t *) header, frame->next, major_type );
+
+    if (hdrlen < MAX_LENGTH_HEADER) {
+        Move( body, header + hdrlen, encode_state->buffer + encode_state->len - body, char );
+        encode_state->len -= MAX_LENGTH_HEADER - hdrlen;
+    }
+
+    encode_state->pending_patches--;
+}
+
+static inline void _pop_frame( pTHX_ encode_ctx *encode_state ) {
+    cbf_encode_frame *frame = encode_state->stack + --encode_state->stack_used;
+
+    switch (frame->length_type) {
+        case CBF_LENGTH_BACKPATCH:
+            _patch_length_header( encode_state, frame, CBOR_TYPE_MAP );
+            break;
+
+        case CBF_LENGTH_INDEFINITE:
+            _COPY_INTO_ENCODE( encode_state, &CBOR_BREAK_U8, 1 );
+            break;
+
+        default:
+            break;
+    }
+
+    switch (frame->type) {
+        case CBF_FRAME_SHAPED_HASH:
+            ((cbf_shape *) frame->container)->busy--;
+            _release_values( aTHX_ encode_state, frame );
+            _release_sortables( encode_state, frame->sortables_base );
+            break;
+
+        case CBF_FRAME_SORTED_HASH:
+            _release_values( aTHX_ encode_state, frame );
+
+            // fall through
+
+        case CBF_FRAME_COLUMNAR:
+            encode_state->key_copies_used = frame->keys_base;
+            _release_sortables( encode_state, frame->sortables_base );
+            break;
+
+        default:
+            break;
+    }
+
+    if (frame->type != CBF_FRAME_SHAPED_HASH) {
+        SvREFCNT_dec( (SV *) frame->container );
+    }
+}
+
+// Stores a hash key that has to be upgraded (if string_type is
+// CBOR_TYPE_UTF8 and the key isn’t UTF-8) or downgraded (otherwise).
+// Conversion needs a mortal copy of the key, so we cache the result.
+static void _store_converted_hash_key( pTHX_ HE *h_entry, encode_ctx *encode_state, enum CBOR_TYPE string_type ) {
+    cbf_key_cache_entry *cached = NULL;
+    HEK *hek = NULL;
+
+    // Tied hashes’ keys are SVs.
+    if (!HeSVKEY(h_entry) && HeKLEN(h_entry) <= ENCODE_KEY_CACHE_MAX_LENGTH) {
+        hek = HeKEY_hek(h_entry);
+
+        if (!encode_state->key_cache) {
+            Newxz( encode_state->key_cache, ENCODE_KEY_CACHE_SIZE, cbf_key_cache_entry );
+        }
+
+        cached = encode_state->key_cache + (HEK_HASH(hek) & (ENCODE_KEY_CACHE_SIZE - 1));
+
+        // The HEK that we cached may be gone, so compare contents.
+        if (cached->bytes
+            && cached->hash == HEK_HASH(hek)
+            && cached->klen == HEK_LEN(hek)
+            && cached->hek_flags == (HEK_FLAGS(hek) & CBF_SHAPE_HEK_FLAGS)
+            && memEQ( cached->bytes, HEK_KEY(hek), HEK_LEN(hek) )
+        ) {
+            _COPY_INTO_ENCODE( encode_state, (unsigned char *) cached->bytes + cached->klen, cached->encoded_length );
+            return;
+        }
+    }
+
+    SV* key_sv;
+    CBF_HeSVKEY_force(h_entry, key_sv);
+
+    if (string_type == CBOR_TYPE_UTF8 && !HeUTF8(h_entry)) {
+        sv_utf8_upgrade(key_sv);
+    }
+    else {
+        UTF8_DOWNGRADE_OR_CROAK(encode_state, key_sv);
+    }
+
+    STRLEN key_length;
+    char *key = SvPV(key_sv, key_length);
+
+    STRLEN hdrlen = _write_length_header( encode_state->scratch, key_length, string_type );
+
+    if (cached) {
+        Renew( cached->bytes, HEK_LEN(hek) + hdrlen + key_length, char );
+
+        Copy( HEK_KEY(hek), cached->bytes, HEK_LEN(hek), char );
+        Copy( encode_state->scratch, cached->bytes + HEK_LEN(hek), hdrlen, char );
+        Copy( key, cached->bytes + HEK_LEN(hek) + hdrlen, key_length, char );
+
+        cached->hash = HEK_HASH(hek);
+        cached->klen = HEK_LEN(hek);
+        cached->hek_flags = HEK_FLAGS(hek) & CBF_SHAPE_HEK_FLAGS;
+        cached->encoded_length = hdrlen + key_length;
+
+        _COPY_INTO_ENCODE( encode_state, (unsigned char *) cached->bytes + cached->klen, cached->encoded_length );
+    }
+    else {
+        _COPY_INTO_ENCODE( encode_state, encode_state->scratch, hdrlen );
+        _COPY_INTO_ENCODE( encode_state, (unsigned char *) key, key_length );
+    }
+}
+
+// For integer_keys: if the key is an integer in canonical decimal
+// form (i.e., as Perl stringifies integers), this gives its CBOR
+// head’s major type and argument and returns true.
+static inline bool _parse_integer_key( const char *key, STRLEN length, enum CBOR_TYPE *major_type, UV *argument ) {
+    const char *end = key + length;
+
+    bool negative = (length > 1 && *key == '-');
+    if (negative) key++;
+
+    if (key == end) return false;
+
+    // No leading zeros, nor “-0”
+    if (*key == '0' && end - key > 1 - negative) return false;
+
+    UV num = 0;
+
+    for ( ; key < end; key++) {
+        unsigned digit = (U8) *key - '0';
+
+        if (digit > 9) return false;
+        if (num > (UV_MAX - digit) / 10) return false;
+
+        num = num * 10 + digit;
+    }
+
+    if (negative) {
+
+        // Perl can’t have stringified anything lower than IV_MIN
+        // from an integer.
+        if (num > (UV) IV_MAX + 1) return false;
+
+        *major_type = CBOR_TYPE_NEGINT;
+        *argument = num - 1;
+    }
+    else {
+        *major_type = CBOR_TYPE_UINT;
+        *argument = num;
+    }
+
+    return true;
+}
+
+CBF_FORCE_INLINE void _store_hash_key( pTHX_ HE *h_entry, encode_ctx *encode_state, enum cbf_string_encode_mode string_mode ) {
+    char *key;
+    STRLEN key_length;
+
+    if (encode_state->integer_keys) {
+        enum CBOR_TYPE major_type;
+        UV argument;
+
+        key = HePV(h_entry, key_length);
+
+        if (_parse_integer_key( key, key_length, &major_type, &argument )) {
+            _init_length_buffer( aTHX_ argument, major_type, encode_state );
+            return;
+        }
+    }
+
+    /*
+    fprintf(stderr, "HeSVKEY: %p\n", HeSVKEY(h_entry));
+    fprintf(stderr, "HeUTF8: %d\n", HeUTF8(h_entry));
+    fprintf(stderr, "CBF_HeUTF8: %d\n", CBF_HeUTF8(h_entry));
+    */
+
+    switch (string_mode) {
+        case CBF_STRING_ENCODE_SV:
+            if (HeUTF8(h_entry) || !CBF_HeUTF8(h_entry)) {
+                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, HeUTF8(h_entry) ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY );
+            }
+            else {
+                _store_converted_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_UTF8 );
+            }
+            break;
+
+        case CBF_STRING_ENCODE_UNICODE:
+            if (HeUTF8(h_entry)) {
+                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_UTF8 );
+            }
+            else {
+                _store_converted_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_UTF8 );
+            }
+            break;
+
+        case CBF_STRING_ENCODE_UTF8:
+            if (HeUTF8(h_entry)) {
+                _store_converted_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_UTF8 );
+            }
+            else {
+                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_UTF8 );
+            }
+
+            break;
+
+        case CBF_STRING_ENCODE_OCTETS:
+            if (HeUTF8(h_entry)) {
+                _store_converted_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_BINARY );
+            }
+            else {
+                STORE_PLAIN_HASH_KEY( encode_state, h_entry, key, key_length, CBOR_TYPE_BINARY );
+            }
+
+            break;
+
+        case CBF_STRING_ENCODE_AUTO:
+            if (HeUTF8(h_entry) || !CBF_HeUTF8(h_entry)) {
+                key = HePV(h_entry, key_length);
+
+                _init_length_buffer( aTHX_
+                    key_length,
+                    _auto_string_is_text( aTHX_ encode_state, key, key_length, HeUTF8(h_entry) ) ? CBOR_TYPE_UTF8 : CBOR_TYPE_BINARY,
+                    encode_state
+                );
+
+                _COPY_INTO_ENCODE( encode_state, (unsigned char *) key, key_length );
+            }
+            else {
+                _store_converted_hash_key( aTHX_ h_entry, encode_state, CBOR_TYPE_UTF8 );
+            }
+
+            break;
+
+        default:
+            assert(0);
+    }
+}
+
+// Returns a plain (i.e., non-magical) hash’s next entry, or NULL if
+// there are no more. This reads the buckets directly rather than via
+// the hash’s iterator, which leaves the caller’s each() state alone.
+//
+// The position is a bucket & a count of entries into that bucket
+// rather than an HE pointer: a TO_CBOR method or output callback can
+// change the hash between calls, which could free a saved entry.
+// (The caller’s frame holds a reference to the hash, which is what
+// keeps the hash itself alive between calls.) Such a change can still
+// skip or repeat entries, though, or end the walk before the count
+// that the map header already gave.
+static inline HE *_next_plain_hash_entry( pTHX_ HV *hash, STRLEN *bucket, STRLEN *chain_pos ) {
+    HE **buckets = HvARRAY(hash);
+
+    if (!buckets) return NULL;
+
+    STRLEN max = HvMAX(hash);
+    STRLEN p;
+
+    HE *h_entry;
+
+    for ( ; *bucket <= max; (*bucket)++, *chain_pos = 0 ) {
+        h_entry = buckets[*bucket];
+
+        for (p=0; h_entry && p < *chain_pos; p++) {
+            h_entry = HeNEXT(h_entry);
+        }
+
+        for ( ; h_entry; h_entry = HeNEXT(h_entry) ) {
+            (*chain_pos)++;
+
+            // Restricted hashes keep deleted keys as placeholders.
+            if (HeVAL(h_entry) != &PL_sv_placeholder) return h_entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the hash that value refers to if the columnar option can
+// output that hash as a row, or NULL if not.
+static inline HV *_columnar_row( SV *value ) {
+    if (!value || !SvROK(value)) return NULL;
+
+    HV *hash = (HV *) SvRV(value);
+
+    if (SvTYPE((SV *) hash) != SVt_PVHV || SvOBJECT((SV *) hash) || SvMAGICAL((SV *) hash)) {
+        return NULL;
+    }
+
+    return hash;
+}
+
+// Looks up, in a columnar row, the entry whose key is key’s. This reads
+// the buckets directly, which is much faster than hv_fetch(). Rows’
+// keys are usually shared (via PL_strtab) with the first row’s, so a
+// pointer comparison usually suffices.
+//
+// Unlike hv_fetch() this deems a key that Perl downgraded from UTF-8
+// different from the same key that wasn’t, since we encode those
+// differently.
+static inline HE *_fetch_columnar_entry( HV *row, const HEK *hek ) {
+    HE **buckets = HvARRAY(row);
+
+    if (!buckets) return NULL;
+
+    HE *h_entry = buckets[HEK_HASH(hek) & HvMAX(row)];
+
+    for ( ; h_entry; h_entry = HeNEXT(h_entry)) {
+        HEK *cur = HeKEY_hek(h_entry);
+
+        if (cur == hek || (
+            HEK_HASH(cur) == HEK_HASH(hek)
+            && HEK_LEN(cur) == HEK_LEN(hek)
+            && !((HEK_FLAGS(cur) ^ HEK_FLAGS(hek)) & CBF_SHAPE_HEK_FLAGS)
+            && memEQ( HEK_KEY(cur), HEK_KEY(hek), HEK_LEN(hek) )
+        )) {
+
+            // Restricted hashes keep deleted keys as placeholders.
+            return (HeVAL(h_entry) == &PL_sv_placeholder) ? NULL : h_entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Outputs a key that _store_sortable_key() filled in.
+static inline void _encode_sortable_key( pTHX_ struct sortable_hash_entry *entry, const char *key, encode_ctx *encode_state ) {
+    if (entry->major_type <= CBOR_TYPE_NEGINT) {
+        _init_length_buffer( aTHX_ entry->prefix, entry->major_type, encode_state );
+    }
+    else {
+        STRLEN start = _begin_string(encode_state);
+        _init_length_buffer( aTHX_ entry->length, entry->major_type, encode_state );
+        _COPY_INTO_ENCODE( encode_state, (const unsigned char *) key, entry->length );
+        _end_string( aTHX_ encode_state, start );
+    }
+}
+
+// Returns the (non-array) frame’s next child, or NULL if there are
+// no more. When the caller passes a constant frame type, the compiler
+// can omit the switch.
+CBF_FORCE_INLINE SV *_next_child( pTHX_ cbf_encode_frame *frame, enum cbf_encode_frame_type type, encode_ctx *encode_state, enum cbf_string_encode_mode string_mode ) {
+    switch (type) {
+        case CBF_FRAME_HASH: {
+            if (frame->next < frame->count) {
+                HE *h_entry = _next_plain_hash_entry( aTHX_ (HV *) frame->container, &frame->bucket, &frame->chain_pos );
+
+                if (h_entry) {
+                    frame->next++;
+
+                    STRLEN start = _begin_string(encode_state);
+                    _store_hash_key( aTHX_ h_entry, encode_state, string_mode );
+                    _end_string( aTHX_ encode_state, start );
+
+                    return HeVAL(h_entry);
+                }
+
+                // The map header promised more entries than remain.
+                _croak_encode( encode_state, "Hash lost entries during encode!" );
+            }
+
+            break;
+        }
+
+        case CBF_FRAME_MAGICAL_HASH: {
+            HV *hash = (HV *) frame->container;
+            HE *h_entry = hv_iternext(hash);
+
+            if (h_entry) {
+                frame->next++;
+
+                STRLEN start = _begin_string(encode_state);
+                _store_hash_key( aTHX_ h_entry, encode_state, string_mode );
+                _end_string( aTHX_ encode_state, start );
+
+                return hv_iterval(hash, h_entry);
+            }
+
+            break;
+        }
+
+        case CBF_FRAME_SORTED_HASH:
+            if (frame->next < frame->count) {
+                struct sortable_hash_entry *entry = encode_state->sortables + frame->sortables_base + frame->next++;
+
+                _encode_sortable_key( aTHX_ entry, encode_state->key_copies + frame->key_offset, encode_state );
+
+                if (entry->major_type > CBOR_TYPE_NEGINT) {
+                    frame->key_offset += entry->length;
+                }
+
+                return entry->value;
+            }
+
+            break;
+
+        case CBF_FRAME_SHAPED_HASH:
+            if (frame->next < frame->count) {
+                cbf_shape *shape = (cbf_shape *) frame->container;
+                STRLEN encoded_length = shape->keys[frame->next].encoded_length;
+
+                STRLEN start = _begin_string(encode_state);
+                _COPY_INTO_ENCODE( encode_state, shape->encoded + frame->key_offset, encoded_length );
+                _end_string( aTHX_ encode_state, start );
+
+                frame->key_offset += encoded_length;
+
+                return encode_state->sortables[frame->sortables_base + frame->next++].value;
+            }
+
+            break;
+
+        case CBF_FRAME_SINGLE:
+            if (!frame->next) {
+                frame->next = 1;
+                return (SV *) frame->container;
+            }
+
+            break;
+
+        case CBF_FRAME_COLUMNAR:
+            if (frame->next < frame->count) {
+                const HEK *key = (const HEK *) (encode_state->key_copies + frame->key_offset);
+
+                if (!frame->column) {
+                    _init_length_buffer( aTHX_ frame->columns, CBOR_TYPE_ARRAY, encode_state );
+                }
+
+                // A TO_CBOR method (for example) can change the array
+                // or its hashes, so we look up each value anew. (The
+                // frame’s reference keeps the array itself alive.)
+                AV *array = (AV *) frame->container;
+                SV **row = SvRMAGICAL((SV *) array) ? av_fetch(array, frame->next, 0) : (frame->next <= AvFILLp(array)) ? AvARRAY(array) + frame->next : NULL;
+                HV *hash = row ? _columnar_row(*row) : NULL;
+                HE *h_entry = hash ? _fetch_columnar_entry( hash, key ) : NULL;
+
+                if (++frame->column == frame->columns) {
+                    frame->column = 0;
+                    frame->next++;
+                    frame->key_offset = frame->keys_base;
+                }
+                else {
+                    frame->key_offset += _hek_copy_size(key);
+                }
+
+                return h_entry ? HeVAL(h_entry) : &PL_sv_undef;
+            }
+
+            break;
+
+        default:
+            assert(0);
+    }
+
+    return NULL;
+}
+
+// Finds the hash’s cached shape, if any, and pushes a frame that
+// will encode the hash’s entries (i.e., not the map header) in the
+// cached order. Returns whether it did so.
+static bool _encode_hash_via_shape_cache( pTHX_ HV *hash, I32 keyscount, uint64_t fingerprint, encode_ctx *encode_state ) {
+    if (!encode_state->shapes) return false;
+
+    cbf_shape *shape = encode_state->shapes + (fingerprint & (ENCODE_SHAPE_CACHE_SIZE - 1));
+
+    if (shape->keyscount != keyscount || shape->fingerprint != fingerprint) {
+        return false;
+    }
+
+    // Since there are as many cached keys as the hash has, finding
+    // each cached key in the hash means that the key sets match.
+    // We look up all of them before we encode anything.
+    STRLEN sortables_base = _reserve_sortables( encode_state, keyscount );
+    struct sortable_hash_entry *sortables = encode_state->sortables + sortables_base;
+
+    I32 k;
+
+    for (k=0; k<keyscount; k++) {
+        struct cbf_shape_key *key = shape->keys + k;
+
+        HE *h_entry = (HE *) hv_common_key_len( hash, key->key, (key->hek_flags & HVhek_UTF8) ? -key->klen : key->klen, 0, NULL, key->hash );
+
+        if (!h_entry || (HeKFLAGS(h_entry) & CBF_SHAPE_HEK_FLAGS) != key->hek_flags) {
+            _release_sortables( encode_state, sortables_base );
+            return false;
+        }
+
+        sortables[k].value = HeVAL(h_entry);
+    }
+
+    cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_SHAPED_HASH, shape, keyscount );
+    frame->sortables_base = sortables_base;
+    frame->key_offset = 0;
+
+    _hold_values( aTHX_ encode_state, frame );
+
+    // Nested maps mustn’t evict this shape while we use it.
+    shape->busy++;
+
+    return true;
+}
+
+// Fills in a sortable entry’s key (i.e., everything but the value
+// and h_entry) for canonical order.
+CBF_FORCE_INLINE void _store_sortable_key( pTHX_ encode_ctx *encode_state, struct sortable_hash_entry *entry, HE *h_entry ) {
+    char *key;
+    STRLEN key_length;
+
+    bool heutf8;
+
+    if (encode_state->integer_keys) {
+        key = HePV(h_entry, key_length);
+
+        if (_parse_integer_key( key, key_length, &entry->major_type, &entry->prefix )) {
+            entry->length = _write_length_header( encode_state->scratch, entry->prefix, entry->major_type ) - 1;
+            return;
+        }
+    }
+
+    heutf8 = HeUTF8(h_entry);
+
+    switch (encode_state->string_encode_mode) {
+        case CBF_STRING_ENCODE_SV:
+            if (heutf8 || !CBF_HeUTF8(h_entry)) {
+                STORE_SORTABLE_HASH_KEY( entry, h_entry, key, key_length, heutf8 );
+            }
+            else {
+                STORE_UPGRADED_SORTABLE_HASH_KEY(entry, h_entry);
+            }
+
+            break;
+
+        case CBF_STRING_ENCODE_UNICODE:
+            if (heutf8) {
+                STORE_SORTABLE_HASH_KEY( entry, h_entry, key, key_length, true );
+            }
+            else {
+                STORE_UPGRADED_SORTABLE_HASH_KEY(entry, h_entry);
+            }
+            break;
+
+        case CBF_STRING_ENCODE_UTF8:
+        case CBF_STRING_ENCODE_OCTETS:
+            if (heutf8) {
+                STORE_DOWNGRADED_SORTABLE_HASH_KEY(entry, h_entry, encode_state->string_encode_mode == CBF_STRING_ENCODE_UTF8);
+            }
+            else {
+                STORE_SORTABLE_HASH_KEY( entry, h_entry, key, key_length, encode_state->string_encode_mode == CBF_STRING_ENCODE_UTF8 );
+            }
+            break;
+
+        case CBF_STRING_ENCODE_AUTO:
+            if (heutf8 || !CBF_HeUTF8(h_entry)) {
+                STORE_SORTABLE_HASH_KEY( entry, h_entry, key, key_length, _auto_string_is_text( aTHX_ encode_state, key, key_length, heutf8 ) );
+            }
+            else {
+                STORE_UPGRADED_SORTABLE_HASH_KEY(entry, h_entry);
+            }
+
+            break;
+
+        default:
+            assert(0);
+    }
+}
+
+// Pushes a frame that will encode the hash’s entries (i.e., not the
+// map header) in canonical order. If keyscount is negative, this
+// iterates through the whole hash. Returns the number of entries.
+static I32 _encode_sorted_hash( pTHX_ HV *hash, I32 keyscount, bool use_shapes, uint64_t fingerprint, encode_ctx *encode_state ) {
+    HE* h_entry;
+
+    I32 curkey = 0;
+
+    // Nested maps can reallocate the arena, so frames only
+    // hold onto the base offset.
+    I32 reserved = (keyscount < 0) ? ENCODE_SORTABLES_MIN_RESERVE : keyscount;
+
+    STRLEN sortables_base = _reserve_sortables( encode_state, reserved );
+
+    struct sortable_hash_entry *sortables = encode_state->sortables + sortables_base;
+
+    bool is_magical = SvMAGICAL((SV *) hash);
+    STRLEN bucket = 0, chain_pos = 0;
+
+    while ( (keyscount < 0 || curkey < keyscount) && (h_entry = is_magical ? hv_iternext(hash) : _next_plain_hash_entry( aTHX_ hash, &bucket, &chain_pos )) ) {
+        if (curkey == reserved) {
+
+            // Nothing else has reserved space since we did,
+            // so this extends our space.
+            _reserve_sortables( encode_state, reserved );
+            reserved <<= 1;
+
+            sortables = encode_state->sortables + sortables_base;
+        }
+
+        sortables[curkey].value = is_magical ? hv_iterval(hash, h_entry) : HeVAL(h_entry);
+        sortables[curkey].h_entry = h_entry;
+
+        _store_sortable_key( aTHX_ encode_state, sortables + curkey, h_entry );
+
+        curkey++;
+    }
+
+    _sort_sortables( sortables, curkey );
+
+    if (use_shapes && curkey == keyscount) {
+        _shape_cache_store( encode_state, fingerprint, curkey, sortables );
+    }
+
+    encode_state->sortables_used = sortables_base + curkey;
+
+    cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_SORTED_HASH, hash, curkey );
+    frame->sortables_base = sortables_base;
+
+    _hold_values( aTHX_ encode_state, frame );
+    _copy_sorted_keys( encode_state, frame );
+
+    return curkey;
+}
+
+// Magical (e.g., tied) hashes can only tell us how many entries they
+// have by iterating through them, which may be expensive. So rather
+// than iterate twice we write the map header afterward or, if the
+// caller prefers, output an indefinite-length map.
+static void _encode_magical_hash( pTHX_ HV *hash, encode_ctx *encode_state ) {
+    hv_iterinit(hash);
+
+    if (encode_state->is_canonical) {
+
+        // Sorting needs all the keys up front anyway. (Canonical
+        // CBOR also forbids indefinite lengths.) The header can
+        // follow the frame push since the frame writes nothing yet.
+        I32 keyscount = _encode_sorted_hash( aTHX_ hash, -1, false, 0, encode_state );
+
+        _init_length_buffer( aTHX_ keyscount, CBOR_TYPE_MAP, encode_state );
+    }
+    else {
+        cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_MAGICAL_HASH, hash, 0 );
+
+        if (encode_state->indefinite_magic) {
+            _init_indefinite_header( CBOR_TYPE_MAP, encode_state );
+            frame->length_type = CBF_LENGTH_INDEFINITE;
+        }
+        else {
+            _reserve_length_header( encode_state, frame );
+        }
+    }
+}
+
+static inline void _encode_int( pTHX_ SV *value, encode_ctx *encode_state ) {
+    IV val = SvIVX(value);
+
+    // In testing, Perl’s (0 + ~0) evaluated as < 0 here,
+    // but the SvUOK() check fixes that.
+    if (val < 0 && !SvUOK(value)) {
+        _init_length_buffer( aTHX_ -(++val), CBOR_TYPE_NEGINT, encode_state );
+    }
+    else {
+        // NB: SvUOK doesn’t work to identify nonnegatives … ?
+        _init_length_buffer( aTHX_ val, CBOR_TYPE_UINT, encode_state );
+    }
+}
+
+// Copies a CBOR::Free::Raw’s CBOR verbatim, optionally as
+// tag 24’s byte string.
+static inline void _encode_raw( pTHX_ AV *raw, encode_ctx *encode_state ) {
+    SV **cbor = av_fetch(raw, 0, 0);
+    SV **embedded = av_fetch(raw, 1, 0);
+
+    STRLEN len;
+    char *bytes = SvPVbyte( *cbor, len );
+
+    // The raw CBOR’s strings mustn’t take up indexes in our namespace
+    // (or refer to them), so give it a namespace of its own.
+    if (encode_state->stringrefs) {
+        _COPY_INTO_ENCODE( encode_state, CBOR_STRINGREF_NAMESPACE, sizeof(CBOR_STRINGREF_NAMESPACE) );
+    }
+
+    if (embedded && SvTRUE(*embedded)) {
+        _init_length_buffer( aTHX_ CBOR_TAG_ENCODED_CBOR, CBOR_TYPE_TAG, encode_state );
+        _init_length_buffer( aTHX_ len, CBOR_TYPE_BINARY, encode_state );
+    }
+
+    _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, *cbor, (unsigned char *) bytes, len );
+}
+
+// Like _COPY_INTO_ENCODE() but byte-swaps each width-byte element of
+// src on the way into the buffer.
+static void _copy_swapped_into_encode( encode_ctx *encode_state, const U8 *src, STRLEN len, U8 width ) {
+    if (encode_state->counting && _can_cut_buffer(encode_state)) {
+        encode_state->flushed_len += len;
+        return;
+    }
+
+    while (len) {
+        STRLEN room = encode_state->buflen - encode_state->len;
+
+        if (room < width) {
+            if (_can_flush(encode_state)) {
+                _flush_encode_buffer(encode_state);
+            }
+            else {
+                _grow_encode_buffer( encode_state, len );
+            }
+
+            room = encode_state->buflen - encode_state->len;
+
+            // A tiny chunk_size can leave no room for even one element.
+            if (room < width) {
+                U8 element[16];
+
+                cbf_byteswap( element, src, 1, width );
+                _COPY_INTO_ENCODE( encode_state, element, width );
+
+                src += width;
+                len -= width;
+                continue;
+            }
+        }
+
+        STRLEN count = ((room < len) ? room : len) / width;
+
+        cbf_byteswap( (U8 *) encode_state->buffer + encode_state->len, src, count, width );
+
+        encode_state->len += count * width;
+        src += count * width;
+        len -= count * width;
+    }
+}
+
+// Outputs a CBOR::Free::TypedArray as its RFC 8746 tag and byte
+// string, swapping the bytes if the tag’s byte order isn’t ours.
+static inline void _encode_typed_array( pTHX_ SV *value, encode_ctx *encode_state ) {
+    AV *array = (AV *)SvRV(value);
+
+    SV **packed = av_fetch(array, 1, 0);
+    SV **tag = av_fetch(array, 2, 0);
+
+    UV tagnum = (tag && *tag) ? SvUV(*tag) : 0;
+
+    if (!packed || !*packed || !cbf_is_typed_array_tag(tagnum)) {
+        _croak_unrecognized( aTHX_ encode_state, value );
+    }
+
+    U8 width = cbf_typed_array_width(tagnum);
+
+    STRLEN len;
+    const U8 *bytes = (const U8 *) SvPVbyte( *packed, len );
+
+    if (len % width) {
+        _croak_unrecognized( aTHX_ encode_state, value );
+    }
+
+    _init_length_buffer( aTHX_ tagnum, CBOR_TYPE_TAG, encode_state );
+
+    // Stringref decoders index these bytes like any other string.
+    STRLEN start = _begin_string(encode_state);
+
+    _init_length_buffer( aTHX_ len, CBOR_TYPE_BINARY, encode_state );
+
+    if (cbf_typed_array_needs_swap(tagnum)) {
+        _copy_swapped_into_encode( encode_state, bytes, len, width );
+    }
+    else {
+        _COPY_SV_STRING_INTO_ENCODE( aTHX_ encode_state, *packed, bytes, len );
+    }
+
+    _end_string( aTHX_ encode_state, start );
+}
+
+//----------------------------------------------------------------------
+// Objects: TO_CBOR and the Types::Serialiser FREEZE/THAW protocol
+
+// Changes to a class’s methods bump its pkg_gen; changes to its
+// parents’ methods or its @ISA bump its cache_gen; changes to
+// UNIVERSAL bump PL_sub_generation. All only ever increase.
+static inline U32 _method_generation( pTHX_ HV *stash ) {
+    struct mro_meta *meta = HvMROMETA(stash);
+
+    return PL_sub_generation + meta->cache_gen + meta->pkg_gen;
+}
+
+static inline CV *_find_method( pTHX_ HV *stash, const char *name ) {
+    GV *gv = gv_fetchmethod_autoload( stash, name, 0 );
+
+    return gv ? GvCV(gv) : NULL;
+}
+
+static cbf_class_methods *_get_class_methods( pTHX_ HV *stash, encode_ctx *encode_state ) {
+    if (!encode_state->method_cache) {
+        Newxz( encode_state->method_cache, ENCODE_METHOD_CACHE_SIZE, cbf_class_methods );
+    }
+
+    cbf_class_methods *methods = encode_state->method_cache + ((PTR2UV(stash) >> 4) & (ENCODE_METHOD_CACHE_SIZE - 1));
+
+    U32 generation = _method_generation( aTHX_ stash );
+
+    if (methods->stash != stash || methods->generation != generation) {
+        if (methods->stash != stash) {
+            SvREFCNT_dec( (SV *) methods->stash );
+            methods->stash = (HV *) SvREFCNT_inc( (SV *) stash );
+        }
+
+        methods->generation = generation;
+        methods->to_cbor = _find_method( aTHX_ stash, "TO_CBOR" );
+        methods->freeze = _find_method( aTHX_ stash, "FREEZE" );
+    }
+
+    return methods;
+}
+
+// Calls method on object (plus, for FREEZE, the serialiser name) and
+// leaves the results on the Perl stack. Those results are mortal, so
+// they outlive the frames that we push for them.
+static I32 _call_object_method( pTHX_ CV *method, SV *object, bool is_freeze, I32 context, encode_ctx *encode_state ) {
+    dSP;
+
+    PUSHMARK(SP);
+    EXTEND(SP, 2);
+    PUSHs(object);
+    if (is_freeze) PUSHs( sv_2mortal( newSVpvs("CBOR") ) );
+    PUTBACK;
+
+    I32 count = call_sv( (SV *) method, context | G_EVAL );
+
+    if (SvTRUE(ERRSV)) {
+        _croak_encode( encode_state, NULL );
+    }
+
+    return count;
+}
+
+// TO_CBOR’s return replaces the object. Since that may itself be an
+// object (or a container), it goes into a frame of its own.
+static void _encode_to_cbor( pTHX_ CV *method, SV *object, encode_ctx *encode_state ) {
+    _call_object_method( aTHX_ method, object, false, G_SCALAR, encode_state );
+
+    dSP;
+    SV *converted = POPs;
+    PUTBACK;
+
+    _push_frame( aTHX_ encode_state, CBF_FRAME_SINGLE, converted, 1 );
+}
+
+// FREEZE’s returns, after the class name, become tag 26’s array.
+static void _encode_frozen( pTHX_ CV *method, SV *object, encode_ctx *encode_state ) {
+    I32 count = _call_object_method( aTHX_ method, object, true, G_ARRAY, encode_state );
+
+    dSP;
+
+    AV *frozen = newAV();
+    av_extend( frozen, count );
+
+    HV *stash = SvSTASH( SvRV(object) );
+    av_store( frozen, 0, newSVhek( HvNAME_HEK(stash) ) );
+
+    while (count) {
+        av_store( frozen, count--, SvREFCNT_inc( POPs ) );
+    }
+
+    PUTBACK;
+
+    _encode_tag( aTHX_ CBOR_TAG_PERL_OBJECT, sv_2mortal( newRV_noinc( (SV *) frozen ) ), encode_state );
+}
+
+static void _encode_object( pTHX_ SV *value, encode_ctx *encode_state ) {
+    if (encode_state->convert_blessed || encode_state->freeze_objects) {
+        cbf_class_methods *methods = _get_class_methods( aTHX_ SvSTASH( SvRV(value) ), encode_state );
+
+        if (encode_state->convert_blessed && methods->to_cbor) {
+            _encode_to_cbor( aTHX_ methods->to_cbor, value, encode_state );
+            return;
+        }
+
+        if (encode_state->freeze_objects && methods->freeze) {
+            _encode_frozen( aTHX_ methods->freeze, value, encode_state );
+            return;
+        }
+    }
+
+    _croak_unrecognized(aTHX_ encode_state, value);
+}
+
+static void _encode_blessed( pTHX_ SV *value, encode_ctx *encode_state ) {
+    HV *stash = SvSTASH( SvRV(value) );
+
+    if (_get_tagged_stash() == stash) {
+        AV *array = (AV *)SvRV(value);
+        SV **tag = av_fetch(array, 0, 0);
+        IV tagnum = SvIV(*tag);
+
+        _encode_tag( aTHX_ tagnum, *(av_fetch(array, 1, 0)), encode_state );
+    }
+    else if (cbf_get_boolean_stash() == stash) {
+        _COPY_INTO_ENCODE(
+            encode_state,
+            SvTRUE(SvRV(value)) ? &CBOR_TRUE_U8 : &CBOR_FALSE_U8,
+            1
+        );
+    }
+    else if (cbf_get_raw_stash() == stash) {
+        _encode_raw( aTHX_ (AV *)SvRV(value), encode_state );
+    }
+    else if (cbf_get_typed_array_stash() == stash) {
+        _encode_typed_array( aTHX_ value, encode_state );
+    }
+    else _encode_object( aTHX_ value, encode_state );
+}
+
+//----------------------------------------------------------------------
+// columnar
+//
+// An array of hashes that all have the same keys (e.g., database rows)
+// can be output as CBOR_TAG_COLUMNAR around an array whose first item
+// is the keys and whose other items are arrays of each hash’s values,
+// in the keys’ order. That outputs each key once rather than once per
+// hash. The keys are in the first hash’s order or, in canonical mode,
+// canonical order.
+
+// If the array qualifies, this outputs the tag, the array header, and
+// the keys, then pushes a frame that will output the rows. Returns
+// whether it did so.
+static bool _encode_columnar( pTHX_ AV *array, SSize_t len, encode_ctx *encode_state, bool canonical ) {
+    if (len < ENCODE_COLUMNAR_MIN_ROWS || SvMAGICAL((SV *) array)) return false;
+
+    SV **rows = AvARRAY(array);
+
+    HV *first = _columnar_row(rows[0]);
+    if (!first) return false;
+
+    I32 keyscount = HvUSEDKEYS(first);
+    if (!keyscount) return false;
+
+    SSize_t r;
+
+    // The cheap checks come first so that arrays of other
+    // things cost little.
+    for (r=1; r<len; r++) {
+        HV *row = _columnar_row(rows[r]);
+
+        if (!row || HvUSEDKEYS(row) != keyscount) return false;
+    }
+
+    STRLEN sortables_base = _reserve_sortables( encode_state, keyscount );
+    struct sortable_hash_entry *keys = encode_state->sortables + sortables_base;
+
+    STRLEN bucket = 0, chain_pos = 0;
+    I32 k;
+
+    for (k=0; k<keyscount; k++) {
+        keys[k].h_entry = _next_plain_hash_entry( aTHX_ first, &bucket, &chain_pos );
+    }
+
+    // Since every row has as many keys as the first, finding each of
+    // the first row’s keys in a row means that the key sets match.
+    for (r=1; r<len; r++) {
+        HV *row = (HV *) SvRV(rows[r]);
+
+        for (k=0; k<keyscount; k++) {
+            if (!_fetch_columnar_entry( row, HeKEY_hek(keys[k].h_entry) )) {
+                _release_sortables( encode_state, sortables_base );
+                return false;
+            }
+        }
+    }
+
+    if (canonical) {
+        for (k=0; k<keyscount; k++) {
+            _store_sortable_key( aTHX_ encode_state, keys + k, keys[k].h_entry );
+        }
+
+        _sort_sortables( keys, keyscount );
+    }
+
+    _init_length_buffer( aTHX_ CBOR_TAG_COLUMNAR, CBOR_TYPE_TAG, encode_state );
+    _init_length_buffer( aTHX_ 1 + len, CBOR_TYPE_ARRAY, encode_state );
+    _init_length_buffer( aTHX_ keyscount, CBOR_TYPE_ARRAY, encode_state );
+
+    for (k=0; k<keyscount; k++) {
+        if (canonical) {
+            _encode_sortable_key( aTHX_ keys + k, keys[k].buffer, encode_state );
+        }
+        else {
+            STRLEN start = _begin_string(encode_state);
+            _store_hash_key( aTHX_ keys[k].h_entry, encode_state, encode_state->string_encode_mode );
+            _end_string( aTHX_ encode_state, start );
+        }
+    }
+
+    cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_COLUMNAR, array, len );
+    frame->sortables_base = sortables_base;
+    frame->column = 0;
+    frame->columns = keyscount;
+
+    _copy_columnar_keys( encode_state, frame );
+
+    return true;
+}
+
+CBF_FORCE_INLINE void _encode_array( pTHX_ AV *array, encode_ctx *encode_state, bool canonical, bool track_refs ) {
+    if (!track_refs || _check_reference( aTHX_ (SV *)array, encode_state )) {
+        SSize_t len;
+        len = 1 + av_len(array);
+
+        // Magical arrays report their lengths cheaply, so they only
+        // differ when the caller wants them as indefinite-length.
+        // (Canonical CBOR forbids indefinite lengths.)
+        if (!canonical && encode_state->indefinite_magic && SvMAGICAL(array)) {
+            cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_ARRAY, array, len );
+
+            _init_indefinite_header( CBOR_TYPE_ARRAY, encode_state );
+            frame->length_type = CBF_LENGTH_INDEFINITE;
+        }
+        else if (!track_refs && encode_state->columnar && _encode_columnar( aTHX_ array, len, encode_state, canonical )) {
+            // Nothing else to do.
+        }
+        else {
+            _init_length_buffer( aTHX_ len, CBOR_TYPE_ARRAY, encode_state );
+
+            if (len) {
+                _push_frame( aTHX_ encode_state, CBF_FRAME_ARRAY, array, len );
+            }
+        }
+    }
+}
+
+CBF_FORCE_INLINE void _encode_hash( pTHX_ HV *hash, encode_ctx *encode_state, bool canonical, bool track_refs ) {
+    if (!track_refs || _check_reference( aTHX_ (SV *)hash, encode_state)) {
+        if (SvMAGICAL(hash)) {
+            _encode_magical_hash( aTHX_ hash, encode_state );
+        }
+        else {
+
+            // Unlike hv_iterinit() this excludes a restricted hash’s
+            // placeholders, and it leaves the hash’s iterator alone.
+            I32 keyscount = HvUSEDKEYS(hash);
+
+            _init_length_buffer( aTHX_ keyscount, CBOR_TYPE_MAP, encode_state );
+
+            if (!keyscount) {
+                // Nothing else to do.
+            }
+            else if (canonical) {
+                bool use_shapes = _shape_is_cacheable(hash, keyscount);
+                uint64_t fingerprint = use_shapes ? _shape_fingerprint(aTHX_ hash, keyscount) : 0;
+
+                if (!use_shapes || !_encode_hash_via_shape_cache(aTHX_ hash, keyscount, fingerprint, encode_state)) {
+                    _encode_sorted_hash( aTHX_ hash, keyscount, use_shapes, fingerprint, encode_state );
+                }
+            }
+            else {
+                cbf_encode_frame *frame = _push_frame( aTHX_ encode_state, CBF_FRAME_HASH, hash, keyscount );
+                frame->bucket = 0;
+                frame->chain_pos = 0;
+            }
+        }
+    }
+}
+
+CBF_FORCE_INLINE void _encode_string( pTHX_ encode_ctx* encode_state, SV* value, enum cbf_string_encode_mode string_mode ) {
+    switch (string_mode) {
+        case CBF_STRING_ENCODE_SV:
+            _encode_string_sv( aTHX_ encode_state, value );
+            break;
+        case CBF_STRING_ENCODE_UNICODE:
+            _encode_string_unicode( aTHX_ encode_state, value );
+            break;
+        case CBF_STRING_ENCODE_UTF8:
+            _encode_string_utf8( aTHX_ encode_state, value );
+            break;
+        case CBF_STRING_ENCODE_OCTETS:
+            _encode_string_octets( aTHX_ encode_state, value );
+            break;
+        case CBF_STRING_ENCODE_AUTO:
+            _encode_string_auto( aTHX_ encode_state, value );
+            break;
+
+        default:
+            assert(0);
+    }
+}
+
+// Encodes a scalar, or a container’s header. In the latter case this
+// pushes a frame for the container’s contents.
+CBF_FORCE_INLINE void _encode_value( pTHX_ SV *value, encode_ctx *encode_state, enum cbf_string_encode_mode string_mode, bool canonical, bool track_refs ) {
+    SvGETMAGIC(value);
+
+    if (!SvROK(value)) {
+
+        if (SvIOK(value)) {
+            _encode_int( aTHX_ value, encode_state );
+        }
+        else if (SvNOK(value)) {
+            NV val_nv = SvNVX(value);
+
+            if (Perl_isnan(val_nv)) {
+                _COPY_INTO_ENCODE(encode_state, CBOR_NAN_SHORT, 3);
+            }
+            else if (Perl_isinf(val_nv)) {
+                if (val_nv > 0) {
+                    _COPY_INTO_ENCODE(encode_state, CBOR_INF_SHORT, 3);
+                }
+                else {
+                    _COPY_INTO_ENCODE(encode_state, CBOR_NEGINF_SHORT, 3);
+                }
+            }
+            else if (encode_state->compact_floats) {
+                _encode_compact_float( aTHX_ (double) val_nv, encode_state );
+            }
+            else {
+
+                // Typecast to a double to accommodate long-double perls.
+                _encode_double( aTHX_ (double) val_nv, encode_state );
+            }
+        }
+        else if (!SvOK(value)) {
+            _COPY_INTO_ENCODE(encode_state, &CBOR_NULL_U8, 1);
+        }
+        else {
+            STRLEN start = _begin_string(encode_state);
+            _encode_string( aTHX_ encode_state, value, string_mode );
+            _end_string( aTHX_ encode_state, start );
+        }
+    }
+    else {
+        SV *referent = SvRV(value);
+
+        if (SvOBJECT(referent)) {
+            _encode_blessed( aTHX_ value, encode_state );
+        }
+        else {
+
+            // One switch on the referent’s type rather than a
+            // chain of tests.
+            switch (SvTYPE(referent)) {
+                case SVt_PVAV:
+                    _encode_array( aTHX_ (AV *) referent, encode_state, canonical, track_refs );
+                    break;
+
+                case SVt_PVHV:
+                    _encode_hash( aTHX_ (HV *) referent, encode_state, canonical, track_refs );
+                    break;
+
+                default:
+                    if (encode_state->encode_scalar_refs && IS_SCALAR_REFERENCE(value)) {
+                        if (!track_refs || _check_reference( aTHX_ referent, encode_state)) {
+                            _encode_tag( aTHX_ CBOR_TAG_INDIRECTION, referent, encode_state );
+                        }
+                    }
+                    else {
+                        _croak_unrecognized(aTHX_ encode_state, value);
+                    }
+            }
+        }
+    }
+}
+
+#define _IS_PLAIN_INTEGER(sv) \
+    ((SvFLAGS(sv) & (SVf_IOK | SVf_ROK | SVs_GMG)) == SVf_IOK)
+
+// Encodes the frame’s children until one of them opens a container
+// (i.e., pushes a frame). Returns whether the frame is finished.
+// (Until a push the stack can’t move, so the frame pointer stays valid.)
+CBF_FORCE_INLINE bool _encode_children( pTHX_ cbf_encode_frame *frame, enum cbf_encode_frame_type type, encode_ctx *encode_state, value_encoder encode_value, enum cbf_string_encode_mode string_mode ) {
+    STRLEN depth = encode_state->stack_used;
+    SV *value;
+
+    while ( (value = _next_child( aTHX_ frame, type, encode_state, string_mode )) ) {
+
+        // Plain integers are common enough to merit a fast path.
+        if (_IS_PLAIN_INTEGER(value)) {
+            _encode_int( aTHX_ value, encode_state );
+            continue;
+        }
+
+        encode_value( aTHX_ value, encode_state );
+
+        if (encode_state->stack_used != depth) return false;
+    }
+
+    return true;
+}
+
+// The same as _encode_children() but specific to arrays, which are
+// common enough to merit keeping the loop state in locals.
+CBF_FORCE_INLINE bool _encode_array_children( pTHX_ cbf_encode_frame *frame, encode_ctx *encode_state, value_encoder encode_value ) {
+    STRLEN depth = encode_state->stack_used;
+
+    AV *array = (AV *) frame->container;
+    SSize_t i = frame->next;
+    SSize_t count = frame->count;
+
+    SV **cur;
+    SV *value;
+
+    while (i < count) {
+
+        // Plain arrays we read directly. We recheck each time
+        // since a TO_CBOR method (for example) can change the array.
+        // (The frame’s reference to the array is what keeps it alive
+        // for us to recheck.)
+        if (!SvRMAGICAL((SV *) array)) {
+            value = (i <= AvFILLp(array)) ? AvARRAY(array)[i] : NULL;
+        }
+        else {
+            cur = av_fetch(array, i, 0);
+            value = cur ? *cur : NULL;
+        }
+
+        i++;
+
+        // A nonexistent element (e.g., after $#array was
+        // increased) is undef.
+        if (!value) value = &PL_sv_undef;
+
+        if (_IS_PLAIN_INTEGER(value)) {
+            _encode_int( aTHX_ value, encode_state );
+            continue;
+        }
+
+        // In case value is a container:
+        frame->next = i;
+
+        encode_value( aTHX_ value, encode_state );
+
+        if (encode_state->stack_used != depth) return false;
+    }
+
+    return true;
+}
+
+CBF_FORCE_INLINE void _encode_loop( pTHX_ SV *value, encode_ctx *encode_state, value_encoder encode_value, enum cbf_string_encode_mode string_mode ) {
+    STRLEN stack_base = encode_state->stack_used;
+
+    encode_value( aTHX_ value, encode_state );
+
+    while (encode_state->stack_used > stack_base) {
+        cbf_encode_frame *frame = encode_state->stack + encode_state->stack_used - 1;
+
+        bool finished;
+
+        // Each frame type gets its own loop.
+        switch (frame->type) {
+            case CBF_FRAME_ARRAY:
+                finished = _encode_array_children( aTHX_ frame, encode_state, encode_value );
+                break;
+
+            case CBF_FRAME_HASH:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_HASH, encode_state, encode_value, string_mode );
+                break;
+
+            case CBF_FRAME_MAGICAL_HASH:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_MAGICAL_HASH, encode_state, encode_value, string_mode );
+                break;
+
+            case CBF_FRAME_SORTED_HASH:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_SORTED_HASH, encode_state, encode_value, string_mode );
+                break;
+
+            case CBF_FRAME_SHAPED_HASH:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_SHAPED_HASH, encode_state, encode_value, string_mode );
+                break;
+
+            case CBF_FRAME_SINGLE:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_SINGLE, encode_state, encode_value, string_mode );
+                break;
+
+            case CBF_FRAME_COLUMNAR:
+                finished = _encode_children( aTHX_ frame, CBF_FRAME_COLUMNAR, encode_state, encode_value, string_mode );
+                break;
+
+            default:
+                assert(0);
+                finished = true;
+        }
+
+        if (finished) _pop_frame( aTHX_ encode_state );
+    }
+}
+
+// Each of these is _encode_loop() and _encode_value() compiled for
+// one combination of string mode, canonical, and reference tracking.
+typedef void (*encoder_variant)( pTHX_ SV *value, encode_ctx *encode_state );
+
+#define ENCODE_VARIANT(name, mode, canonical, track_refs)  \
+    static void name##_value( pTHX_ SV *value, encode_ctx *encode_state ) {  \
+        _encode_value( aTHX_ value, encode_state, mode, canonical, track_refs );  \
+    }  \
+    static void name( pTHX_ SV *value, encode_ctx *encode_state ) {  \
+        _encode_loop( aTHX_ value, encode_state, name##_value, mode );  \
+    }
+
+#define ENCODE_MODE_VARIANTS(suffix, mode)  \
+    ENCODE_VARIANT(_encode_##suffix, mode, false, false)  \
+    ENCODE_VARIANT(_encode_##suffix##_refs, mode, false, true)  \
+    ENCODE_VARIANT(_encode_##suffix##_canonical, mode, true, false)  \
+    ENCODE_VARIANT(_encode_##suffix##_canonical_refs, mode, true, true)
+
+ENCODE_MODE_VARIANTS(sv, CBF_STRING_ENCODE_SV)
+ENCODE_MODE_VARIANTS(unicode, CBF_STRING_ENCODE_UNICODE)
+ENCODE_MODE_VARIANTS(utf8, CBF_STRING_ENCODE_UTF8)
+ENCODE_MODE_VARIANTS(octets, CBF_STRING_ENCODE_OCTETS)
+ENCODE_MODE_VARIANTS(auto, CBF_STRING_ENCODE_AUTO)
+
+#define ENCODE_MODE_VARIANTS_ROW(suffix) {  \
+    { _encode_##suffix, _encode_##suffix##_refs },  \
+    { _encode_##suffix##_canonical, _encode_##suffix##_canonical_refs },  \
+}
+
+// Indexed by string mode, then canonical, then reference tracking:
+static const encoder_variant encoder_variants[CBF_STRING_ENCODE__LIMIT][2][2] = {
+    ENCODE_MODE_VARIANTS_ROW(sv),
+    ENCODE_MODE_VARIANTS_ROW(unicode),
+    ENCODE_MODE_VARIANTS_ROW(utf8),
+    ENCODE_MODE_VARIANTS_ROW(octets),
+    ENCODE_MODE_VARIANTS_ROW(auto),
+};
+
+// Encodes value via the variant that matches encode_state’s options.
+// (The context only has a reftracker when it preserves references.)
+void _encode( pTHX_ SV *value, encode_ctx *encode_state ) {
+    assert(encode_state->string_encode_mode < CBF_STRING_ENCODE__LIMIT);
+
+    encoder_variants[ encode_state->string_encode_mode ][ encode_state->is_canonical ][ !!encode_state->reftracker ]( aTHX_ value, encode_state );
+}
+
+static inline void _encode_tag( pTHX_ IV tagnum, SV *value, encode_ctx *encode_state ) {
+    _init_length_buffer( aTHX_ tagnum, CBOR_TYPE_TAG, encode_state );
+    _push_frame( aTHX_ encode_state, CBF_FRAME_SINGLE, value, 1 );
+}
+
+//----------------------------------------------------------------------
+
+void cbf_encode_ctx_init(encode_ctx* encode_state, uint8_t flags, enum cbf_string_encode_mode string_encode_mode) {
+    encode_state->buffer = NULL;
+    encode_state->buflen = 0;
+    encode_state->len = 0;
+    encode_state->reftracker = NULL;
+    encode_state->in_use = false;
+    encode_state->recent_max_len = 0;
+    encode_state->size_hint = 0;
+
+    encode_state->sortables = NULL;
+    encode_state->sortables_size = 0;
+    encode_state->sortables_used = 0;
+
+    encode_state->key_copies = NULL;
+    encode_state->key_copies_size = 0;
+    encode_state->key_copies_used = 0;
+
+    encode_state->stack = NULL;
+    encode_state->stack_size = 0;
+    encode_state->stack_used = 0;
+    encode_state->max_depth = MAX_ENCODE_RECURSE;
+
+    encode_state->shapes = NULL;
+
+    encode_state->key_cache = NULL;
+
+    encode_state->method_cache = NULL;
+
+    encode_state->stringref_table = NULL;
+    encode_state->pin_buffer = false;
+
+    encode_state->output_fh = NULL;
+    encode_state->output_cb = NULL;
+    encode_state->chunk_size = ENCODE_OUTPUT_CHUNK_SIZE;
+    encode_state->flushed_len = 0;
+    encode_state->counting = false;
+
+    encode_state->is_canonical = !!(flags & ENCODE_FLAG_CANONICAL);
+
+    encode_state->text_keys = !!(flags & ENCODE_FLAG_TEXT_KEYS);
+
+    encode_state->encode_scalar_refs = !!(flags & ENCODE_FLAG_SCALAR_REFS);
+
+    encode_state->preserve_references = !!(flags & ENCODE_FLAG_PRESERVE_REFS);
+
+    encode_state->compact_floats = false;
+    encode_state->indefinite_magic = false;
+    encode_state->convert_blessed = false;
+    encode_state->freeze_objects = false;
+    encode_state->stringrefs = false;
+    encode_state->integer_keys = false;
+    encode_state->columnar = false;
+    encode_state->pending_patches = 0;
+
+    encode_state->is_stream = false;
+    encode_state->rollback_len = 0;
+
+    encode_state->output_sv = NULL;
+    encode_state->length_prefix = 0;
+
+    encode_state->iov = NULL;
+    encode_state->iov_threshold = ENCODE_IOV_THRESHOLD;
+
+    encode_state->string_encode_mode = string_encode_mode;
+}
+
+// An encode that Perl code aborted outside of our error handling
+// (e.g., via an uncaught die from a tied hash’s FETCH) leaves its
+// per-encode state behind. A persistent context frees that state
+// here before it encodes again.
+static void _discard_leftovers(encode_ctx* encode_state) {
+    _unwind_stack(encode_state);
+
+    cbf_encode_ctx_free_reftracker(encode_state);
+
+    Safefree( encode_state->buffer );
+    encode_state->buffer = NULL;
+
+    if (encode_state->iov) {
+        dTHX;
+
+        SvREFCNT_dec( (SV *) encode_state->iov );
+        encode_state->iov = NULL;
+    }
+}
+
+// Resets the per-encode state and, if needed, allocates the
+// reference tracker. The caller sets up the buffer after
+// calling _discard_leftovers().
+static void _prepare_encode_state(encode_ctx* encode_state) {
+    encode_state->pending_patches = 0;
+    encode_state->pin_buffer = false;
+    encode_state->counting = false;
+
+    if (encode_state->preserve_references) {
+        Newxz( encode_state->reftracker, 1, cbf_reftracker );
+    }
+    else {
+        encode_state->reftracker = NULL;
+    }
+}
+
+// Allocates the per-encode state (i.e., the output buffer and,
+// if needed, the reference tracker).
+void cbf_encode_ctx_prepare(encode_ctx* encode_state, STRLEN buflen) {
+    _discard_leftovers(encode_state);
+
+    Newx( encode_state->buffer, buflen, char );
+
+    encode_state->buflen = buflen;
+    encode_state->len = 0;
+
+    _prepare_encode_state(encode_state);
+}
+
+// The initial buffer size is the caller’s size_hint if there is one.
+// Persistent encoders also size each new buffer according to
+// what they’ve recently output. That way repeated encodes of
+// similarly-sized documents avoid reallocations.
+STRLEN cbf_encode_ctx_initial_buflen(encode_ctx* encode_state) {
+    STRLEN buflen = encode_state->recent_max_len;
+
+    if (encode_state->size_hint > buflen) {
+        buflen = encode_state->size_hint;
+    }
+
+    if (buflen) {
+
+        // +1 for the trailing NUL
+        return 1 + buflen;
+    }
+
+    return ENCODE_ALLOC_CHUNK_SIZE;
+}
+
+void cbf_encode_ctx_record_len(encode_ctx* encode_state) {
+    STRLEN len = encode_state->len;
+    STRLEN recent = encode_state->recent_max_len;
+
+    if (len > recent) {
+        encode_state->recent_max_len = len;
+    }
+    else {
+
+        // Decay toward smaller outputs so that one huge document
+        // doesn’t inflate every subsequent buffer.
+        encode_state->recent_max_len -= (recent - len) >> 3;
+    }
+}
+
+// Gives back excess buffer space. This matters when the buffer will
+// become a Perl string, which would otherwise retain the slack for as
+// long as it lives.
+void cbf_encode_ctx_shrink_buffer(encode_ctx* encode_state) {
+    STRLEN slack = encode_state->buflen - encode_state->len;
+
+    if (slack > ENCODE_ALLOC_CHUNK_SIZE && slack > (encode_state->len >> 3)) {
+        Renew( encode_state->buffer, encode_state->len, char );
+        encode_state->buflen = encode_state->len;
+    }
+}
+
+void cbf_encode_ctx_free_reftracker(encode_ctx* encode_state) {
+    if (encode_state->reftracker) {
+        Safefree( encode_state->reftracker->entries );
+    }
+
+    Safefree( encode_state->reftracker );
+    encode_state->reftracker = NULL;
+}
+
+void cbf_encode_ctx_free_all(encode_ctx* encode_state) {
+    _unwind_stack(encode_state);
+
+    cbf_encode_ctx_free_reftracker(encode_state);
+    Safefree( encode_state->buffer );
+    encode_state->buffer = NULL;
+
+    Safefree( encode_state->sortables );
+    encode_state->sortables = NULL;
+    encode_state->sortables_size = 0;
+
+    Safefree( encode_state->key_copies );
+    encode_state->key_copies = NULL;
+    encode_state->key_copies_size = 0;
+
+    Safefree( encode_state->stack );
+    encode_state->stack = NULL;
+    encode_state->stack_size = 0;
+
+    if (encode_state->shapes) {
+        unsigned s;
+        for (s=0; s<ENCODE_SHAPE_CACHE_SIZE; s++) {
+            _free_shape( encode_state->shapes + s );
+        }
+
+        Safefree( encode_state->shapes );
+        encode_state->shapes = NULL;
+    }
+
+    if (encode_state->key_cache) {
+        unsigned k;
+        for (k=0; k<ENCODE_KEY_CACHE_SIZE; k++) {
+            Safefree( encode_state->key_cache[k].bytes );
+        }
+
+        Safefree( encode_state->key_cache );
+        encode_state->key_cache = NULL;
+    }
+
+    if (encode_state->method_cache) {
+        dTHX;
+
+        unsigned m;
+        for (m=0; m<ENCODE_METHOD_CACHE_SIZE; m++) {
+            SvREFCNT_dec( (SV *) encode_state->method_cache[m].stash );
+        }
+
+        Safefree( encode_state->method_cache );
+        encode_state->method_cache = NULL;
+    }
+
+    _stringref_table_free( encode_state->stringref_table );
+    encode_state->stringref_table = NULL;
+
+    if (encode_state->iov) {
+        dTHX;
+
+        SvREFCNT_dec( (SV *) encode_state->iov );
+        encode_state->iov = NULL;
+    }
+}
+
+// Hands off the encode buffer to a new SV.
+// The encode_state’s buffer is NULL afterward.
+SV *cbf_encode_ctx_buffer_to_sv( pTHX_ encode_ctx* encode_state ) {
+    cbf_encode_ctx_shrink_buffer( encode_state );
+
+    SV* RETVAL = newSV(0);
+
+    // Don’t use newSVpvn here because that will copy the string.
+    // Instead, create a new SV and manually assign its pieces.
+    // This follows the example from ext/POSIX/POSIX.xs:
+
+    SvUPGRADE(RETVAL, SVt_PV);
+    SvPV_set(RETVAL, encode_state->buffer);
+    SvPOK_on(RETVAL);
+    SvCUR_set(RETVAL, encode_state->len - 1);
+    SvLEN_set(RETVAL, encode_state->buflen);
+
+    encode_state->buffer = NULL;
+
+    return RETVAL;
+}
+
+SV *cbf_encode( pTHX_ SV *value, encode_ctx *encode_state, SV *RETVAL ) {
+    _begin_document(encode_state);
+    _encode(aTHX_ value, encode_state);
+
+    // Ensure that there’s a trailing NUL:
+    _COPY_INTO_ENCODE( encode_state, &NUL, 1 );
+
+    return RETVAL;
+}
+
+// Encodes each of items, back-to-back, as a CBOR sequence. If offsets
+// is given, each item’s offset in the output is pushed onto it.
+SV *cbf_encode_sequence( pTHX_ AV *items, encode_ctx *encode_state, AV *offsets, SV *RETVAL ) {
+    SSize_t count = 1 + av_len(items);
+    SSize_t i;
+
+    for (i=0; i<count; i++) {
+        SV **item = av_fetch(items, i, 0);
+
+        if (offsets) av_push( offsets, newSVuv(encode_state->len) );
+
+        // Each item is its own document, so shared references
+        // don’t span items.
+        if (encode_state->reftracker) _reftracker_clear(encode_state->reftracker);
+
+        _begin_document(encode_state);
+        _encode(aTHX_ item ? *item : &PL_sv_undef, encode_state);
+    }
+
+    // Ensure that there’s a trailing NUL:
+    _COPY_INTO_ENCODE( encode_state, &NUL, 1 );
+
+    return RETVAL;
+}
+
+// Encodes to the context’s output filehandle or callback.
+// Returns the number of bytes output.
+UV cbf_encode_to_output( pTHX_ SV *value, encode_ctx *encode_state ) {
+    cbf_encode_ctx_prepare( encode_state, encode_state->chunk_size );
+
+    _begin_document(encode_state);
+    _encode(aTHX_ value, encode_state);
+
+    _flush_encode_buffer(encode_state);
+
+    cbf_encode_ctx_free_all(encode_state);
+
+    return encode_state->flushed_len;
+}
+
+//----------------------------------------------------------------------
+// encode_into()
+//
+// The output SV lends us its string buffer: we detach the buffer from
+// the SV, append to it, then reattach it. While detached the SV is
+// undef, so Perl code that runs mid-encode (e.g., TO_CBOR) can’t
+// reallocate the buffer out from under us.
+
+// Gives the buffer back to the output SV with the given length.
+static void _return_output_buffer( encode_ctx *encode_state, STRLEN len ) {
+    dTHX;
+
+    SV *output = encode_state->output_sv;
+
+    encode_state->buffer[len] = '\0';
+
+    // Discard anything that Perl code assigned in the meantime.
+    if (SvROK(output)) sv_unref(output);
+    SvPV_free(output);
+
+    SvPV_set(output, encode_state->buffer);
+    SvLEN_set(output, encode_state->buflen);
+    SvCUR_set(output, len);
+    SvPOK_only(output);
+
+    encode_state->buffer = NULL;
+    encode_state->output_sv = NULL;
+
+    SvSETMAGIC(output);
+}
+
+// Scope guard for cbf_encode_into(). Perl code can die mid-encode
+// without passing through our error handling (e.g., a tied hash’s
+// FETCH), which would leave the output SV without its string. Once
+// the output SV has its string back this does nothing.
+static void _encode_into_guard( pTHX_ void *encode_state ) {
+    if (((encode_ctx *) encode_state)->output_sv) {
+        _cleanup_after_error( (encode_ctx *) encode_state );
+    }
+}
+
+// Appends value’s CBOR, after a big-endian length prefix if the
+// context wants one, to output’s string. Returns the number of
+// bytes appended.
+UV cbf_encode_into( pTHX_ SV *value, encode_ctx *encode_state, SV *output ) {
+    static const unsigned char prefix_placeholder[8] = { 0 };
+
+    STRLEN start;
+
+    SvGETMAGIC(output);
+
+    if (!SvOK(output)) sv_setpvs(output, "");
+
+    // This also croaks if output is read-only.
+    SvPV_force_nomg(output, start);
+
+    if (SvUTF8(output) && !sv_utf8_downgrade(output, true)) {
+        croak("encode_into() cannot append to a string with wide characters!");
+    }
+
+    // Renew() needs the start of an allocation that the SV owns.
+    SvOOK_off(output);
+
+    start = SvCUR(output);
+    SvGROW(output, start + 1);
+
+    _discard_leftovers(encode_state);
+
+    encode_state->buffer = SvPVX(output);
+    encode_state->buflen = SvLEN(output);
+    encode_state->len = start;
+
+    ENTER;
+
+    // Perl code that runs mid-encode mustn’t free the output SV.
+    SAVEFREESV( SvREFCNT_inc_simple_NN(output) );
+    SAVEDESTRUCTOR_X( _encode_into_guard, encode_state );
+
+    SvPV_set(output, NULL);
+    SvLEN_set(output, 0);
+    SvCUR_set(output, 0);
+    SvOK_off(output);
+
+    encode_state->output_sv = output;
+    encode_state->rollback_len = start;
+
+    _prepare_encode_state(encode_state);
+
+    U8 prefix_length = encode_state->length_prefix;
+
+    _COPY_INTO_ENCODE( encode_state, prefix_placeholder, prefix_length );
+
+    cbf_encode( aTHX_ value, encode_state, NULL );
+
+    // cbf_encode() appends a NUL, which the SV doesn’t count.
+    STRLEN end = encode_state->len - 1;
+
+    if (prefix_length) {
+        UV cbor_length = end - start - prefix_length;
+
+        if (prefix_length < sizeof(UV) && (cbor_length >> (prefix_length << 3))) {
+            _cleanup_after_error(encode_state);
+
+            croak("CBOR (%" UVuf " bytes) is too long for a %u-byte length prefix!", cbor_length, prefix_length);
+        }
+
+        unsigned char *prefix = (unsigned char *) encode_state->buffer + start;
+
+        U8 b;
+        for (b = prefix_length; b > 0; b--) {
+            prefix[b - 1] = cbor_length & 0xff;
+            cbor_length >>= 8;
+        }
+    }
+
+    _return_output_buffer( encode_state, end );
+
+    LEAVE;
+
+    return end - start;
+}
+
+// Encodes value as a list of segments (see above) whose concatenation
+// is value’s CBOR. Returns a new AV of those segments.
+AV *cbf_encode_iov( pTHX_ SV *value, encode_ctx *encode_state ) {
+    cbf_encode_ctx_prepare( encode_state, cbf_encode_ctx_initial_buflen(encode_state) );
+
+    encode_state->iov = newAV();
+
+    cbf_encode( aTHX_ value, encode_state, NULL );
+
+    AV *iov = encode_state->iov;
+    encode_state->iov = NULL;
+
+    // The buffer becomes the last segment, unless it holds
+    // just cbf_encode()’s trailing NUL.
+    if (encode_state->len > 1) {
+        av_push( iov, cbf_encode_ctx_buffer_to_sv( aTHX_ encode_state ) );
+    }
+    else {
+        Safefree( encode_state->buffer );
+        encode_state->buffer = NULL;
+    }
+
+    return iov;
+}
+
+//----------------------------------------------------------------------
+// encoded_length()
+//
+// This is an encode to an output that discards everything. Strings
+// too long for the (small) buffer never enter it, and we skip the
+// work of converting strings whose converted length we already know.
+
+// Returns the length of the CBOR that cbf_encode() would output
+// for value (without cbf_encode()’s trailing NUL).
+UV cbf_encoded_length( pTHX_ SV *value, encode_ctx *encode_state ) {
+    cbf_encode_ctx_prepare( encode_state, ENCODE_COUNT_CHUNK_SIZE );
+
+    encode_state->counting = true;
+    encode_state->flushed_len = 0;
+
+    _begin_document(encode_state);
+    _encode(aTHX_ value, encode_state);
+
+    encode_state->counting = false;
+
+    Safefree( encode_state->buffer );
+    encode_state->buffer = NULL;
+
+    STRLEN length = encode_state->flushed_len + encode_state->len;
+
+    // A persistent encoder will likely encode value next, so
+    // have that encode allocate enough space up front.
+    if (length > encode_state->recent_max_len) {
+        encode_state->recent_max_len = length;
+    }
+
+    return length;
+}
+
+//----------------------------------------------------------------------
+// CBOR::Free::Encoder::Stream
+//
+// Each addition is an ordinary _encode() into the stream’s buffer,
+// which persists until take_bytes() hands it off. If an addition
+// fails, we roll the buffer back to where that addition started.
+
+static void _rollback_stream( encode_ctx *encode_state ) {
+    encode_state->len = encode_state->rollback_len;
+    encode_state->pending_patches = 0;
+
+    _unwind_stack(encode_state);
+
+    if (encode_state->reftracker) {
+        _reftracker_clear(encode_state->reftracker);
+    }
+}
+
+// Readies the stream for an addition and records the rollback point.
+static void _stream_mark( encode_stream_ctx *stream ) {
+    encode_ctx *encode_state = &stream->encode_state;
+
+    if (stream->adding) _rollback_stream(encode_state);
+    stream->adding = true;
+
+    if (!encode_state->buffer) {
+        STRLEN buflen = cbf_encode_ctx_initial_buflen(encode_state);
+
+        Newx( encode_state->buffer, buflen, char );
+        encode_state->buflen = buflen;
+        encode_state->len = 0;
+    }
+
+    encode_state->rollback_len = encode_state->len;
+
+    if (encode_state->preserve_references) {
+        cbf_reftracker *reftracker = encode_state->reftracker;
+
+        if (reftracker) {
+
+            // Earlier additions’ referents may be gone by now, and new
+            // SVs can reuse their addresses, so forget them. Indexes
+            // keep counting, though, since the decoder’s will.
+            reftracker->index_base += reftracker->count;
+            _reftracker_clear(reftracker);
+        }
+        else {
+            Newxz( encode_state->reftracker, 1, cbf_reftracker );
+        }
+    }
+}
+
+// Called whenever the stream finishes a top-level item.
+static inline void _stream_item_done( encode_stream_ctx *stream ) {
+    cbf_reftracker *reftracker = stream->encode_state.reftracker;
+
+    if (reftracker) {
+        _reftracker_clear(reftracker);
+        reftracker->index_base = 0;
+    }
+}
+
+static void _stream_check_key( pTHX_ encode_stream_ctx *stream, SV *key ) {
+    bool in_map = stream->open_count && (stream->open[stream->open_count - 1] == CBOR_TYPE_MAP);
+
+    if (in_map) {
+        if (!key) croak("Map members need keys!");
+    }
+    else if (key) {
+        croak("Only map members have keys!");
+    }
+}
+
+void cbf_encode_stream_begin( pTHX_ encode_stream_ctx *stream, enum CBOR_TYPE major_type, SV *key ) {
+    encode_ctx *encode_state = &stream->encode_state;
+
+    _stream_check_key( aTHX_ stream, key );
+
+    _stream_mark(stream);
+
+    if (stream->open_count >= encode_state->max_depth) {
+        _die_recursion( aTHX_ encode_state );
+    }
+
+    if (key) _encode( aTHX_ key, encode_state );
+
+    _init_indefinite_header( major_type, encode_state );
+
+    if (stream->open_count == stream->open_size) {
+        stream->open_size = stream->open_size ? (stream->open_size << 1) : ENCODE_STACK_INITIAL_SIZE;
+        Renew( stream->open, stream->open_size, enum CBOR_TYPE );
+    }
+
+    stream->open[ stream->open_count++ ] = major_type;
+
+    stream->adding = false;
+}
+
+// key is NULL except for map members.
+void cbf_encode_stream_add( pTHX_ encode_stream_ctx *stream, SV *key, SV *value ) {
+    encode_ctx *encode_state = &stream->encode_state;
+
+    _stream_check_key( aTHX_ stream, key );
+
+    _stream_mark(stream);
+
+    if (key) _encode( aTHX_ key, encode_state );
+
+    _encode( aTHX_ value, encode_state );
+
+    stream->adding = false;
+
+    if (!stream->open_count) _stream_item_done(stream);
+}
+
+void cbf_encode_stream_end( pTHX_ encode_stream_ctx *stream ) {
+    if (!stream->open_count) croak("No array or map is open!");
+
+    _stream_mark(stream);
+
+    _COPY_INTO_ENCODE( &stream->encode_state, &CBOR_BREAK_U8, 1 );
+
+    stream->adding = false;
+
+    if (!--stream->open_count) _stream_item_done(stream);
+}
+
+SV *cbf_encode_stream_take_bytes( pTHX_ encode_stream_ctx *stream ) {
+    encode_ctx *encode_state = &stream->encode_state;
+
+    if (stream->adding) {
+        _rollback_stream(encode_state);
+        stream->adding = false;
+    }
+
+    if (!encode_state->len) return newSVpvs("");
+
+    // Ensure that there’s a trailing NUL:
+    _COPY_INTO_ENCODE( encode_state, &NUL, 1 );
+
+    cbf_encode_ctx_record_len( encode_state );
+
+    SV *RETVAL = cbf_encode_ctx_buffer_to_sv( aTHX_ encode_state );
+
+    encode_state->buflen = 0;
+    encode_state->len = 0;
+
+    return RETVAL;
+}
+
+void cbf_encode_stream_free( encode_stream_ctx *stream ) {
+    cbf_encode_ctx_free_all( &stream->encode_state );
+
+    Safefree( stream->open );
+    stream->open = NULL;
 }
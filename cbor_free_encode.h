@@ -6,10 +6,44 @@
 #include "cbor_free_common.h"
 #include "cbor_free_boolean.h"
 
+// The default max_depth
 #define MAX_ENCODE_RECURSE 98
 
+#define ENCODE_STACK_INITIAL_SIZE 16
+
 #define ENCODE_ALLOC_CHUNK_SIZE 1024
 
+#define ENCODE_OUTPUT_CHUNK_SIZE 65536
+
+// encoded_length()’s buffer, which only holds what can’t be
+// counted yet (e.g., a string that stringrefs may yet replace)
+#define ENCODE_COUNT_CHUNK_SIZE 512
+
+// encode_iov()’s default minimum length for a string to have its
+// own segment rather than be copied
+#define ENCODE_IOV_THRESHOLD 4096
+
+#define ENCODE_REFTRACKER_INITIAL_SIZE 16
+
+// Canonical mode’s initial sort space for a magical hash’s keys
+#define ENCODE_SORTABLES_MIN_RESERVE 16
+
+// Canonical mode’s key-order cache; see struct cbf_shape below.
+#define ENCODE_SHAPE_CACHE_SIZE 64
+#define ENCODE_SHAPE_MAX_KEYS 256
+
+// The converted-key cache; see struct cbf_key_cache_entry below.
+#define ENCODE_KEY_CACHE_SIZE 256
+#define ENCODE_KEY_CACHE_MAX_LENGTH 256
+
+#define ENCODE_STRINGREF_INITIAL_SIZE 64
+
+// The fewest hashes that the columnar option outputs as columnar
+#define ENCODE_COLUMNAR_MIN_ROWS 2
+
+// The per-class method cache; see struct cbf_class_methods below.
+#define ENCODE_METHOD_CACHE_SIZE 64
+
 #define ENCODE_FLAG_CANONICAL       1
 #define ENCODE_FLAG_PRESERVE_REFS   2
 #define ENCODE_FLAG_SCALAR_REFS     4
@@ -24,36 +58,278 @@ enum cbf_string_encode_mode {
     CBF_STRING_ENCODE_UNICODE,
     CBF_STRING_ENCODE_UTF8,
     CBF_STRING_ENCODE_OCTETS,
+    CBF_STRING_ENCODE_AUTO,   // i.e., text if SvUTF8 or ASCII
 
     // ----------------------------------------------------------------------
     CBF_STRING_ENCODE__LIMIT,
 };
 
+// An open-addressing hash table of referent → share index,
+// for preserve_references mode.
+struct cbf_reftracker_entry {
+    void *ref;
+    UV index;
+};
+
+typedef struct {
+    struct cbf_reftracker_entry *entries;
+    UV size;    // always 0 or a power of 2
+    UV count;
+
+    // Added to each new entry’s index. This lets a stream forget
+    // references from earlier additions without renumbering.
+    UV index_base;
+} cbf_reftracker;
+
+// stringrefs mode’s table of the strings that the current namespace
+// has indexed: an open-addressing hash table whose entries point into
+// a buffer of copies of those strings.
+struct cbf_stringref_entry {
+    U32 hash;
+    U8 major_type;
+    STRLEN length;      // 0 means the slot is empty
+    STRLEN offset;      // into the table’s bytes
+    UV index;
+};
+
+typedef struct {
+    struct cbf_stringref_entry *entries;
+    UV size;    // always 0 or a power of 2
+    UV count;   // i.e., the next string’s index
+
+    char *bytes;
+    STRLEN bytes_len;
+    STRLEN bytes_size;
+} cbf_stringref_table;
+
+struct sortable_hash_entry {
+    enum CBOR_TYPE major_type;
+    char *buffer;
+    STRLEN length;
+
+    // The key’s first 8 bytes as a big-endian integer (0-padded),
+    // which lets most comparisons avoid memcmp().
+    // (For integer_keys, an integer key’s buffer is unused; this is
+    // the key’s CBOR argument, and length is that argument’s size.)
+    uint64_t prefix;
+
+    SV *value;
+    HE *h_entry;
+};
+
+// A cached key order for canonical encoding. Records that share a
+// key set (e.g., rows from a database) share a shape, which lets us
+// skip sorting and reuse the already-encoded keys.
+struct cbf_shape_key {
+    const char *key;
+    I32 klen;
+    U32 hash;
+    U8 hek_flags;
+    STRLEN encoded_length;
+};
+
+typedef struct {
+    uint64_t fingerprint;
+    uint64_t pending_fingerprint;   // seen once, not yet cached
+    I32 keyscount;                  // 0 means the slot is empty
+    unsigned busy;                  // nested encodes mustn’t evict this
+    struct cbf_shape_key *keys;     // in sorted order
+    char *key_bytes;
+    unsigned char *encoded;         // all keys’ CBOR, concatenated
+} cbf_shape;
+
+// A hash key that needed conversion (i.e., a UTF-8 upgrade or
+// downgrade) to encode, along with its CBOR. Perl shares keys across
+// hashes, so records that share keys would otherwise convert the
+// same keys over and over.
+typedef struct {
+    U32 hash;
+    I32 klen;
+    U8 hek_flags;
+    STRLEN encoded_length;
+    char *bytes;        // the key as stored in Perl, then its CBOR
+} cbf_key_cache_entry;
+
+// A class’s TO_CBOR and FREEZE methods (NULL where it lacks them),
+// so that we look them up once per class rather than per object.
+// The entry holds a reference to the stash; generation tells us
+// when the class’s methods (or @ISA) have changed.
+typedef struct {
+    HV *stash;
+    U32 generation;
+    CV *to_cbor;
+    CV *freeze;
+} cbf_class_methods;
+
+enum cbf_encode_frame_type {
+    CBF_FRAME_ARRAY,
+    CBF_FRAME_HASH,
+    CBF_FRAME_MAGICAL_HASH, // e.g., tied; uses the hash’s iterator
+    CBF_FRAME_SORTED_HASH,  // canonical
+    CBF_FRAME_SHAPED_HASH,  // canonical, from a cbf_shape
+    CBF_FRAME_SINGLE,       // a tag’s (or scalar reference’s) one value
+    CBF_FRAME_COLUMNAR,     // an array of same-keyed hashes’ values
+};
+
+// How a frame’s container conveys its length. Magical (e.g., tied)
+// containers may only learn their lengths as we encode them.
+enum cbf_frame_length {
+    CBF_LENGTH_DEFINITE,    // header already written
+    CBF_LENGTH_BACKPATCH,   // header reserved at header_offset
+    CBF_LENGTH_INDEFINITE,  // needs a “break” at the end
+};
+
+// A container that the encoder is in the middle of.
+typedef struct {
+    enum cbf_encode_frame_type type;
+    void *container;        // AV*, HV*, cbf_shape*, or (single) SV*
+    SSize_t next;
+    SSize_t count;
+    STRLEN sortables_base;
+    STRLEN keys_base;       // where the frame’s key copies start
+    STRLEN key_offset;
+    STRLEN bucket;          // for plain hashes: the next entry’s
+    STRLEN chain_pos;       // bucket & position in that bucket
+    SSize_t column;         // for columnar arrays: the next value’s
+    SSize_t columns;        // column & the number of keys
+    enum cbf_frame_length length_type;
+    STRLEN header_offset;
+} cbf_encode_frame;
+
 typedef struct {
     STRLEN buflen;
     STRLEN len;
     char *buffer;
-    void **reftracker;
-    uint8_t recurse_count;
+    cbf_reftracker *reftracker;
     uint8_t scratch[9];
     bool is_canonical;
     bool text_keys;
     bool encode_scalar_refs;
+    bool preserve_references;
+    bool compact_floats;
+    bool indefinite_magic;
+    bool convert_blessed;
+    bool freeze_objects;
+    bool stringrefs;
+    bool integer_keys;
+    bool columnar;
     enum cbf_string_encode_mode string_encode_mode;
+
+    // Only used in persistent (i.e., CBOR::Free::Encoder) contexts:
+    // a decaying maximum of recent output sizes, which we use to
+    // size each new buffer.
+    STRLEN recent_max_len;
+
+    // The caller’s estimate of the output size.
+    STRLEN size_hint;
+
+    // Canonical mode’s map-key sort space. Nested maps use successive
+    // regions of this, and it persists across encodes.
+    struct sortable_hash_entry *sortables;
+    STRLEN sortables_size;
+    STRLEN sortables_used;
+
+    // Copies of keys that frames need after Perl code may have run:
+    // sorted maps’ keys (in encode order) and columnar arrays’ HEKs.
+    // Like sortables, nested frames use successive regions of this.
+    char *key_copies;
+    STRLEN key_copies_size;
+    STRLEN key_copies_used;
+
+    // The encode stack, which persists across encodes.
+    cbf_encode_frame *stack;
+    STRLEN stack_size;
+    STRLEN stack_used;
+    STRLEN max_depth;
+
+    // Direct-mapped by shape fingerprint; allocated on first use.
+    cbf_shape *shapes;
+
+    // Direct-mapped by key hash; allocated on first use.
+    cbf_key_cache_entry *key_cache;
+
+    // Direct-mapped by stash; allocated on first use.
+    cbf_class_methods *method_cache;
+
+    // stringrefs mode’s current namespace; allocated on first use.
+    // While a string is being output we can’t flush the buffer since
+    // the string may yet become a reference.
+    cbf_stringref_table *stringref_table;
+    bool pin_buffer;
+
+    // Streaming output: if either of these is set, the buffer is
+    // flushed to it whenever it fills rather than being grown.
+    PerlIO *output_fh;
+    SV *output_cb;
+    STRLEN chunk_size;
+    UV flushed_len;
+
+    // encoded_length() streams to nowhere: flushes only count.
+    bool counting;
+
+    // How many frames await a back-patched length header. Until they
+    // get it, streaming output can’t flush the buffer.
+    STRLEN pending_patches;
+
+    // Only used in CBOR::Free::Encoder::Stream contexts: a failed
+    // addition rolls the buffer back to rollback_len rather than
+    // freeing it, so that earlier additions survive.
+    bool is_stream;
+    STRLEN rollback_len;
+
+    // Set while a persistent (i.e., Encoder or Encoder::Stream) context
+    // encodes, so that Perl code that runs mid-encode (e.g., a TO_CBOR
+    // method) can’t reenter it.
+    bool in_use;
+
+    // Only used in encode_into(): the SV whose string buffer we’re
+    // appending to. (rollback_len is where that string ended.)
+    SV *output_sv;
+
+    // The width, in bytes, of encode_into()’s length prefix, or 0.
+    U8 length_prefix;
+
+    // Only used in encode_iov(): the output segments so far, and
+    // the minimum length for a string to be a segment of its own.
+    AV *iov;
+    STRLEN iov_threshold;
 } encode_ctx;
 
-struct sortable_hash_entry {
-    bool is_utf8;
-    char *buffer;
-    STRLEN length;
-    SV *value;
-};
+// CBOR::Free::Encoder::Stream: an encode context plus the
+// indefinite-length containers that the caller has begun.
+typedef struct {
+    encode_ctx encode_state;
+    enum CBOR_TYPE *open;   // outermost first
+    STRLEN open_size;
+    STRLEN open_count;
+
+    // Set while an addition is underway. If that addition dies
+    // somewhere that doesn’t roll back (e.g., in a tied hash’s
+    // FETCH), this tells the stream to roll back before continuing.
+    bool adding;
+} encode_stream_ctx;
 
 SV * cbf_encode( pTHX_ SV *value, encode_ctx *encode_state, SV *RETVAL );
+SV * cbf_encode_sequence( pTHX_ AV *items, encode_ctx *encode_state, AV *offsets, SV *RETVAL );
+UV cbf_encode_to_output( pTHX_ SV *value, encode_ctx *encode_state );
+UV cbf_encode_into( pTHX_ SV *value, encode_ctx *encode_state, SV *output );
+AV * cbf_encode_iov( pTHX_ SV *value, encode_ctx *encode_state );
+UV cbf_encoded_length( pTHX_ SV *value, encode_ctx *encode_state );
 
-encode_ctx cbf_encode_ctx_create( uint8_t flags, enum cbf_string_encode_mode );
+void cbf_encode_ctx_init( encode_ctx* encode_state, uint8_t flags, enum cbf_string_encode_mode );
+void cbf_encode_ctx_prepare( encode_ctx* encode_state, STRLEN buflen );
+STRLEN cbf_encode_ctx_initial_buflen( encode_ctx* encode_state );
+void cbf_encode_ctx_record_len( encode_ctx* encode_state );
+void cbf_encode_ctx_shrink_buffer( encode_ctx* encode_state );
+SV * cbf_encode_ctx_buffer_to_sv( pTHX_ encode_ctx* encode_state );
 
 void cbf_encode_ctx_free_reftracker( encode_ctx* encode_state );
 void cbf_encode_ctx_free_all( encode_ctx* encode_state );
 
+void cbf_encode_stream_begin( pTHX_ encode_stream_ctx* stream, enum CBOR_TYPE major_type, SV *key );
+void cbf_encode_stream_add( pTHX_ encode_stream_ctx* stream, SV *key, SV *value );
+void cbf_encode_stream_end( pTHX_ encode_stream_ctx* stream );
+SV * cbf_encode_stream_take_bytes( pTHX_ encode_stream_ctx* stream );
+void cbf_encode_stream_free( encode_stream_ctx* stream );
+
 #endif
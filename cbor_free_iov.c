@@ -0,0 +1,91 @@
+#include "easyxs/init.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#ifdef I_SYSUIO
+#include <sys/uio.h>
+#endif
+
+#include "cbor_free_iov.h"
+
+#ifndef I_SYSUIO
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
+// How many segments to give each writev(). POSIX only promises 16.
+#if defined(IOV_MAX) && IOV_MAX < 64
+#   define CBF_WRITEV_BATCH IOV_MAX
+#else
+#   define CBF_WRITEV_BATCH 64
+#endif
+
+// Without writev() we write one segment at a time, which the
+// partial-write handling below takes care of.
+#ifdef HAS_WRITEV
+#   define _cbf_writev(fd, vec, count) writev(fd, vec, count)
+#else
+#   define _cbf_writev(fd, vec, count) PerlLIO_write(fd, (vec)->iov_base, (vec)->iov_len)
+#endif
+
+UV cbf_iov_writev( pTHX_ AV *segments, int fd ) {
+    struct iovec vec[CBF_WRITEV_BATCH];
+
+    SSize_t count = 1 + av_len(segments);
+    SSize_t next = 0;
+
+    // vec[first] through vec[used - 1] remain to be written.
+    int first = 0;
+    int used = 0;
+
+    UV total = 0;
+
+    while (1) {
+        if (first == used) {
+            first = used = 0;
+
+            while (next < count && used < CBF_WRITEV_BATCH) {
+                SV **segment = av_fetch(segments, next++, 0);
+                if (!segment) continue;
+
+                STRLEN len;
+                char *bytes = SvPVbyte(*segment, len);
+                if (!len) continue;
+
+                vec[used].iov_base = bytes;
+                vec[used].iov_len = len;
+                used++;
+            }
+
+            if (!used) break;
+        }
+
+        SSize_t wrote = _cbf_writev( fd, vec + first, used - first );
+
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+
+            croak("Failed to write CBOR: %s", strerror(errno));
+        }
+
+        total += wrote;
+
+        while (wrote) {
+            if ((size_t) wrote >= vec[first].iov_len) {
+                wrote -= vec[first].iov_len;
+                first++;
+            }
+            else {
+                vec[first].iov_base = (char *) vec[first].iov_base + wrote;
+                vec[first].iov_len -= wrote;
+                wrote = 0;
+            }
+        }
+    }
+
+    return total;
+}
@@ -0,0 +1,12 @@
+#ifndef CBOR_FREE_IOV
+#define CBOR_FREE_IOV
+
+#include "easyxs/init.h"
+
+#define IOV_CLASS "CBOR::Free::IOV"
+
+// Writes all of segments’ bytes to fd, via writev() where the system
+// has it. Returns the number of bytes written.
+UV cbf_iov_writev( pTHX_ AV *segments, int fd );
+
+#endif
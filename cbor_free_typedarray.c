@@ -0,0 +1,236 @@
+#include "cbor_free_typedarray.h"
+
+// As with strings, x86 byte swaps use SSSE3’s or, if the CPU has it,
+// AVX2’s byte shuffle. Elsewhere we go an element at a time.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#   if defined(__clang__) || __GNUC__ >= 5
+#       define CBF_HAVE_SSSE3 1
+#       define CBF_HAVE_AVX2 1
+#   endif
+#endif
+
+#if CBF_HAVE_SSSE3
+#include <immintrin.h>
+#endif
+
+typedef void (*byteswapper)( U8 *dest, const U8 *src, STRLEN count, U8 width );
+
+static void _byteswap_scalar( U8 *dest, const U8 *src, STRLEN count, U8 width ) {
+    STRLEN i;
+
+#if defined(__GNUC__)
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (width) {
+        case 2:
+            for (i=0; i<count; i++) {
+                Copy( src + (i << 1), &u16, 1, uint16_t );
+                u16 = __builtin_bswap16(u16);
+                Copy( &u16, dest + (i << 1), 1, uint16_t );
+            }
+            return;
+
+        case 4:
+            for (i=0; i<count; i++) {
+                Copy( src + (i << 2), &u32, 1, uint32_t );
+                u32 = __builtin_bswap32(u32);
+                Copy( &u32, dest + (i << 2), 1, uint32_t );
+            }
+            return;
+
+        case 8:
+            for (i=0; i<count; i++) {
+                Copy( src + (i << 3), &u64, 1, uint64_t );
+                u64 = __builtin_bswap64(u64);
+                Copy( &u64, dest + (i << 3), 1, uint64_t );
+            }
+            return;
+    }
+#endif
+
+    U8 element[16];
+    U8 b;
+
+    for (i=0; i<count; i++) {
+        Copy( src + i * width, element, width, U8 );
+
+        for (b=0; b<width; b++) {
+            dest[ i * width + b ] = element[ width - 1 - b ];
+        }
+    }
+}
+
+#if CBF_HAVE_SSSE3
+
+// A shuffle mask that reverses each width-byte element of 16 bytes.
+// (AVX2 shuffles each 16-byte half of a register separately, so
+// it can use two of these.)
+static inline void _byteswap_mask( U8 mask[16], U8 width ) {
+    U8 i;
+
+    for (i=0; i<16; i++) {
+        mask[i] = (i - (i % width)) + (width - 1 - (i % width));
+    }
+}
+
+__attribute__((target("ssse3")))
+static void _byteswap_ssse3( U8 *dest, const U8 *src, STRLEN count, U8 width ) {
+    U8 mask_bytes[16];
+    _byteswap_mask( mask_bytes, width );
+
+    __m128i mask = _mm_loadu_si128( (const __m128i *) mask_bytes );
+
+    STRLEN len = count * width;
+    STRLEN i = 0;
+
+    for ( ; len - i >= 16; i += 16 ) {
+        __m128i chunk = _mm_loadu_si128( (const __m128i *) (src + i) );
+        _mm_storeu_si128( (__m128i *) (dest + i), _mm_shuffle_epi8( chunk, mask ) );
+    }
+
+    _byteswap_scalar( dest + i, src + i, (len - i) / width, width );
+}
+#endif
+
+#if CBF_HAVE_AVX2
+__attribute__((target("avx2")))
+static void _byteswap_avx2( U8 *dest, const U8 *src, STRLEN count, U8 width ) {
+    U8 mask_bytes[16];
+    _byteswap_mask( mask_bytes, width );
+
+    __m256i mask = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *) mask_bytes ) );
+
+    STRLEN len = count * width;
+    STRLEN i = 0;
+
+    for ( ; len - i >= 64; i += 64 ) {
+        __m256i a = _mm256_loadu_si256( (const __m256i *) (src + i) );
+        __m256i b = _mm256_loadu_si256( (const __m256i *) (src + i + 32) );
+
+        _mm256_storeu_si256( (__m256i *) (dest + i), _mm256_shuffle_epi8( a, mask ) );
+        _mm256_storeu_si256( (__m256i *) (dest + i + 32), _mm256_shuffle_epi8( b, mask ) );
+    }
+
+    for ( ; len - i >= 32; i += 32 ) {
+        __m256i a = _mm256_loadu_si256( (const __m256i *) (src + i) );
+        _mm256_storeu_si256( (__m256i *) (dest + i), _mm256_shuffle_epi8( a, mask ) );
+    }
+
+    _byteswap_scalar( dest + i, src + i, (len - i) / width, width );
+}
+#endif
+
+//----------------------------------------------------------------------
+
+static bool _cpu_has_any() {
+    return true;
+}
+
+#if CBF_HAVE_SSSE3
+static bool _cpu_has_ssse3() {
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("ssse3");
+}
+#endif
+
+#if CBF_HAVE_AVX2
+static bool _cpu_has_avx2() {
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx2");
+}
+#endif
+
+static const struct {
+    const char *name;
+    byteswapper byteswap;
+    bool (*cpu_has)();
+} kernels[] = {
+
+    // Best first:
+#if CBF_HAVE_AVX2
+    { "avx2", _byteswap_avx2, _cpu_has_avx2 },
+#endif
+#if CBF_HAVE_SSSE3
+    { "ssse3", _byteswap_ssse3, _cpu_has_ssse3 },
+#endif
+    { "scalar", _byteswap_scalar, _cpu_has_any },
+};
+
+#define KERNELS_COUNT (sizeof(kernels) / sizeof(*kernels))
+
+// The first use picks the best kernel that the CPU supports.
+// (Threads may race to do so, but they’ll all pick the same one.)
+static int kernel_index = -1;
+
+static inline unsigned _kernel_index() {
+    if (kernel_index < 0) {
+        unsigned i = 0;
+
+        while (!kernels[i].cpu_has()) i++;
+
+        kernel_index = i;
+    }
+
+    return kernel_index;
+}
+
+void cbf_byteswap( U8 *dest, const U8 *src, STRLEN count, U8 width ) {
+    kernels[ _kernel_index() ].byteswap( dest, src, count, width );
+}
+
+const char *cbf_byteswap_kernel_name() {
+    return kernels[ _kernel_index() ].name;
+}
+
+bool cbf_set_byteswap_kernel( const char *name ) {
+    unsigned i;
+
+    for (i=0; i<KERNELS_COUNT; i++) {
+        if (strEQ(name, kernels[i].name)) {
+            if (!kernels[i].cpu_has()) break;
+
+            kernel_index = i;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------
+
+// Indexed by tag number minus 64:
+static const char * const TYPE_NAMES[] = {
+    "uint8", "uint16be", "uint32be", "uint64be",
+    "uint8_clamped", "uint16le", "uint32le", "uint64le",
+    "int8", "int16be", "int32be", "int64be",
+    NULL, "int16le", "int32le", "int64le",
+    "float16be", "float32be", "float64be", "float128be",
+    "float16le", "float32le", "float64le", "float128le",
+};
+
+static HV *typed_array_stash = NULL;
+
+HV *cbf_get_typed_array_stash() {
+    if (!typed_array_stash) {
+        dTHX;
+        typed_array_stash = gv_stashpv(TYPED_ARRAY_CLASS, 1);
+    }
+
+    return typed_array_stash;
+}
+
+SV *cbf_new_typed_array( pTHX_ UV tagnum, SV *packed ) {
+    AV *array = newAV();
+
+    av_extend(array, 2);
+    av_push(array, newSVpv( TYPE_NAMES[ tagnum - CBOR_TAG_TYPED_ARRAY_FIRST ], 0 ));
+    av_push(array, packed);
+    av_push(array, newSVuv(tagnum));
+
+    return sv_bless( newRV_noinc((SV *) array), cbf_get_typed_array_stash() );
+}
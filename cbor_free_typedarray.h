@@ -0,0 +1,57 @@
+#ifndef CBOR_FREE_TYPEDARRAY
+#define CBOR_FREE_TYPEDARRAY
+
+#include "easyxs/init.h"
+
+#include "cbor_free_common.h"
+
+#define TYPED_ARRAY_CLASS "CBOR::Free::TypedArray"
+
+// RFC 8746 typed arrays are tags 64 to 87 on byte strings of packed
+// numbers. The tag’s low 5 bits are “f s e ll”: float, signed,
+// little-endian (or, for uint8, clamped), and the element size.
+#define CBOR_TAG_TYPED_ARRAY_FIRST  64
+#define CBOR_TAG_TYPED_ARRAY_LAST   87
+#define CBOR_TAG_TYPED_ARRAY_SINT8_LE 76  // reserved
+
+#define TYPED_ARRAY_FLOAT_BIT       0x10
+#define TYPED_ARRAY_SIGNED_BIT      0x08
+#define TYPED_ARRAY_LE_BIT          0x04
+
+static inline bool cbf_is_typed_array_tag( UV tagnum ) {
+    return tagnum >= CBOR_TAG_TYPED_ARRAY_FIRST
+        && tagnum <= CBOR_TAG_TYPED_ARRAY_LAST
+        && tagnum != CBOR_TAG_TYPED_ARRAY_SINT8_LE;
+}
+
+// Returns the size, in bytes, of the tagged array’s elements.
+static inline U8 cbf_typed_array_width( UV tagnum ) {
+    U8 ll = tagnum & 3;
+
+    return (tagnum & TYPED_ARRAY_FLOAT_BIT) ? (2 << ll) : (1 << ll);
+}
+
+// Whether the tagged array’s byte order differs from ours.
+static inline bool cbf_typed_array_needs_swap( UV tagnum ) {
+    return cbf_typed_array_width(tagnum) > 1
+        && !!(tagnum & TYPED_ARRAY_LE_BIT) != IS_LITTLE_ENDIAN;
+}
+
+// Reverses the bytes of each of count elements of the given width.
+// dest and src may be the same but mustn’t otherwise overlap.
+void cbf_byteswap( U8 *dest, const U8 *src, STRLEN count, U8 width );
+
+// Returns the name of the kernel (e.g., "avx2") that the above uses.
+const char *cbf_byteswap_kernel_name();
+
+// Switches to the named kernel. Returns false if this CPU (or build)
+// lacks it. This is for tests & benchmarks.
+bool cbf_set_byteswap_kernel( const char *name );
+
+HV *cbf_get_typed_array_stash();
+
+// Creates a CBOR::Free::TypedArray instance. This takes ownership
+// of packed, which must be in our byte order.
+SV *cbf_new_typed_array( pTHX_ UV tagnum, SV *packed );
+
+#endif
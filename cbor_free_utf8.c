@@ -0,0 +1,407 @@
+#include "cbor_free_utf8.h"
+
+// On x86 we use SSE2 or, if the CPU has it, AVX2. (SSE2 is part of
+// x86-64, so it needs no check.) Elsewhere we go a word at a time.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#   define CBF_HAVE_SSE2 1
+#   if defined(__clang__) || __GNUC__ >= 5
+#       define CBF_HAVE_AVX2 1
+#   endif
+#endif
+
+#if CBF_HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+typedef STRLEN (*ascii_scanner)( const U8 *src, STRLEN len );
+typedef bool (*utf8_validator)( const U8 *src, STRLEN len );
+
+static STRLEN _ascii_prefix_length_scalar( const U8 *src, STRLEN len ) {
+    const U8 *cur = src;
+    const U8 *end = src + len;
+    UV word;
+
+    while ( (STRLEN) (end - cur) >= sizeof(UV) ) {
+        Copy( cur, &word, 1, UV );
+        if (word & WORD_HIGH_BITS) break;
+        cur += sizeof(UV);
+    }
+
+    while (cur < end && !(*cur & 0x80)) cur++;
+
+    return cur - src;
+}
+
+#if CBF_HAVE_SSE2
+static STRLEN _ascii_prefix_length_sse2( const U8 *src, STRLEN len ) {
+    const U8 *cur = src;
+    const U8 *end = src + len;
+    int mask;
+
+    while ( (end - cur) >= 16 ) {
+        mask = _mm_movemask_epi8( _mm_loadu_si128( (const __m128i *) cur ) );
+
+        if (mask) return (cur - src) + __builtin_ctz(mask);
+
+        cur += 16;
+    }
+
+    return (cur - src) + _ascii_prefix_length_scalar( cur, end - cur );
+}
+#endif
+
+#if CBF_HAVE_AVX2
+__attribute__((target("avx2")))
+static STRLEN _ascii_prefix_length_avx2( const U8 *src, STRLEN len ) {
+    const U8 *cur = src;
+    const U8 *end = src + len;
+    __m256i chunk, next;
+    int mask;
+
+    // Test 64 bytes per iteration; only look closer on a hit.
+    while ( (end - cur) >= 64 ) {
+        chunk = _mm256_loadu_si256( (const __m256i *) cur );
+        next = _mm256_loadu_si256( (const __m256i *) (cur + 32) );
+
+        if ( _mm256_movemask_epi8( _mm256_or_si256(chunk, next) ) ) break;
+
+        cur += 64;
+    }
+
+    while ( (end - cur) >= 32 ) {
+        mask = _mm256_movemask_epi8( _mm256_loadu_si256( (const __m256i *) cur ) );
+
+        if (mask) return (cur - src) + __builtin_ctz(mask);
+
+        cur += 32;
+    }
+
+    return (cur - src) + _ascii_prefix_length_sse2( cur, end - cur );
+}
+#endif
+
+//----------------------------------------------------------------------
+// UTF-8 validation
+
+// Validates one character at a time, letting the given scanner skip
+// runs of ASCII.
+static inline bool _is_strict_utf8_with( const U8 *src, STRLEN len, ascii_scanner ascii_prefix_length ) {
+    const U8 *end = src + len;
+    U8 lead, min, max;
+    STRLEN seqlen, i;
+    UV word;
+
+    while (src < end) {
+        lead = *src;
+
+        if (lead < 0x80) {
+            src++;
+
+            // Only bother the scanner if a long run looks likely.
+            if ( (STRLEN) (end - src) >= sizeof(UV) ) {
+                Copy( src, &word, 1, UV );
+
+                if (!(word & WORD_HIGH_BITS)) {
+                    src += ascii_prefix_length( src, end - src );
+                }
+            }
+
+            continue;
+        }
+
+        // cf. RFC 3629, section 4: the 2nd byte’s range excludes
+        // overlong forms, surrogates, and code points above U+10FFFF.
+        min = 0x80;
+        max = 0xbf;
+
+        if (lead < 0xc2) {
+            return false;
+        }
+        else if (lead < 0xe0) {
+            seqlen = 2;
+        }
+        else if (lead < 0xf0) {
+            seqlen = 3;
+            if (lead == 0xe0) min = 0xa0;
+            else if (lead == 0xed) max = 0x9f;
+        }
+        else if (lead < 0xf5) {
+            seqlen = 4;
+            if (lead == 0xf0) min = 0x90;
+            else if (lead == 0xf4) max = 0x8f;
+        }
+        else {
+            return false;
+        }
+
+        if ( (STRLEN) (end - src) < seqlen ) return false;
+
+        if (src[1] < min || src[1] > max) return false;
+
+        for (i=2; i<seqlen; i++) {
+            if ((src[i] & 0xc0) != 0x80) return false;
+        }
+
+        src += seqlen;
+    }
+
+    return true;
+}
+
+static bool _is_strict_utf8_scalar( const U8 *src, STRLEN len ) {
+    return _is_strict_utf8_with( src, len, _ascii_prefix_length_scalar );
+}
+
+#if CBF_HAVE_SSE2
+static bool _is_strict_utf8_sse2( const U8 *src, STRLEN len ) {
+    return _is_strict_utf8_with( src, len, _ascii_prefix_length_sse2 );
+}
+#endif
+
+#if CBF_HAVE_AVX2
+
+// This is the “lookup” algorithm from John Keiser & Daniel Lemire,
+// “Validating UTF-8 In Less Than One Instruction Per Byte”
+// (Software: Practice and Experience, 2021). Three table lookups
+// classify each pair of adjacent bytes by error type; a separate
+// check ensures that 3- and 4-byte sequences have enough
+// continuation bytes.
+
+#define U8_TOO_SHORT        (1 << 0)
+#define U8_TOO_LONG         (1 << 1)
+#define U8_OVERLONG_3       (1 << 2)
+#define U8_TOO_LARGE        (1 << 3)
+#define U8_SURROGATE        (1 << 4)
+#define U8_OVERLONG_2       (1 << 5)
+#define U8_TOO_LARGE_1000   (1 << 6)
+#define U8_OVERLONG_4       (1 << 6)
+#define U8_TWO_CONTS        (1 << 7)
+
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define LOOKUP16(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p) \
+    _mm256_setr_epi8(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p)
+
+// The bytes that precede input’s, shifted in from prev.
+#define PREV_BYTES(input, prev, n) \
+    _mm256_alignr_epi8( input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - n )
+
+__attribute__((target("avx2")))
+static inline __m256i _utf8_block_errors( __m256i input, __m256i prev_input ) {
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+
+    const __m256i byte_1_high_table = LOOKUP16(
+        // 0_______ ________ <ASCII in byte 1>
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        // 10______ ________ <continuation in byte 1>
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        // 1100____ ________ <two byte lead in byte 1>
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        // 1101____ ________ <two byte lead in byte 1>
+        U8_TOO_SHORT,
+        // 1110____ ________ <three byte lead in byte 1>
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        // 1111____ ________ <four+ byte lead in byte 1>
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+    );
+
+    const __m256i byte_1_low_table = LOOKUP16(
+        // ____0000 ________
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+        // ____0001 ________
+        U8_CARRY | U8_OVERLONG_2,
+        // ____001_ ________
+        U8_CARRY,
+        U8_CARRY,
+        // ____0100 ________
+        U8_CARRY | U8_TOO_LARGE,
+        // ____0101 ________
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        // ____011_ ________
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        // ____1___ ________
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        // ____1101 ________
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+    );
+
+    const __m256i byte_2_high_table = LOOKUP16(
+        // ________ 0_______ <ASCII in byte 2>
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        // ________ 1000____
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        // ________ 1001____
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+        // ________ 101_____
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        // ________ 11______
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+    );
+
+    __m256i prev1 = PREV_BYTES(input, prev_input, 1);
+
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8( byte_1_high_table, _mm256_and_si256( _mm256_srli_epi16(prev1, 4), low_nibble ) ),
+            _mm256_shuffle_epi8( byte_1_low_table, _mm256_and_si256( prev1, low_nibble ) )
+        ),
+        _mm256_shuffle_epi8( byte_2_high_table, _mm256_and_si256( _mm256_srli_epi16(input, 4), low_nibble ) )
+    );
+
+    // Bytes 2 & 3 after a 3- or 4-byte lead must be continuations.
+    __m256i is_third_byte = _mm256_subs_epu8( PREV_BYTES(input, prev_input, 2), _mm256_set1_epi8( (char) (0xe0 - 0x80) ) );
+    __m256i is_fourth_byte = _mm256_subs_epu8( PREV_BYTES(input, prev_input, 3), _mm256_set1_epi8( (char) (0xf0 - 0x80) ) );
+
+    __m256i must_be_continuation = _mm256_and_si256(
+        _mm256_or_si256( is_third_byte, is_fourth_byte ),
+        _mm256_set1_epi8( (char) 0x80 )
+    );
+
+    return _mm256_xor_si256( must_be_continuation, special );
+}
+
+// Nonzero if input ends with an incomplete sequence.
+__attribute__((target("avx2")))
+static inline __m256i _utf8_block_incomplete( __m256i input ) {
+    const __m256i max_complete = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, (char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1)
+    );
+
+    return _mm256_subs_epu8( input, max_complete );
+}
+
+__attribute__((target("avx2")))
+static bool _is_strict_utf8_avx2( const U8 *src, STRLEN len ) {
+    const U8 *end = src + len;
+    __m256i input;
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    U8 tail[32];
+
+    while (src < end) {
+        if ( (end - src) >= 32 ) {
+            input = _mm256_loadu_si256( (const __m256i *) src );
+        }
+        else {
+
+            // Pad with NULs, which are ASCII.
+            Zero( tail, 32, U8 );
+            Copy( src, tail, end - src, U8 );
+            input = _mm256_loadu_si256( (const __m256i *) tail );
+        }
+
+        if ( _mm256_movemask_epi8(input) ) {
+            error = _mm256_or_si256( error, _utf8_block_errors(input, prev_input) );
+            prev_incomplete = _utf8_block_incomplete(input);
+        }
+        else {
+
+            // An all-ASCII block just needs the last one to have ended
+            // with a complete character.
+            error = _mm256_or_si256( error, prev_incomplete );
+            prev_incomplete = _mm256_setzero_si256();
+        }
+
+        prev_input = input;
+        src += 32;
+    }
+
+    error = _mm256_or_si256( error, prev_incomplete );
+
+    return _mm256_testz_si256( error, error );
+}
+#endif
+
+//----------------------------------------------------------------------
+
+static bool _cpu_has_any() {
+    return true;
+}
+
+#if CBF_HAVE_AVX2
+static bool _cpu_has_avx2() {
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx2");
+}
+#endif
+
+static const struct {
+    const char *name;
+    ascii_scanner ascii_prefix_length;
+    utf8_validator is_strict_utf8;
+    bool (*cpu_has)();
+} kernels[] = {
+
+    // Best first:
+#if CBF_HAVE_AVX2
+    { "avx2", _ascii_prefix_length_avx2, _is_strict_utf8_avx2, _cpu_has_avx2 },
+#endif
+#if CBF_HAVE_SSE2
+    { "sse2", _ascii_prefix_length_sse2, _is_strict_utf8_sse2, _cpu_has_any },
+#endif
+    { "scalar", _ascii_prefix_length_scalar, _is_strict_utf8_scalar, _cpu_has_any },
+};
+
+#define KERNELS_COUNT (sizeof(kernels) / sizeof(*kernels))
+
+// The first use picks the best kernel that the CPU supports.
+// (Threads may race to do so, but they’ll all pick the same one.)
+static int kernel_index = -1;
+
+static inline unsigned _kernel_index() {
+    if (kernel_index < 0) {
+        unsigned i = 0;
+
+        while (!kernels[i].cpu_has()) i++;
+
+        kernel_index = i;
+    }
+
+    return kernel_index;
+}
+
+STRLEN cbf_ascii_prefix_length( const U8 *src, STRLEN len ) {
+
+    if (len < CBF_STRING_KERNEL_MIN_LENGTH) return _ascii_prefix_length_scalar( src, len );
+
+    return kernels[ _kernel_index() ].ascii_prefix_length( src, len );
+}
+
+bool cbf_is_strict_utf8( const U8 *src, STRLEN len ) {
+    return kernels[ _kernel_index() ].is_strict_utf8( src, len );
+}
+
+const char *cbf_string_kernel_name() {
+    return kernels[ _kernel_index() ].name;
+}
+
+bool cbf_set_string_kernel( const char *name ) {
+    unsigned i;
+
+    for (i=0; i<KERNELS_COUNT; i++) {
+        if (strEQ(name, kernels[i].name)) {
+            if (!kernels[i].cpu_has()) break;
+
+            kernel_index = i;
+
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,57 @@
+#ifndef CBOR_FREE_UTF8
+#define CBOR_FREE_UTF8
+
+#include "easyxs/init.h"
+
+#include "cbor_free_common.h"
+
+// Every byte’s high (or low) bit in a UV.
+#define WORD_HIGH_BITS  ((~(UV) 0 / 0xff) * 0x80)
+#define WORD_LOW_BITS   (~(UV) 0 / 0xff)
+
+// Returns how many of src’s leading bytes are ASCII.
+STRLEN cbf_ascii_prefix_length( const U8 *src, STRLEN len );
+
+// Strings shorter than this aren’t worth a SIMD scan.
+#define CBF_STRING_KERNEL_MIN_LENGTH 32
+
+// Returns whether src is all ASCII.
+static inline bool cbf_is_ascii( const U8 *src, STRLEN len ) {
+    if (len >= CBF_STRING_KERNEL_MIN_LENGTH) {
+        return cbf_ascii_prefix_length( src, len ) == len;
+    }
+
+    UV bits = 0, word;
+
+    if (len >= sizeof(UV)) {
+
+        // The last word may overlap the one before it.
+        const U8 *last = src + len - sizeof(UV);
+
+        for ( ; src < last; src += sizeof(UV) ) {
+            Copy( src, &word, 1, UV );
+            bits |= word;
+        }
+
+        Copy( last, &word, 1, UV );
+
+        return !((bits | word) & WORD_HIGH_BITS);
+    }
+
+    while (len--) bits |= *src++;
+
+    return !(bits & 0x80);
+}
+
+// Returns whether src is valid UTF-8 per RFC 3629, i.e., without
+// overlong forms, surrogates, or code points above U+10FFFF.
+bool cbf_is_strict_utf8( const U8 *src, STRLEN len );
+
+// Returns the name of the kernel (e.g., "avx2") that the above use.
+const char *cbf_string_kernel_name();
+
+// Switches to the named kernel. Returns false if this CPU (or build)
+// lacks it. This is for tests & benchmarks.
+bool cbf_set_string_kernel( const char *name );
+
+#endif
@@ -5,6 +5,9 @@ use warnings;
 
 use CBOR::Free::X;
 use CBOR::Free::Tagged;
+use CBOR::Free::Raw;
+use CBOR::Free::TypedArray;
+use CBOR::Free::IOV;
 
 our ($VERSION);
 
@@ -31,8 +34,8 @@ CBOR::Free - Fast CBOR for everyone
 
     my $tagged = CBOR::Free::tag( 1, '2019-01-02T00:01:02Z' );
 
-Also see L<CBOR::Free::Decoder> for an object-oriented interface
-to the decoder.
+Also see L<CBOR::Free::Decoder> and L<CBOR::Free::Encoder> for
+object-oriented interfaces to the decoder and encoder.
 
 =head1 DESCRIPTION
 
@@ -69,6 +72,9 @@ The encoder currently does not handle any other blessed references.
 
 =item * C<canonical> - A boolean that makes the encoder output
 CBOR in L<canonical form|https://tools.ietf.org/html/rfc7049#section-3.9>.
+The encoder remembers the key order of hashes whose key sets recur
+(e.g., database rows), so canonical encoding of many similar records
+costs little more than non-canonical encoding.
 
 =item * C<string_encode_mode> - Decides the logic to use for
 CBOR encoding of strings and hash keys. (The word “string”
@@ -133,6 +139,21 @@ all the time”.
 
 Think of this option as: “Just the bytes, ma’am.”
 
+=item * C<auto>: Like C<sv>, but strings whose UTF8 flag is off become
+CBOR text if they’re all ASCII. (Only those with non-ASCII octets become
+binary.) Strings whose UTF8 flag is on must be valid UTF-8 (per
+L<RFC 3629|https://tools.ietf.org/html/rfc3629>), or else a
+C<CBOR::Free::X::InvalidUTF8> error is thrown; this rejects, e.g.,
+surrogates, which Perl otherwise allows.
+
+This is probably what you want if you don’t control whether your strings
+are decoded, B<BUT> consumers of your CBOR expect text wherever possible.
+
+Think of this option as: “Text unless it can’t be.”
+
+(Perl internals note: The ASCII and UTF-8 checks use SSE2 or AVX2
+where the CPU supports them.)
+
 =back
 
 =item * C<preserve_references> - A boolean that makes the encoder encode
@@ -151,6 +172,72 @@ little use outside all-Perl IPC contexts; it is arguably more useful, then,
 for general use to have the encoder reject data structures that most other
 languages cannot represent.
 
+=item * C<convert_blessed> - A boolean that makes the encoder call a
+C<TO_CBOR()> method on objects that have one. The method’s (scalar)
+return, which may itself be an object or a container, is encoded in
+place of the object.
+
+=item * C<freeze_objects> - A boolean that makes the encoder serialize
+objects that have a C<FREEZE()> method via L<Types::Serialiser>’s
+object serialization protocol: the method receives C<CBOR> as its
+argument, and the class name plus the method’s returns become an array
+that L<tag 26|http://cbor.schmorp.de/perl-object> tags. See
+L<CBOR::Free::Decoder>’s C<thaw_objects()> for the reverse.
+(C<convert_blessed>, if also given, takes precedence.)
+
+=item * C<compact_floats> - A boolean that makes the encoder output
+each float in the smallest of CBOR’s half-, single-, and double-precision
+forms that holds it exactly. Floats with integral values (e.g., 3.0)
+become CBOR integers. This can shrink float-heavy payloads considerably.
+(Negative zero remains a float.)
+
+=item * C<max_depth> - The maximum number of nested arrays, maps, and
+tags to encode. Defaults to 98. Since the encoder doesn’t recurse in C,
+this can safely be quite large (e.g., for deeply-nested syntax trees);
+its purpose is to catch circular references.
+
+=item * C<indefinite_magic> - A boolean that makes the encoder output
+magical (e.g., tied) hashes and arrays as indefinite-length maps and
+arrays, so it needn’t know their sizes in advance. (Canonical mode
+ignores this.) Without it such hashes are still iterated just once;
+the encoder writes each map’s length after the map’s contents.
+
+=item * C<stringrefs> - A boolean that makes the encoder deduplicate
+strings via L<the stringref extension|http://cbor.schmorp.de/stringref>:
+the output is wrapped in tag 256, and each repeat of a string (map keys
+included) becomes a tag 25 reference to the first occurrence. This can
+shrink data with many recurring strings considerably, at some cost to
+encoding speed. Each document (including each item of a CBOR sequence
+and each L<CBOR::Free::Raw>) gets its own set of references.
+L<CBOR::Free::Encoder::Stream> does not support this.
+
+=item * C<integer_keys> - A boolean that makes the encoder output hash
+keys that are integers in canonical decimal form (e.g., C<42> or C<-7>,
+but not C<042>, C<+7>, or C<-0>) as CBOR integers rather than strings.
+That saves at least 1 byte per key and matches what other CBOR encoders
+produce from integer-keyed maps. Since C<decode()> stringifies integer
+keys, such hashes round-trip unchanged. Canonical mode sorts the
+integer keys per the RFC, i.e., before all string keys.
+
+=item * C<columnar> - A boolean that makes the encoder output each array
+of two or more hashes that all have the same keys (e.g., database rows)
+in a “columnar” form: an array of the keys, then one array of values
+per hash. That outputs each key once rather than once per hash, which
+can shrink such data considerably. The keys are in the first hash’s
+order, or canonical order if C<canonical> is given.
+
+The columnar form is tagged with tag 1128416835 (0x43424643, i.e.,
+“CBFC”), which is B<not> registered with IANA, so only use this if
+whatever decodes the CBOR is CBOR::Free or understands this format.
+C<decode()> turns it back into an array of hashes.
+Blessed and magical (e.g., tied) hashes don’t qualify, and
+C<preserve_references> disables this.
+
+=item * C<size_hint> - An estimate of the encoded CBOR’s length in bytes.
+If given, the encoder starts with an output buffer of this size, which
+avoids reallocations as the output grows. (Any slack is given back before
+the encoded CBOR is returned, so an overestimate costs little.)
+
 =back
 
 Notes on mapping Perl to CBOR:
@@ -169,7 +256,8 @@ your Perl-sourced CBOR B<MUST> account for the prospect of numbers that
 are in CBOR as strings, or vice-versa.
 
 =item * Perl hash keys are serialized as strings, either binary or text
-(according to the C<string_encode_mode>).
+(according to the C<string_encode_mode>), unless the
+C<integer_keys> option is given.
 
 =item * L<Types::Serialiser> booleans are encoded as CBOR booleans.
 Perl undef is encoded as CBOR null. (NB: No Perl value encodes as CBOR
@@ -185,9 +273,138 @@ exception, and other shared references are not preserved.
 
 =item * Instances of L<CBOR::Free::Tagged> are encoded as tagged values.
 
+=item * Instances of L<CBOR::Free::Raw> are output verbatim, which lets
+you embed already-encoded CBOR without decoding it.
+
+=item * Instances of L<CBOR::Free::TypedArray> are encoded as
+L<RFC 8746|https://www.rfc-editor.org/rfc/rfc8746.html> typed arrays,
+which store packed numbers as one byte string. For large numeric
+arrays this is far faster (and smaller) than encoding each number.
+
+=item * Other objects are unhandled by default. The C<convert_blessed>
+and C<freeze_objects> flags let them define their own serialization.
+Either way, CBOR::Free looks up an object’s methods once per class
+per call (or, for L<CBOR::Free::Encoder>, until the class changes).
+
+=back
+
+An error is thrown on excess nesting (see C<max_depth> above) or an
+unrecognized object.
+
+If you encode many documents with the same options, see
+L<CBOR::Free::Encoder>, which avoids some per-call overhead.
+To build a huge array or map one member at a time, see
+L<CBOR::Free::Encoder::Stream>.
+
+=head2 $cbor = encode_sequence( \@ITEMS, %OPTS )
+
+=head2 ($cbor, $offsets_ar) = encode_sequence( \@ITEMS, %OPTS )
+
+Encodes each member of @ITEMS as a separate CBOR document and
+concatenates them, which yields a
+L<CBOR sequence|https://tools.ietf.org/html/rfc8742>. (Cf.
+L<CBOR::Free::SequenceDecoder>.) This is equivalent to, but faster than,
+concatenating individual C<encode()> calls’ outputs.
+
+%OPTS are as for C<encode()>. With C<preserve_references>, references
+are shared only within each item, not across items.
+
+In list context this also returns a reference to an array of each
+item’s starting offset in $cbor.
+
+
+Like C<encode()>, but rather than returning the CBOR, this writes it
+to $FH in chunks as the encoder’s buffer fills. The encoder’s memory
+usage thus stays constant rather than growing with the output, which
+helps when encoding very large documents.
+
+$FH must be a writable Perl filehandle. (Tied filehandles aren’t
+supported; use C<encode_to_cb()> for those.) You probably want to
+C<binmode()> it first.
+
+%OPTS are as for C<encode()>, plus:
+
+=over
+
+=item * C<chunk_size> - The size, in bytes, of the encoder’s buffer,
+i.e., of each write. Defaults to 65,536. (Strings bigger than this are
+written separately.)
+
 =back
 
-An error is thrown on excess recursion or an unrecognized object.
+Returns the number of bytes written. If an error occurs, whatever
+output was already written stays written.
+
+=head2 $count = encode_to_cb( $CODEREF, $DATA, %OPTS )
+
+Like C<encode_to_fh()>, but each chunk of output is given to $CODEREF
+instead. If $CODEREF throws, the exception propagates.
+
+=head2 $count = encode_into( $BUFFER, $DATA, %OPTS )
+
+Like C<encode()>, but this appends the CBOR to $BUFFER, a string
+that you already have (e.g., a connection’s output buffer). That
+avoids creating a new string for the CBOR and then copying it onto
+$BUFFER. The encoder writes straight into $BUFFER’s memory, using
+whatever spare capacity it has and growing it as needed.
+
+If $BUFFER is undef, it becomes an empty string first. It must not
+contain wide characters. While the encoder runs, $BUFFER is undef;
+Perl code that runs during the encode (e.g., a C<TO_CBOR()> method)
+mustn’t expect to see or change it.
+
+%OPTS are as for C<encode()>, plus:
+
+=over
+
+=item * C<length_prefix> - The size, in bytes (1, 2, 4, or 8), of an
+unsigned big-endian integer to put before the CBOR that gives the CBOR’s
+length. This is a common way to frame messages on a byte stream. An
+exception is thrown if the CBOR is too long for the prefix.
+
+=back
+
+Returns the number of bytes appended, including any length prefix.
+If an error occurs, $BUFFER is as it was before the call.
+
+=head2 $length = encoded_length( $DATA, %OPTS )
+
+Returns the length, in bytes, of the CBOR that C<encode()> would
+give for $DATA and %OPTS, without creating that CBOR. Use this when
+you need to know how much you’ll send before you send it (e.g., for
+admission control or a length prefix).
+
+This runs the same encoder as C<encode()>, so it throws the same
+exceptions, calls the same C<TO_CBOR()> methods, etc. It avoids the
+cost of copying long strings, converting strings per
+C<string_encode_mode>, and allocating the output. For data that
+consists mostly of small items, though, expect it to cost about as
+much as C<encode()>.
+
+=head2 $iov = encode_iov( $DATA, %OPTS )
+
+Like C<encode()>, but this returns the CBOR as a L<CBOR::Free::IOV>
+instance: a list of segments for scatter-gather output via
+L<writev(2)>. Long strings aren’t copied into the CBOR; instead each
+is a segment of its own that shares the original string’s buffer.
+This suits responses that carry large blobs (e.g., file contents).
+
+%OPTS are as for C<encode()>, plus:
+
+=over
+
+=item * C<iov_threshold> - The minimum length, in bytes, for a string
+to get its own segment. Defaults to 4,096. Shorter strings are copied
+as usual, since a segment of their own would cost more than the copy.
+
+=back
+
+A string can only get its own segment where C<encode_to_fh()> could
+flush its buffer. Thus, strings in C<stringrefs> mode, or inside a
+tied container without C<indefinite_magic>, are always copied. Strings
+that need conversion per C<string_encode_mode> are also copied.
+C<CBOR::Free::Raw> and C<CBOR::Free::TypedArray> buffers count as
+strings.
 
 =head2 $data = decode( $CBOR )
 
@@ -237,6 +454,13 @@ active; unlike with the encoder, there is no need to enable it manually.
 =item * C<preserve_references()> mode complements the same flag
 given to the encoder.
 
+=item * The C<columnar> encode option’s tag is always expanded to an array
+of hashes. (See L<CBOR::Free::Decoder> if you want the columnar form.)
+
+=item * Stringrefs (tags 256 and 25) are always resolved. Long strings
+that a document references more than once share a buffer (via Perl’s
+copy-on-write) rather than being copied.
+
 =item * This function does not interpret any other tags. If you need to
 decode other tags, look at L<CBOR::Free::Decoder>. Any unhandled tags that
 this function sees prompt a warning but are otherwise ignored.
@@ -345,7 +569,9 @@ sub tag {
 #----------------------------------------------------------------------
 
 sub _die_recursion {
-    die CBOR::Free::X->create( 'Recursion', _MAX_RECURSION());
+    my ($max_depth) = @_;
+
+    die CBOR::Free::X->create( 'Recursion', $max_depth // _MAX_RECURSION());
 }
 
 sub _die {
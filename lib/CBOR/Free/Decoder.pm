@@ -80,6 +80,52 @@ If in doubt, leave this off.
 
 #----------------------------------------------------------------------
 
+=head2 $enabled_yn = I<OBJ>->lazy_embedded_cbor( [$ENABLE] )
+
+Same interface as C<preserve_references()>. When enabled, this makes
+I<OBJ> decode
+L<tag 24 (“encoded CBOR data item”)|https://www.rfc-editor.org/rfc/rfc8949.html#name-encoded-cbor-data-item>
+byte strings to L<CBOR::Free::Raw> instances rather than decoding them
+further. That saves work if you’ll just re-encode the tagged CBOR as-is;
+if you do need its contents, call the instance’s C<decode()> method.
+
+=cut
+
+#----------------------------------------------------------------------
+
+=head2 $enabled_yn = I<OBJ>->thaw_objects( [$ENABLE] )
+
+Same interface as C<preserve_references()>. When enabled, this makes
+I<OBJ> decode L<tag 26|http://cbor.schmorp.de/perl-object> (i.e.,
+what C<CBOR::Free::encode()>’s C<freeze_objects> flag outputs) by
+calling the named class’s C<THAW()> method, per L<Types::Serialiser>’s
+object serialization protocol. The method receives C<CBOR> then the
+tagged array’s remaining items, and its return replaces the tagged
+value. An exception is thrown if the class lacks a C<THAW()> method.
+
+CBOR::Free does not load the class for you. B<HANDLE WITH CARE:> this
+lets whoever produced the CBOR call C<THAW()> on any class that your
+application has loaded.
+
+=cut
+
+#----------------------------------------------------------------------
+
+=head2 $enabled_yn = I<OBJ>->keep_columnar( [$ENABLE] )
+
+Same interface as C<preserve_references()>. When enabled, this makes
+I<OBJ> treat the tag that C<CBOR::Free::encode()>’s C<columnar> flag
+outputs like any other tag: the columnar form itself (i.e., an array
+whose first item is an array of the keys and whose remaining items are
+arrays of each row’s values) goes to the tag’s handler (see
+C<set_tag_handlers()>), if any. That’s cheaper than creating a hash per
+row if you’ll just read the values in order. As with other tags, if
+there is no handler you get the columnar form and a warning.
+
+=cut
+
+#----------------------------------------------------------------------
+
 =head2 $obj = I<OBJ>->string_decode_cbor();
 
 This causes I<OBJ> to decode strings according to their CBOR type:
@@ -101,6 +147,32 @@ enabled. This is useful if you expect all strings (including binary) to be
 UTF-8 and want to handle them in Perl as character strings instead of
 byte strings.
 
+=head2 $obj = I<OBJ>->typed_arrays_as_tags();
+
+This causes I<OBJ> to treat
+L<RFC 8746|https://www.rfc-editor.org/rfc/rfc8746.html> typed arrays
+(tags 64 to 87) like any other tag: the tagged byte string goes to
+the tag’s handler (see C<set_tag_handlers()>), if any. This is the
+default configuration.
+
+=head2 $obj = I<OBJ>->typed_arrays_as_arrays();
+
+This causes I<OBJ> to decode typed arrays to Perl arrays of numbers.
+(Perl can’t represent 128-bit floats, so their tags are left alone.)
+
+=head2 $obj = I<OBJ>->typed_arrays_as_packed();
+
+This causes I<OBJ> to decode typed arrays to byte strings of packed
+numbers in the system’s byte order, as Perl’s C<pack()> would create.
+This is much faster than C<typed_arrays_as_arrays()> for large arrays
+since it needs only one copy (or byte swap) of the data.
+
+=head2 $obj = I<OBJ>->typed_arrays_as_objects();
+
+Like C<typed_arrays_as_packed()> but decodes to
+L<CBOR::Free::TypedArray> instances, which preserve the arrays’
+element types and re-encode to the same CBOR.
+
 =head2 I<OBJ>->set_tag_handlers( %TAG_CALLBACK )
 
 Takes a list of key/value pairs where each key is a tag (i.e., number)
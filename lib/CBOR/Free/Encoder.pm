@@ -0,0 +1,71 @@
+package CBOR::Free::Encoder;
+
+use strict;
+use warnings;
+
+=encoding utf-8
+
+=head1 NAME
+
+CBOR::Free::Encoder
+
+=head1 SYNOPSIS
+
+    my $encoder = CBOR::Free::Encoder->new( canonical => 1 );
+
+    for my $msg (@messages) {
+        my $cbor = $encoder->encode($msg);
+
+        # …
+    }
+
+=head1 DESCRIPTION
+
+This class provides an object-oriented interface to L<CBOR::Free>’s
+encoder. It’s useful when you need to encode many documents with the
+same options: the options are parsed only once, and the encoder sizes
+its output buffers according to what it has recently encoded, which
+reduces reallocations.
+
+=cut
+
+#----------------------------------------------------------------------
+
+use CBOR::Free ();
+
+#----------------------------------------------------------------------
+
+=head1 METHODS
+
+=head2 $obj = I<CLASS>->new( %OPTS )
+
+Creates a new CBOR encoder object. %OPTS are the same as
+L<CBOR::Free>’s C<encode()> accepts.
+
+=head2 $cbor = I<OBJ>->encode( $DATA )
+
+Same as L<CBOR::Free>’s static function of the same name but uses
+the options given to C<new()>.
+
+=head2 $cbor = I<OBJ>->encode_sequence( \@ITEMS )
+
+=head2 ($cbor, $offsets_ar) = I<OBJ>->encode_sequence( \@ITEMS )
+
+Likewise.
+
+=head2 $count = I<OBJ>->encode_into( $BUFFER, $DATA )
+
+Likewise. (Give C<length_prefix> to C<new()>.)
+
+=head2 $length = I<OBJ>->encoded_length( $DATA )
+
+Likewise. The next C<encode()> then allocates at least this much
+space up front.
+
+=head2 $iov = I<OBJ>->encode_iov( $DATA )
+
+Likewise. (Give C<iov_threshold> to C<new()>.)
+
+=cut
+
+1;
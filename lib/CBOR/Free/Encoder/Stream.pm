@@ -0,0 +1,110 @@
+package CBOR::Free::Encoder::Stream;
+
+use strict;
+use warnings;
+
+=encoding utf-8
+
+=head1 NAME
+
+CBOR::Free::Encoder::Stream
+
+=head1 SYNOPSIS
+
+    my $stream = CBOR::Free::Encoder::Stream->new( canonical => 1 );
+
+    $stream->begin_array();
+
+    while (my $row = $sth->fetchrow_hashref()) {
+        $stream->add($row);
+
+        print {$fh} $stream->take_bytes();
+    }
+
+    $stream->end();
+
+    print {$fh} $stream->take_bytes();
+
+=head1 DESCRIPTION
+
+This class builds CBOR incrementally via indefinite-length arrays
+and maps. You add one member at a time, and you can take the CBOR
+output so far whenever you want. Thus, you can encode an array of
+millions of rows without ever holding all of those rows (or all of
+their CBOR) in memory at once.
+
+Each value that you add is encoded just as L<CBOR::Free>’s C<encode()>
+would encode it.
+
+=cut
+
+#----------------------------------------------------------------------
+
+use CBOR::Free ();
+
+#----------------------------------------------------------------------
+
+=head1 METHODS
+
+=head2 $obj = I<CLASS>->new( %OPTS )
+
+Creates a new stream. %OPTS are the same as L<CBOR::Free>’s C<encode()>
+accepts, with these caveats:
+
+=over
+
+=item * C<max_depth> limits how many arrays and maps may be open at
+once. It also applies separately to each added value.
+
+=item * C<canonical> applies only within added values. Members of
+the stream’s own maps are output in the order you add them.
+
+=item * With C<preserve_references>, references are shared only
+within a single added value. (Earlier values’ referents may no longer
+exist, so the stream forgets them.)
+
+=back
+
+=head2 I<OBJ>->begin_array()
+
+=head2 I<OBJ>->begin_map()
+
+Starts an indefinite-length array or map. Everything you add until
+the matching C<end()> becomes a member of it.
+
+If the innermost open container is a map, give the new container’s
+key as an argument, e.g., C<$stream-E<gt>begin_array('rows')>.
+
+=head2 I<OBJ>->add( $VALUE )
+
+Encodes $VALUE. If no array or map is open, $VALUE becomes a
+top-level item in its own right, so the output is a
+L<CBOR sequence|https://tools.ietf.org/html/rfc8742>.
+
+If the innermost open container is a map, use C<add_pair()> instead.
+
+=head2 I<OBJ>->add_pair( $KEY, $VALUE )
+
+Like C<add()> but for maps. $KEY is encoded like any other value,
+so it will be a CBOR string unless it’s a number, a reference, etc.
+
+=head2 I<OBJ>->end()
+
+Ends the innermost open array or map.
+
+=head2 $depth = I<OBJ>->depth()
+
+Returns the number of open arrays and maps.
+
+=head2 $cbor = I<OBJ>->take_bytes()
+
+Returns the CBOR that the stream has output since the last
+C<take_bytes()> and removes it from the stream.
+
+If any of the above methods throws (e.g., because C<add()> was given
+an unrecognized object), the stream discards whatever that call
+output and remains usable.
+
+=cut
+
+1;
@@ -0,0 +1,60 @@
+package CBOR::Free::IOV;
+
+use strict;
+use warnings;
+
+=encoding utf-8
+
+=head1 NAME
+
+CBOR::Free::IOV
+
+=head1 SYNOPSIS
+
+    my $iov = CBOR::Free::encode_iov( { name => $name, file => $blob } );
+
+    # One writev() call (more for many segments) and no copy of $blob:
+    $iov->writev($socket);
+
+    # The same CBOR that CBOR::Free::encode() would give:
+    my $cbor = join q<>, $iov->segments();
+
+=head1 DESCRIPTION
+
+This class holds L<CBOR::Free>’s C<encode_iov()> output: a list of
+byte strings (“segments”) whose concatenation is the CBOR.
+
+Each string at least as long as C<encode_iov()>’s C<iov_threshold>
+is a segment of its own that shares its buffer with the original
+string via Perl’s copy-on-write mechanism. (Perl may still copy the
+string, e.g., if the original’s buffer has no room for copy-on-write
+bookkeeping.) Later changes to the original don’t affect the segment.
+
+Everything else, including those strings’ CBOR heads, is in the
+segments between.
+
+=head1 METHODS
+
+=head2 @segments = I<OBJ>->segments()
+
+Returns the segments, in order.
+
+=cut
+
+sub segments { @{ $_[0] } }
+
+=head2 $count = I<OBJ>->writev( $FH_OR_FD )
+
+Writes all of the segments to a Perl filehandle or a file descriptor
+number, via L<writev(2)> where the system has it. Partial writes and
+C<EINTR> are retried; other failures (including, for non-blocking
+descriptors, C<EAGAIN>) throw.
+
+If you give a Perl filehandle, Perl’s buffer for it is flushed
+first.
+
+Returns the number of bytes written.
+
+=cut
+
+1;
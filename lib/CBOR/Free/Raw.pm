@@ -0,0 +1,83 @@
+package CBOR::Free::Raw;
+
+use strict;
+use warnings;
+
+=encoding utf-8
+
+=head1 NAME
+
+CBOR::Free::Raw
+
+=head1 SYNOPSIS
+
+    my $profile = CBOR::Free::Raw->new( $cached_profile_cbor );
+
+    my $cbor = CBOR::Free::encode( { user => $profile, status => 'ok' } );
+
+    # The same, but as tag 24 (“encoded CBOR data item”):
+    my $embedded = CBOR::Free::Raw->new( $cached_profile_cbor, 1 );
+
+=head1 DESCRIPTION
+
+This class represents already-encoded CBOR. L<CBOR::Free>’s encoder
+copies an instance’s CBOR into its output as-is, so you can assemble
+CBOR documents from cached pieces without decoding and re-encoding
+those pieces.
+
+The encoder does B<not> validate the CBOR that you give it. If it’s
+invalid, so is the output.
+
+L<CBOR::Free::Decoder>’s C<lazy_embedded_cbor()> option decodes
+tag 24 to instances of this class.
+
+=head1 METHODS
+
+=head2 $obj = I<CLASS>->new( $CBOR [, $EMBEDDED_YN] )
+
+$CBOR is a byte string that contains exactly one CBOR data item.
+If $EMBEDDED_YN is truthy, then the encoder outputs $CBOR as a byte
+string in tag 24 rather than splicing it in.
+
+Returns a class instance.
+
+=cut
+
+sub new {
+    my ($class, $cbor, $embedded) = @_;
+
+    die 'Raw CBOR must not be empty!' if !length $cbor;
+
+    utf8::downgrade($cbor);
+
+    return bless [ $cbor, !!$embedded ], $class;
+}
+
+=head2 $cbor = I<OBJ>->bytes()
+
+Returns the instance’s CBOR.
+
+=cut
+
+sub bytes { $_[0][0] }
+
+=head2 $yn = I<OBJ>->embedded()
+
+Returns a boolean that indicates whether the encoder will output
+I<OBJ> as tag 24.
+
+=cut
+
+sub embedded { $_[0][1] }
+
+=head2 $data = I<OBJ>->decode()
+
+Decodes the instance’s CBOR via L<CBOR::Free>’s C<decode()>.
+
+=cut
+
+sub decode {
+    return CBOR::Free::decode( $_[0][0] );
+}
+
+1;
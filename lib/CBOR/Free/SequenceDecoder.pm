@@ -50,12 +50,26 @@ with L<CBOR::Free::Decoder>:
 
 =item * C<naive_utf8()>
 
+=item * C<lazy_embedded_cbor()>
+
+=item * C<thaw_objects()>
+
+=item * C<keep_columnar()>
+
 =item * C<string_decode_cbor()>
 
 =item * C<string_decode_never()>
 
 =item * C<string_decode_always()>
 
+=item * C<typed_arrays_as_tags()>
+
+=item * C<typed_arrays_as_arrays()>
+
+=item * C<typed_arrays_as_packed()>
+
+=item * C<typed_arrays_as_objects()>
+
 =item * C<set_tag_handlers()>
 
 =back
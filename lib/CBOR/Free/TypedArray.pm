@@ -0,0 +1,181 @@
+package CBOR::Free::TypedArray;
+
+use strict;
+use warnings;
+
+=encoding utf-8
+
+=head1 NAME
+
+CBOR::Free::TypedArray
+
+=head1 SYNOPSIS
+
+    my $samples = CBOR::Free::TypedArray->new( 'float64', pack 'd*', @samples );
+
+    my $cbor = CBOR::Free::encode( { sensor => 'a1', samples => $samples } );
+
+    # Output big-endian, regardless of this system’s byte order:
+    my $be = CBOR::Free::TypedArray->new( 'float64be', pack 'd*', @samples );
+
+=head1 DESCRIPTION
+
+This class represents an
+L<RFC 8746|https://www.rfc-editor.org/rfc/rfc8746.html> typed array:
+a buffer of packed numbers that CBOR stores as a single tagged byte
+string rather than as an array of separately-encoded items. That makes
+large numeric arrays (e.g., time series) much cheaper to encode and
+decode.
+
+The buffer is always in the system’s own byte order, as Perl’s
+C<pack()> creates by default. The type determines the byte order of
+the encoded CBOR; the encoder swaps bytes as needed.
+
+L<CBOR::Free::Decoder>’s C<typed_arrays_as_objects()> option decodes
+typed arrays to instances of this class.
+
+=head1 TYPES
+
+=over
+
+=item * C<uint8>, C<uint8_clamped>, C<int8>
+
+=item * C<uint16>, C<uint32>, C<uint64>
+
+=item * C<int16>, C<int32>, C<int64>
+
+=item * C<float16>, C<float32>, C<float64>, C<float128>
+
+=back
+
+All but the 8-bit types may have a C<le> or C<be> suffix (e.g.,
+C<float64le>) to select little- or big-endian CBOR output. Without
+a suffix the output is in the system’s byte order, which needs no
+swapping.
+
+(Perl’s C<pack()> can’t create C<float16> or C<float128> values, but
+you can still encode and decode them.)
+
+=cut
+
+my $NATIVE_ORDER = ( pack('S', 1) eq pack('v', 1) ) ? 'le' : 'be';
+
+my %TAG = (
+    uint8 => 64,
+    uint16be => 65,
+    uint32be => 66,
+    uint64be => 67,
+    uint8_clamped => 68,
+    uint16le => 69,
+    uint32le => 70,
+    uint64le => 71,
+    int8 => 72,
+    int16be => 73,
+    int32be => 74,
+    int64be => 75,
+    int16le => 77,
+    int32le => 78,
+    int64le => 79,
+    float16be => 80,
+    float32be => 81,
+    float64be => 82,
+    float128be => 83,
+    float16le => 84,
+    float32le => 85,
+    float64le => 86,
+    float128le => 87,
+);
+
+$TAG{$_} = $TAG{"$_$NATIVE_ORDER"} for map { ( "uint$_", "int$_", "float$_" ) } 16, 32, 64;
+$TAG{$_} = $TAG{"$_$NATIVE_ORDER"} for qw( float16 float128 );
+
+my %UNPACK_TEMPLATE = (
+    uint8 => 'C',
+    uint8_clamped => 'C',
+    int8 => 'c',
+    uint16 => 'S',
+    uint32 => 'L',
+    uint64 => 'Q',
+    int16 => 's',
+    int32 => 'l',
+    int64 => 'q',
+    float32 => 'f',
+    float64 => 'd',
+);
+
+=head1 METHODS
+
+=head2 $obj = I<CLASS>->new( $TYPE, $PACKED )
+
+$TYPE is one of the L</TYPES> above. $PACKED is a byte string of
+packed $TYPE values in the system’s byte order; its length must be a
+multiple of the values’ size.
+
+Returns a class instance.
+
+=cut
+
+sub new {
+    my ($class, $type, $packed) = @_;
+
+    my $tag = $TAG{$type} or die "Unknown typed array type: $type";
+
+    utf8::downgrade($packed);
+
+    my $width = _width($tag);
+
+    die "Typed array ($type) length must be a multiple of $width, not " . length($packed) if length($packed) % $width;
+
+    return bless [ $type, $packed, $tag ], $class;
+}
+
+=head2 $type = I<OBJ>->type()
+
+Returns the instance’s type. For decoded instances this always has
+a byte-order suffix that matches the CBOR (except for 8-bit types).
+
+=cut
+
+sub type { $_[0][0] }
+
+=head2 $packed = I<OBJ>->packed()
+
+Returns the instance’s packed values, in the system’s byte order.
+
+=cut
+
+sub packed { $_[0][1] }
+
+=head2 $count = I<OBJ>->count()
+
+Returns the number of values in the instance.
+
+=cut
+
+sub count { length( $_[0][1] ) / _width( $_[0][2] ) }
+
+=head2 @values = I<OBJ>->values()
+
+Returns the instance’s values, as C<unpack()> gives them. This throws
+for C<float16> and C<float128>, which C<unpack()> doesn’t support.
+
+=cut
+
+sub values {
+    my ($self) = @_;
+
+    ( my $base_type = $self->[0] ) =~ s<(?:le|be)\z><>;
+
+    my $template = $UNPACK_TEMPLATE{$base_type} or die "Cannot unpack $self->[0] values!";
+
+    return unpack "$template*", $self->[1];
+}
+
+# cf. cbf_typed_array_width()
+sub _width {
+    my ($tag) = @_;
+
+    return ( ($tag & 0x10) ? 2 : 1 ) << ($tag & 3);
+}
+
+1;
@@ -6,9 +6,9 @@ use warnings;
 use parent qw( CBOR::Free::X::Base );
 
 sub _new {
-    my ($class, $max_recursion) = @_;
+    my ($class, $max_depth) = @_;
 
-    return $class->SUPER::_new("Refuse to encode() more than $max_recursion times at once!");
+    return $class->SUPER::_new("Refuse to encode() more than $max_depth levels of nesting!");
 }
 
 1;
@@ -0,0 +1,241 @@
+#!/usr/bin/env perl
+
+package t::columnar;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::Encoder;
+use CBOR::Free::SequenceDecoder;
+
+__PACKAGE__->runtests() if !caller;
+
+use constant TAG => "\xda\x43\x42\x46\x43";
+
+sub _rows {
+    return [ map { { id => $_, name => "name $_", score => $_ / 4, tags => [ 'a', $_ ], note => undef } } 1 .. 50 ];
+}
+
+sub T4_wire {
+    my $rows = [ { a => 1, bb => 'x' }, { a => 2, bb => 'y' } ];
+
+    is(
+        CBOR::Free::encode( $rows, columnar => 1, canonical => 1 ),
+        TAG . "\x83\x82\x41a\x42bb\x82\x01\x41x\x82\x02\x41y",
+        'canonical: keys once, then rows of values',
+    );
+
+    my $cbor = CBOR::Free::encode( $rows, columnar => 1 );
+
+    is_deeply( CBOR::Free::decode($cbor), $rows, 'round trip' );
+
+    is_deeply(
+        CBOR::Free::decode( TAG . "\x9f\x82\x41a\x42bb\x9f\x01\x41x\xff\x82\x02\x41y\xff" ),
+        $rows,
+        'decode indefinite-length arrays',
+    );
+
+    cmp_ok(
+        length( CBOR::Free::encode( _rows(), columnar => 1 ) ),
+        '<',
+        0.6 * length( CBOR::Free::encode( _rows() ) ),
+        'smaller',
+    );
+}
+
+sub T7_options {
+    my $rows = _rows();
+
+    my @optsets = (
+        [ canonical => 1 ],
+        [ string_encode_mode => 'encode_text' ],
+        [ string_encode_mode => 'as_binary', canonical => 1 ],
+        [ string_encode_mode => 'auto' ],
+        [ stringrefs => 1 ],
+        [ integer_keys => 1, canonical => 1 ],
+    );
+
+    for my $opts (@optsets) {
+        my $cbor = CBOR::Free::encode( [ $rows, { 5 => 1, -1 => 2 }, { 5 => 3, -1 => 4 } ], columnar => 1, @$opts );
+
+        is_deeply(
+            CBOR::Free::decode($cbor),
+            [ $rows, { 5 => 1, -1 => 2 }, { 5 => 3, -1 => 4 } ],
+            "@$opts",
+        );
+    }
+
+    my %sizes = map {
+        my $cbor = CBOR::Free::encode( $rows, columnar => 1, @$_ );
+        ( $cbor => CBOR::Free::encoded_length( $rows, columnar => 1, @$_ ) );
+    } @optsets;
+
+    is_deeply(
+        [ grep { $sizes{$_} != length } keys %sizes ],
+        [],
+        'encoded_length() agrees',
+    );
+}
+
+sub T8_not_columnar {
+    require Tie::Hash;
+    tie my %tied, 'Tie::StdHash';
+    %tied = ( a => 1 );
+
+    my %arrays = (
+        'one hash' => [ { a => 1 } ],
+        'different keys' => [ { a => 1 }, { b => 1 } ],
+        'different key counts' => [ { a => 1 }, { a => 1, b => 2 } ],
+        'empty hashes' => [ {}, {} ],
+        'a non-hash' => [ { a => 1 }, [ 1 ] ],
+        'an object' => [ { a => 1 }, CBOR::Free::tag( 1, { a => 1 } ) ],
+        'a tied hash' => [ { a => 1 }, \%tied ],
+    );
+
+    for my $name ( sort keys %arrays ) {
+        is(
+            CBOR::Free::encode( $arrays{$name}, columnar => 1 ),
+            CBOR::Free::encode( $arrays{$name} ),
+            $name,
+        );
+    }
+
+    my $row = { a => 1 };
+
+    is(
+        CBOR::Free::encode( [ $row, $row ], columnar => 1, preserve_references => 1 ),
+        CBOR::Free::encode( [ $row, $row ], preserve_references => 1 ),
+        'preserve_references',
+    );
+}
+
+# A TO_CBOR method can change the rows mid-encode.
+sub T2_changed_rows {
+    my $rows = [ map { { a => $_, b => $_ } } 1 .. 3 ];
+
+    no warnings 'once';
+    local *Changer::TO_CBOR = sub {
+        delete $rows->[2]{'b'};
+        $rows->[1] = 'gone';
+        return 0;
+    };
+
+    $rows->[0]{'b'} = bless {}, 'Changer';
+
+    my $cbor = CBOR::Free::encode( $rows, columnar => 1, canonical => 1, convert_blessed => 1 );
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        [ { a => 1, b => 0 }, { a => undef, b => undef }, { a => 3, b => undef } ],
+        'missing values are null',
+    );
+
+    # Rows after the first still find the key that the first lost.
+    my $long_key = 'k' x 40;
+
+    $rows = [ map { { a => $_, $long_key => $_ } } 1 .. 3 ];
+
+    my %reuse;
+
+    local *Changer::TO_CBOR = sub {
+        delete $rows->[0]{$long_key};
+
+        # Encourage reuse of the deleted key’s memory:
+        $reuse{ sprintf '%040d', $_ } = 1 for 1 .. 100;
+
+        return 0;
+    };
+
+    $rows->[0]{'a'} = bless {}, 'Changer';
+
+    $cbor = CBOR::Free::encode( $rows, columnar => 1, canonical => 1, convert_blessed => 1 );
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        [ { a => 0, $long_key => undef }, { a => 2, $long_key => 2 }, { a => 3, $long_key => 3 } ],
+        'first row loses a key',
+    );
+}
+
+sub T3_encoder {
+    my $enc = CBOR::Free::Encoder->new( columnar => 1, canonical => 1 );
+
+    my @cbors = map { $enc->encode( _rows() ) } 1 .. 2;
+
+    is( $cbors[0], $cbors[1], 'encoder, repeatedly' );
+    is( $cbors[0], CBOR::Free::encode( _rows(), columnar => 1, canonical => 1 ), 'same as encode()' );
+
+    is( substr( $cbors[0], 0, 5 ), TAG, 'tag' );
+}
+
+sub T7_keep_columnar {
+    my $rows = [ { a => 1, "\x{100}" => 2 }, { a => 3, "\x{100}" => 4 } ];
+    my $cbor = CBOR::Free::encode( $rows, columnar => 1, canonical => 1 );
+
+    my $columnar = [ [ 'a', "\x{100}" ], [ 1, 2 ], [ 3, 4 ] ];
+
+    my $dec = CBOR::Free::Decoder->new();
+
+    is_deeply( $dec->decode($cbor), $rows, 'expands by default' );
+
+    ok( $dec->keep_columnar(), 'enable' );
+
+    $dec->set_tag_handlers( 0x43424643 => sub { [ columnar => @_ ] } );
+
+    is_deeply(
+        $dec->decode($cbor),
+        [ columnar => $columnar ],
+        'keep_columnar: the tag handler receives the columnar form',
+    );
+
+    $dec->set_tag_handlers( 0x43424643 => undef );
+
+    my @warnings;
+
+    {
+        local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+        is_deeply( $dec->decode($cbor), $columnar, '… or, without a handler, it’s the value' );
+    }
+
+    like( "@warnings", qr<1128416835>, '… with a warning' );
+
+    ok( !$dec->keep_columnar(0), 'disable' );
+
+    my $seqdec = CBOR::Free::SequenceDecoder->new();
+    $seqdec->keep_columnar(1);
+    $seqdec->set_tag_handlers( 0x43424643 => sub { [ columnar => @_ ] } );
+
+    is_deeply(
+        ${ $seqdec->give($cbor) },
+        [ columnar => $columnar ],
+        'sequence decoder',
+    );
+}
+
+sub T4_decode_errors {
+    my @bad = (
+        [ TAG . "\x01" => 'not an array' ],
+        [ TAG . "\x80" => 'empty array' ],
+        [ TAG . "\x82\x81\x80\x81\x01" => 'array key' ],
+        [ TAG . "\x82\x82\x41a\x41b\x81\x01" => 'short row' ],
+    );
+
+    for my $t (@bad) {
+        throws_ok(
+            sub { CBOR::Free::decode( $t->[0] ) },
+            qr<1128416835>,
+            $t->[1],
+        );
+    }
+}
+
+1;
@@ -0,0 +1,67 @@
+#!/usr/bin/env perl
+
+package t::compact_floats;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T11_widths {
+    my @tests = (
+        [ 0.5 => "\xf9\x38\x00" ],
+        [ -1.25 => "\xf9\xbd\x00" ],
+        [ 65504.5 => "\xfa\x47\x7f\xe0\x80" ],
+        [ 2**-24 => "\xf9\x00\x01" ],
+        [ 2**-25 => "\xfa\x33\x00\x00\x00" ],
+        [ 0.1 => "\xfb\x3f\xb9\x99\x99\x99\x99\x99\x9a" ],
+        [ 1e300 => "\xfb\x7e\x37\xe4\x3c\x88\x00\x75\x9c" ],
+        [ unpack('d>', "\x80" . ("\0" x 7)) => "\xf9\x80\x00" ],
+        [ 3.0 => "\x03" ],
+        [ -3.0 => "\x22" ],
+        [ 1e10 => "\x1b\x00\x00\x00\x02\x54\x0b\xe4\x00" ],
+    );
+
+    for my $t (@tests) {
+        my ($num, $cbor) = @$t;
+
+        my $nv = $num;
+
+        is(
+            sprintf('%v.02x', CBOR::Free::encode($nv, compact_floats => 1)),
+            sprintf('%v.02x', $cbor),
+            "compact: $num",
+        );
+    }
+}
+
+sub T2_default_unchanged {
+    is(
+        CBOR::Free::encode(0.5),
+        "\xfb\x3f\xe0\x00\x00\x00\x00\x00\x00",
+        'floats are still doubles by default',
+    );
+
+    is(
+        CBOR::Free::encode(3.0),
+        "\xfb\x40\x08\x00\x00\x00\x00\x00\x00",
+        'integral NVs are still doubles by default',
+    );
+}
+
+sub T1_round_trip {
+    my @nums = map { $_ / 8, -$_ / 8, $_ * 1.1, 2**$_, 2**-$_ } 0 .. 200;
+
+    my $rt = CBOR::Free::decode( CBOR::Free::encode(\@nums, compact_floats => 1) );
+
+    my @mismatches = grep { $rt->[$_] != $nums[$_] } 0 .. $#nums;
+
+    is( "@mismatches", q<>, 'round trip' );
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env perl
+
+package t::encode_buffer;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+
+use parent qw( Test::Class::Tiny );
+
+use B ();
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub _buffer_size {
+    return B::svref_2object(\$_[0])->LEN();
+}
+
+sub T4_size_hint {
+    my $doc = [ ('abc' x 100) x 1000 ];
+
+    my $plain = CBOR::Free::encode($doc);
+
+    for my $hint ( 0, 1, length($plain) - 1, length($plain), length($plain) * 4 ) {
+        is(
+            CBOR::Free::encode($doc, size_hint => $hint),
+            $plain,
+            "size_hint $hint: same output",
+        );
+    }
+
+    is(
+        CBOR::Free::Encoder->new( size_hint => 12345 )->encode($doc),
+        $plain,
+        'encoder object with size_hint: same output',
+    );
+}
+
+sub T2_slack_is_trimmed {
+    my $doc = [ ('x' x 1000) x 1000 ];
+
+    my $cbor = CBOR::Free::encode($doc, size_hint => 100_000_000);
+
+    cmp_ok(
+        _buffer_size($cbor),
+        '<',
+        2 * length($cbor),
+        'overlarge size_hint doesn’t leave excess buffer in the returned string',
+    );
+
+    $cbor = CBOR::Free::encode([ ('x' x 1000) x 3000 ]);
+
+    cmp_ok(
+        _buffer_size($cbor),
+        '<',
+        length($cbor) + length($cbor) / 4,
+        'geometric buffer growth doesn’t leave excess buffer in the returned string',
+    );
+}
+
+sub T1_growth {
+    my @doc = map { 'y' x $_ } 0 .. 3000;
+
+    is_deeply(
+        CBOR::Free::decode( CBOR::Free::encode(\@doc) ),
+        \@doc,
+        'round trip with many buffer expansions',
+    );
+}
+
+1;
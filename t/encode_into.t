@@ -0,0 +1,190 @@
+#!/usr/bin/env perl
+
+package t::encode_into;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T6_append {
+    my $data = { list => [ 1 .. 100 ], str => 'x' x 1000 };
+    my $cbor = CBOR::Free::encode($data, canonical => 1);
+
+    my $buf = 'head';
+
+    my $count = CBOR::Free::encode_into( $buf, $data, canonical => 1 );
+
+    is( $count, length($cbor), 'return is the appended length' );
+    ok( $buf eq "head$cbor", 'appends to the string' );
+
+    CBOR::Free::encode_into( $buf, [] );
+    ok( $buf eq "head$cbor\x80", 'appends again' );
+
+    CBOR::Free::encode_into( my $undef, 5 );
+    ok( $undef eq "\x05", 'undef becomes empty first' );
+
+    my $num = 42;
+    CBOR::Free::encode_into( $num, 1 );
+    ok( $num eq "42\x01", 'number is stringified first' );
+
+    my $big = q<>;
+    CBOR::Free::encode_into( $big, $_ ) for ( $data ) x 100;
+    ok( $big eq CBOR::Free::encode_sequence( [ ($data) x 100 ] ), 'repeated appends grow the string' );
+}
+
+sub T8_length_prefix {
+    my $cbor = CBOR::Free::encode( [ 'abc', 1 ] );
+
+    my %template = ( 1 => 'C', 2 => 'n', 4 => 'N', 8 => 'Q>' );
+
+    for my $width ( 1, 2, 4, 8 ) {
+        my $buf = 'x';
+
+        my $count = CBOR::Free::encode_into( $buf, [ 'abc', 1 ], length_prefix => $width );
+
+        ok( $buf eq 'x' . pack( $template{$width}, length $cbor ) . $cbor, "$width-byte prefix" );
+        is( $count, $width + length($cbor), "$width-byte prefix: return includes the prefix" );
+    }
+
+    my $buf = 'x';
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( $buf, 'y' x 300, length_prefix => 1 ) },
+        qr<303.*1-byte>,
+        'too long for the prefix',
+    );
+
+    is( $buf, 'x', '… leaves the string alone' );
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( $buf, 1, length_prefix => 3 ) },
+        qr<length_prefix>,
+        'invalid width',
+    );
+}
+
+sub T5_errors {
+    my $buf = 'abc';
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( $buf, [ ('x' x 1000) x 10, bless [], 'Weird' ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'encode error',
+    );
+
+    is( $buf, 'abc', '… leaves the string alone' );
+
+    my $wide = "\x{100}";
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( $wide, 1 ) },
+        qr<wide>,
+        'string with wide characters',
+    );
+
+    my $upgraded = "\xe9";
+    utf8::upgrade($upgraded);
+
+    CBOR::Free::encode_into( $upgraded, 1 );
+    ok( $upgraded eq "\xe9\x01" && !utf8::is_utf8($upgraded), 'upgraded string is downgraded first' );
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( 'literal', 1 ) },
+        qr<read-only>,
+        'read-only string',
+    );
+}
+
+# Perl code that runs mid-encode sees the string as undef, and
+# anything it assigns to the string is discarded.
+sub T2_reentrancy {
+    my $buf = 'ab';
+
+    local *Clobber::TO_CBOR = sub {
+        my $was_defined = defined($buf) ? 1 : 0;
+        $buf = 'z' x 1000;
+        return $was_defined;
+    };
+
+    CBOR::Free::encode_into( $buf, [ bless {}, 'Clobber' ], convert_blessed => 1 );
+
+    ok( $buf eq "ab\x81\x00", 'string is detached during the encode' );
+
+    local *Clobber::TO_CBOR = sub { $buf = [1]; 2 };
+
+    CBOR::Free::encode_into( $buf, [ bless {}, 'Clobber' ], convert_blessed => 1 );
+
+    ok( $buf eq "ab\x81\x00\x81\x02", 'reference assignment is discarded' );
+}
+
+# A tied hash’s FETCH dies outside of the encoder’s error handling.
+sub T4_tied_die {
+    tie my %tied, 't::encode_into::DieOnFetch';
+
+    my $buf = 'abc';
+
+    throws_ok(
+        sub { CBOR::Free::encode_into( $buf, [ 'x' x 1000, \%tied ] ) },
+        qr<nope>,
+        'die in a tied hash',
+    );
+
+    is( $buf, 'abc', '… leaves the string alone' );
+
+    my $enc = CBOR::Free::Encoder->new();
+
+    throws_ok(
+        sub { $enc->encode_into( $buf, [ 'x' x 1000, \%tied ] ) },
+        qr<nope>,
+        'encoder: die in a tied hash',
+    );
+
+    $enc->encode_into( $buf, 1 );
+
+    is( $buf, "abc\x01", '… and the encoder still works' );
+}
+
+sub T3_encoder {
+    my $enc = CBOR::Free::Encoder->new( length_prefix => 2, preserve_references => 1 );
+
+    my $shared = [1];
+
+    my $buf = q<>;
+
+    $enc->encode_into( $buf, [ $shared, $shared ] ) for 1 .. 2;
+
+    my $cbor = CBOR::Free::encode( [ $shared, $shared ], preserve_references => 1 );
+
+    ok( $buf eq ( pack( 'n', length $cbor ) . $cbor ) x 2, 'encoder appends with its options' );
+
+    throws_ok(
+        sub { $enc->encode_into( $buf, bless [], 'Weird' ) },
+        'CBOR::Free::X::Unrecognized',
+        'encoder error',
+    );
+
+    $enc->encode_into( $buf, 1 );
+
+    ok( $buf eq ( pack( 'n', length $cbor ) . $cbor ) x 2 . "\0\1\1", 'encoder survives the error' );
+}
+
+#----------------------------------------------------------------------
+
+package t::encode_into::DieOnFetch;
+
+sub TIEHASH { return bless {}, shift }
+sub FETCH { die 'nope' }
+sub FIRSTKEY { 'a' }
+sub NEXTKEY { undef }
+
+1;
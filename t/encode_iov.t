@@ -0,0 +1,215 @@
+#!/usr/bin/env perl
+
+package t::encode_iov;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use Config;
+use File::Temp;
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub _cbor {
+    my ($iov) = @_;
+
+    return join q<>, $iov->segments();
+}
+
+sub T6_segments {
+    my $blob = 'x' x 10_000;
+    my $data = { name => 'abc', file => $blob, list => [ 1, $blob, 'y' x 100 ] };
+
+    my $iov = CBOR::Free::encode_iov( $data, canonical => 1 );
+
+    isa_ok( $iov, 'CBOR::Free::IOV' );
+
+    is(
+        _cbor($iov),
+        CBOR::Free::encode( $data, canonical => 1 ),
+        'segments join to the CBOR',
+    );
+
+    is(
+        ( scalar grep { $_ eq $blob } $iov->segments() ),
+        2,
+        'long strings are segments of their own',
+    );
+
+    $iov = CBOR::Free::encode_iov( $data, canonical => 1, iov_threshold => 100 );
+
+    is(
+        ( scalar grep { length() >= 100 } $iov->segments() ),
+        3,
+        'iov_threshold',
+    );
+
+    $iov = CBOR::Free::encode_iov( [ 1, 'z' x 50 ] );
+    is( scalar( my @segs = $iov->segments() ), 1, 'no long strings: one segment' );
+
+    $iov = CBOR::Free::encode_iov($blob);
+    is( _cbor($iov), CBOR::Free::encode($blob), 'lone long string' );
+}
+
+sub T4_copy_on_write {
+    my $blob = 'x' x 10_000;
+
+    my $iov = CBOR::Free::encode_iov( [ $blob ] );
+
+    SKIP: {
+        require B;
+        skip 'No copy-on-write', 1 if !defined &B::SVf_IsCOW;
+
+        ok(
+            B::svref_2object( \$iov->[1] )->FLAGS & B::SVf_IsCOW(),
+            'segment shares the string’s buffer',
+        );
+    }
+
+    my $cbor = CBOR::Free::encode( [ $blob ] );
+
+    substr( $blob, 0, 1, 'y' );
+    is( _cbor($iov), $cbor, 'later changes to the string don’t matter' );
+
+    undef $blob;
+    is( _cbor($iov), $cbor, 'the string can go away' );
+
+    $iov = CBOR::Free::encode_iov( [ "\x{100}" x 5000 ] );
+    ok( !( grep { utf8::is_utf8($_) } $iov->segments() ), 'segments are bytes' );
+}
+
+sub T12_copied {
+    my $blob = "\xe9" x 10_000;
+
+    for my $mode ( qw( sv encode_text as_text as_binary auto ) ) {
+        for my $str ( $blob, do { utf8::upgrade( my $u = $blob ); $u } ) {
+            my $iov = CBOR::Free::encode_iov( [ $str ], string_encode_mode => $mode );
+
+            is(
+                _cbor($iov),
+                CBOR::Free::encode( [ $str ], string_encode_mode => $mode ),
+                sprintf( '%s, %s string', $mode, utf8::is_utf8($str) ? 'upgraded' : 'downgraded' ),
+            );
+        }
+    }
+
+    my $iov = CBOR::Free::encode_iov( [ $blob, $blob ], stringrefs => 1 );
+
+    is( _cbor($iov), CBOR::Free::encode( [ $blob, $blob ], stringrefs => 1 ), 'stringrefs' );
+
+    require Tie::Hash;
+    tie my %tied, 'Tie::StdHash';
+    %tied = ( a => $blob );
+
+    $iov = CBOR::Free::encode_iov( \%tied );
+    is( scalar( my @segs = $iov->segments() ), 1, 'tied hash: copied' );
+}
+
+sub T3_objects {
+    my $blob = 'x' x 10_000;
+
+    my @data = (
+        CBOR::Free::Raw->new( CBOR::Free::encode($blob) ),
+        CBOR::Free::TypedArray->new( 'uint8', $blob ),
+        CBOR::Free::tag( 24, $blob ),
+    );
+
+    for my $item (@data) {
+        my $iov = CBOR::Free::encode_iov( [ $item ] );
+
+        is( _cbor($iov), CBOR::Free::encode( [ $item ] ), ref $item );
+    }
+}
+
+sub T4_writev {
+    my $blob = 'x' x 100_000;
+    my $data = [ map { ( $_, $blob ) } 1 .. 100 ];
+
+    my $iov = CBOR::Free::encode_iov( $data, iov_threshold => 1000 );
+    my $cbor = CBOR::Free::encode($data);
+
+    my $fh = File::Temp::tempfile();
+
+    print {$fh} 'head';
+
+    is( $iov->writev($fh), length $cbor, 'returns the length written' );
+
+    is( $iov->writev( fileno $fh ), length $cbor, 'file descriptor' );
+
+    sysseek $fh, 0, 0;
+    sysread $fh, my $got, 3 * length $cbor;
+
+    ok( $got eq "head$cbor$cbor", 'writes all of the segments, after Perl’s buffer' );
+
+    throws_ok(
+        sub { $iov->writev(-1) },
+        qr<-1>,
+        'invalid file descriptor',
+    );
+}
+
+# A pipe’s buffer is smaller than this CBOR, so writev() writes
+# only part of it at a time.
+sub T1_partial_writes {
+    SKIP: {
+        skip 'No fork()', 1 if !$Config{'d_fork'};
+
+        my $data = [ map { $_ x 50_000 } 'a' .. 'z' ];
+        my $cbor = CBOR::Free::encode($data);
+
+        pipe my $r, my $w or die "pipe: $!";
+
+        my $pid = fork // die "fork: $!";
+
+        if (!$pid) {
+            close $r;
+            CBOR::Free::encode_iov( $data, iov_threshold => 100 )->writev($w);
+            exit;
+        }
+
+        close $w;
+
+        my $got = do { local $/; <$r> };
+
+        waitpid $pid, 0;
+
+        ok( $got eq $cbor, 'all output arrives' );
+    }
+}
+
+sub T4_errors {
+    throws_ok(
+        sub { CBOR::Free::encode_iov( 1, iov_threshold => 0 ) },
+        qr<iov_threshold>,
+        'invalid iov_threshold',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode_iov( [ 'x' x 10_000, bless [], 'Weird' ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'encode error after a segment',
+    );
+
+    my $enc = CBOR::Free::Encoder->new( iov_threshold => 10 );
+
+    throws_ok(
+        sub { $enc->encode_iov( [ 'x' x 100, bless [], 'Weird' ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'encoder error',
+    );
+
+    my $iov = $enc->encode_iov( [ 'x' x 100, 'y' x 5 ] );
+
+    is( scalar( my @segs = $iov->segments() ), 3, 'encoder survives the error' );
+}
+
+1;
@@ -12,6 +12,7 @@ use Test::Exception;
 use parent qw( Test::Class::Tiny );
 
 use Data::Dumper;
+use Encode ();
 
 use CBOR::Free;
 
@@ -26,9 +27,9 @@ use constant UTF8_0100 => do { utf8::encode( my $v = "\x{100}" ); $v };
 
 __PACKAGE__->runtests() if !caller;
 
-sub T32_test_given_unchanged {
+sub T40_test_given_unchanged {
     for my $canonical ( 0, 1 ) {
-        for my $mode ( qw( sv encode_text as_text as_binary ) ) {
+        for my $mode ( qw( sv encode_text as_text as_binary auto ) ) {
             my $v = UTF8_00FF;
             my $utf8_flag = utf8::is_utf8($v);
             CBOR::Free::encode($v, canonical => $canonical, string_encode_mode => $mode);
@@ -45,6 +46,38 @@ sub T32_test_given_unchanged {
     }
 }
 
+# Each combination of these options has its own encoder.
+sub T60_option_combinations {
+    require CBOR::Free::Decoder;
+    my $decoder = CBOR::Free::Decoder->new();
+    $decoder->preserve_references();
+
+    for my $mode ( qw( sv encode_text as_text as_binary auto ) ) {
+        for my $canonical ( 0, 1 ) {
+            for my $refs ( 0, 1 ) {
+                my $label = "$mode, canonical: $canonical, preserve_references: $refs";
+
+                my $shared = [ 1, 'x' ];
+                my $data = { b => [ 'y', $shared ], a => { k => $shared }, c => 'z' };
+
+                my $cbor = CBOR::Free::encode( $data, string_encode_mode => $mode, canonical => $canonical, preserve_references => $refs );
+
+                my $got = $decoder->decode($cbor);
+
+                is_deeply( $got, $data, "$label: round trip" );
+
+                is( ( $got->{'a'}{'k'} == $got->{'b'}[1] ) ? 1 : 0, $refs, "$label: references" );
+
+                SKIP: {
+                    skip 'Key order is only defined for canonical output.', 1 if !$canonical;
+
+                    like( $cbor, qr<\A\xa3[\x41\x61]a>, "$label: key order" );
+                }
+            }
+        }
+    }
+}
+
 sub T4_test_sv_hash_key {
     my $the_key = (sort keys %!)[0];
 
@@ -205,6 +238,236 @@ sub T24_test_wide_character_errors {
     }
 }
 
+sub _string_head {
+    my ($major, $len) = @_;
+
+    return ($len < 24) ? chr($major + $len)
+        : ($len < 0x100) ? pack('CC', $major + 24, $len)
+        : ($len < 0x10000) ? pack('Cn', $major + 25, $len)
+        : pack('CN', $major + 26, $len);
+}
+
+sub T96_transcoding {
+    my @strings = (
+        q<>,
+        'a' x 40,
+        "\xff",
+        ('x' x 15) . "\xe9" . ('y' x 17),
+
+        # These need shorter heads once downgraded:
+        "\xe9" x 20,
+        "\xe9" x 200,
+
+        ("abc\xe9\xfc\x{7f}\x{80}" x 37) . 'tail',
+        ('z' x 70_000) . "\xe9",
+    );
+
+    my @chunk_sizes = ( 1, 7, 1000 );
+
+    for my $str (@strings) {
+        my $octets = $str;
+        utf8::downgrade($octets);
+
+        my $upgraded = $str;
+        utf8::upgrade($upgraded);
+
+        my $utf8 = $str;
+        utf8::encode($utf8);
+
+        my %expect = (
+            encode_text => _string_head(0x60, length $utf8) . $utf8,
+            as_text => _string_head(0x60, length $octets) . $octets,
+            as_binary => _string_head(0x40, length $octets) . $octets,
+        );
+
+        my $label = sprintf '%d-character string', length $str;
+
+        for my $mode (sort keys %expect) {
+            for my $in ( $octets, $upgraded ) {
+                my $in_label = utf8::is_utf8($in) ? 'upgraded' : 'downgraded';
+
+                my $got = CBOR::Free::encode( $in, string_encode_mode => $mode );
+
+                ok( $got eq $expect{$mode}, "$mode: $label, $in_label" ) or diag explain [ $got, $expect{$mode} ];
+
+                my @mismatch = grep {
+                    my $streamed = q<>;
+                    CBOR::Free::encode_to_cb( sub { $streamed .= $_[0] }, [$in], string_encode_mode => $mode, chunk_size => $_ );
+                    $streamed ne "\x81$expect{$mode}";
+                } @chunk_sizes;
+
+                is( "@mismatch", q<>, "$mode: $label, $in_label (streamed)" );
+            }
+        }
+    }
+
+    for my $mode ( qw( as_text as_binary ) ) {
+        for my $str ( "\x{100}", ('x' x 20) . "\x{100}", ("\xe9" x 20) . "\x{fffd}x" ) {
+            throws_ok(
+                sub { CBOR::Free::encode( $str, string_encode_mode => $mode ) },
+                'CBOR::Free::X::WideCharacter',
+                sprintf( '%s: wide character at %d', $mode, length($str) - 1 ),
+            );
+        }
+    }
+}
+
+# Each string kernel that this CPU supports gets the same tests.
+sub T48_auto {
+    my $initial_kernel = CBOR::Free::_string_kernel();
+
+    for my $kernel ( qw( avx2 sse2 scalar ) ) {
+        SKIP: {
+            skip "No “$kernel” string kernel here.", 16 if !CBOR::Free::_set_string_kernel($kernel);
+
+            _test_auto_strings($kernel);
+            _test_auto_hash_keys($kernel);
+        }
+    }
+
+    CBOR::Free::_set_string_kernel($initial_kernel);
+}
+
+sub _test_auto_strings {
+    my ($kernel) = @_;
+
+    # Vary lengths and offsets so that every part of each kernel
+    # sees some work.
+    my @ascii = map { 'x' x $_ } 0 .. 70, 200, 5000;
+
+    my @mismatch = grep {
+        CBOR::Free::encode( $_, string_encode_mode => 'auto' ) ne _string_head(0x60, length) . $_;
+    } @ascii;
+
+    is( "@mismatch", q<>, "$kernel: all-ASCII octets become text" );
+
+    my @octets;
+    for my $len ( 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 130 ) {
+        for my $pos ( 0 .. $len - 1 ) {
+            my $str = 'x' x $len;
+            substr( $str, $pos, 1, "\x80" );
+            push @octets, $str;
+        }
+    }
+
+    @mismatch = grep {
+        CBOR::Free::encode( $_, string_encode_mode => 'auto' ) ne _string_head(0x40, length) . $_;
+    } @octets;
+
+    is( 0 + @mismatch, 0, "$kernel: non-ASCII octets become binary" );
+
+    my @characters = (
+        q<>,
+        'abc',
+        "\xe9",
+        "\x{100}",
+        ('x' x 40) . "\x{100}" . ('y' x 40),
+        "\x{7ff}\x{800}\x{d7ff}\x{e000}\x{fffd}\x{ffff}\x{10000}\x{10ffff}",
+        ("\x{442}\x{435}\x{43a}\x{441}\x{442} " x 20),
+    );
+
+    @mismatch = grep {
+        utf8::upgrade( my $str = $_ );
+        utf8::encode( my $utf8 = $_ );
+        CBOR::Free::encode( $str, string_encode_mode => 'auto' ) ne _string_head(0x60, length $utf8) . $utf8;
+    } @characters;
+
+    is( 0 + @mismatch, 0, "$kernel: upgraded strings become text" );
+
+    my %invalid = (
+        'surrogate' => "\x{d800}",
+        'beyond U+10FFFF' => "\x{110000}",
+    );
+
+    # Perl won’t create these, so we force them:
+    my %malformed = (
+        'overlong (2 bytes)' => "\xc0\x80",
+        'overlong (3 bytes)' => "\xe0\x80\x80",
+        'overlong (4 bytes)' => "\xf0\x80\x80\x80",
+        'truncated' => "\xe2\x82",
+        'stray continuation' => "\x80",
+        'bad continuation' => "\xe2\x28\xa1",
+        'lead byte 0xf5' => "\xf5\x80\x80\x80",
+    );
+
+    for my $name (sort keys %malformed) {
+        $invalid{$name} = $malformed{$name};
+        Encode::_utf8_on( $invalid{$name} );
+    }
+
+    for my $name (sort keys %invalid) {
+        throws_ok(
+            sub { CBOR::Free::encode( ('x' x 40) . $invalid{$name}, string_encode_mode => 'auto' ) },
+            'CBOR::Free::X::InvalidUTF8',
+            "$kernel: invalid UTF-8 rejected ($name)",
+        );
+    }
+
+    # Now compare against Encode’s strict UTF-8 decoder with assorted
+    # valid & invalid sequences at assorted offsets. (That decoder also
+    # rejects noncharacters, e.g., U+10FFFF, so we avoid those.)
+    my @valid = ( "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\x9f\xbf", "\xee\x80\x80", "\xf4\x8f\xbf\xbd" );
+    my @invalid = ( "\x80", "\xbf", "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xc1\xbf", "\xe0\x9f\xbf", "\xf0\x8f\xbf\xbf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xf8\x88\x80\x80\x80", "\xff" );
+
+    srand(1);
+
+    my @disagreements;
+
+    for ( 1 .. 2000 ) {
+        my $bytes = q<>;
+
+        while ( length($bytes) < 100 ) {
+            $bytes .= ('a' x int rand 40) . $valid[ rand @valid ];
+        }
+
+        substr( $bytes, rand length $bytes, 0, $invalid[ rand @invalid ] ) if rand() < 0.5;
+
+        my $copy = $bytes;
+        my $expect_valid = eval { Encode::decode( 'UTF-8', $copy, Encode::FB_CROAK() ); 1 } ? 1 : 0;
+
+        Encode::_utf8_on( my $str = $bytes );
+        my $got_valid = eval { CBOR::Free::encode( $str, string_encode_mode => 'auto' ); 1 } ? 1 : 0;
+
+        push @disagreements, $bytes if $got_valid != $expect_valid;
+    }
+
+    is( 0 + @disagreements, 0, "$kernel: UTF-8 validation agrees with Encode" ) or diag explain [ map { unpack 'H*', $_ } @disagreements[0 .. 4] ];
+}
+
+sub _test_auto_hash_keys {
+    my ($kernel) = @_;
+
+    my %hash = (
+        abc => 1,
+        "\xff" => 2,
+        "\x{100}" => 3,
+    );
+
+    my %upgraded = ( U_00FF() => 4 );
+
+    for my $canonical ( 0, 1 ) {
+        my $cbor = CBOR::Free::encode( [ \%hash, \%upgraded ], string_encode_mode => 'auto', canonical => $canonical );
+
+        my @found = map { index( $cbor, $_ ) > -1 ? 1 : 0 } (
+            "\x63abc\x01",
+            "\x41\xff\x02",
+            "\x62\xc4\x80\x03",
+            "\xa1\x62\xc3\xbf\x04",
+        );
+
+        is( "@found", '1 1 1 1', "$kernel: hash keys (canonical: $canonical)" );
+    }
+
+    my $bad_key = "\xed\xa0\x80";
+    Encode::_utf8_on($bad_key);
+
+    throws_ok(
+        sub { CBOR::Free::encode( { $bad_key => 1 }, string_encode_mode => 'auto', canonical => 1 ) },
+        'CBOR::Free::X::InvalidUTF8',
+        "$kernel: invalid UTF-8 hash key rejected",
+    );
+}
+
 sub T10_test_as_text__happy_path {
     my @t = (
         [
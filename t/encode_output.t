@@ -0,0 +1,114 @@
+#!/usr/bin/env perl
+
+package t::encode_output;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+
+__PACKAGE__->runtests() if !caller;
+
+sub _create_data_struct {
+    return {
+        short => [ 1 .. 100 ],
+        long => [ map { "$_" x $_ } 1 .. 200 ],
+        huge => ( 'z' x 100_000 ),
+        nested => [ [ [ { a => 1.5, b => undef } ] ] ],
+    };
+}
+
+sub T6_encode_to_cb {
+    my $data = _create_data_struct();
+
+    my $expected = CBOR::Free::encode($data, canonical => 1);
+
+    for my $chunk_size ( 1, 16, 1000, undef ) {
+        my @chunks;
+
+        my $count = CBOR::Free::encode_to_cb(
+            sub { push @chunks, $_[0] },
+            $data,
+            canonical => 1,
+            chunk_size => $chunk_size,
+        );
+
+        my $label = 'chunk_size ' . ($chunk_size // 'default');
+
+        is( join(q<>, @chunks), $expected, "$label: output matches encode()" );
+        is( $count, length($expected), "$label: return is the output length" );
+
+        # Pieces that exceed chunk_size are output on their own,
+        # so only the 100,000-byte string should exceed 1,000 bytes.
+        if ($chunk_size && $chunk_size >= 1000) {
+            my @too_big = grep { length($_) > $chunk_size && length($_) != 100_000 } @chunks;
+
+            is( 0 + @too_big, 0, "$label: chunks don’t exceed chunk_size (except oversized strings)" );
+        }
+    }
+}
+
+sub T3_encode_to_fh {
+    my $data = _create_data_struct();
+
+    open my $fh, '>', \my $buf or die "open: $!";
+
+    my $count = CBOR::Free::encode_to_fh( $fh, $data, canonical => 1, chunk_size => 100 );
+
+    close $fh;
+
+    is( $buf, CBOR::Free::encode($data, canonical => 1), 'output to filehandle matches encode()' );
+    is( $count, length($buf), 'return is the output length' );
+
+    open my $rfh, '<', \my $rbuf or die "open: $!";
+
+    throws_ok(
+        sub { CBOR::Free::encode_to_fh( $rfh, $data ) },
+        qr<writing>,
+        'error on read-only filehandle',
+    );
+}
+
+sub T2_callback_error {
+    throws_ok(
+        sub {
+            CBOR::Free::encode_to_cb(
+                sub { die "oops\n" },
+                [ ('x' x 100) x 10 ],
+                chunk_size => 64,
+            );
+        },
+        qr<oops>,
+        'callback exception propagates',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode_to_cb( 'notcode', [] ) },
+        qr<code>,
+        'non-coderef callback is rejected',
+    );
+}
+
+sub T1_encode_error {
+    my @chunks;
+
+    throws_ok(
+        sub {
+            CBOR::Free::encode_to_cb(
+                sub { push @chunks, $_[0] },
+                [ ('x' x 100) x 10, bless [], 'Weird' ],
+                chunk_size => 64,
+            );
+        },
+        'CBOR::Free::X::Unrecognized',
+        'encode error after partial output',
+    );
+}
+
+1;
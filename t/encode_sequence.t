@@ -0,0 +1,124 @@
+#!/usr/bin/env perl
+
+package t::encode_sequence;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::Encoder;
+use CBOR::Free::SequenceDecoder;
+
+__PACKAGE__->runtests() if !caller;
+
+my @ITEMS = (
+    1,
+    'two',
+    [ 3, { four => 4 } ],
+    undef,
+    { map { ( $_ => "value $_" ) } 1 .. 30 },
+);
+
+sub T4_matches_encode {
+    my @opts_sets = (
+        [],
+        [ canonical => 1 ],
+        [ string_encode_mode => 'encode_text' ],
+    );
+
+    for my $opts_ar (@opts_sets) {
+        my @singles = map { CBOR::Free::encode($_, @$opts_ar) } @ITEMS;
+
+        is(
+            scalar CBOR::Free::encode_sequence(\@ITEMS, @$opts_ar),
+            join( q<>, @singles ),
+            "encode_sequence() (@$opts_ar)",
+        );
+
+        my $encoder = CBOR::Free::Encoder->new(@$opts_ar);
+
+        is(
+            scalar $encoder->encode_sequence(\@ITEMS),
+            join( q<>, @singles ),
+            "Encoder encode_sequence() (@$opts_ar)",
+        );
+    }
+
+    is( scalar CBOR::Free::encode_sequence( [] ), q<>, 'empty list' );
+
+    my @sparse;
+    $sparse[2] = 2;
+
+    is( scalar CBOR::Free::encode_sequence(\@sparse), "\xf6\xf6\x02", 'nonexistent items' );
+}
+
+sub T4_offsets {
+    my ($cbor, $offsets_ar) = CBOR::Free::encode_sequence(\@ITEMS);
+
+    is( 0 + @$offsets_ar, 0 + @ITEMS, 'an offset for each item' );
+
+    my @decoded = map {
+        my $end = ($_ < $#$offsets_ar) ? $offsets_ar->[$_ + 1] : length $cbor;
+        CBOR::Free::decode( substr( $cbor, $offsets_ar->[$_], $end - $offsets_ar->[$_] ) );
+    } 0 .. $#$offsets_ar;
+
+    is_deeply( \@decoded, \@ITEMS, 'each offset starts an item' );
+
+    my ($cbor2, $offsets2_ar) = CBOR::Free::Encoder->new()->encode_sequence(\@ITEMS);
+
+    is_deeply( [ $cbor2, $offsets2_ar ], [ $cbor, $offsets_ar ], 'Encoder: same' );
+
+    my $seq = CBOR::Free::SequenceDecoder->new();
+    my @got;
+    if (my $got_sr = $seq->give($cbor)) {
+        push @got, $$got_sr;
+        while (my $got_sr = $seq->get()) { push @got, $$got_sr }
+    }
+
+    is_deeply( \@got, \@ITEMS, 'SequenceDecoder reads the output' );
+}
+
+sub T2_shared_references {
+    my $shared = [ 1 ];
+
+    my @items = ( [ $shared, $shared ], [ $shared ] );
+
+    is(
+        scalar CBOR::Free::encode_sequence( \@items, preserve_references => 1 ),
+        join( q<>, map { CBOR::Free::encode( $_, preserve_references => 1 ) } @items ),
+        'references are shared within, not across, items',
+    );
+}
+
+sub T3_errors {
+    throws_ok(
+        sub { CBOR::Free::encode_sequence( { a => 1 } ) },
+        qr<array reference>,
+        'non-array',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode_sequence( [ 1, \*STDOUT ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'unrecognized item',
+    );
+
+    my $encoder = CBOR::Free::Encoder->new();
+
+    throws_ok(
+        sub { $encoder->encode_sequence( [ 1, \*STDOUT ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'Encoder: unrecognized item',
+    );
+
+    is( scalar $encoder->encode_sequence( [ 1, 2 ] ), "\x01\x02", 'Encoder: reusable after error' );
+}
+
+1;
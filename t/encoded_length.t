@@ -0,0 +1,111 @@
+#!/usr/bin/env perl
+
+package t::encoded_length;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+my @MODES = qw( sv encode_text as_text as_binary auto );
+
+sub _data {
+    my $upgraded = "caf\xe9" x 1000;
+    utf8::upgrade($upgraded);
+
+    require Tie::Hash;
+    tie my %tied, 'Tie::StdHash';
+    %tied = ( list => [ 1 .. 100 ], blob => 'x' x 1000 );
+
+    return (
+        scalar => 1,
+        short => 'abc',
+        long => 'y' x 100_000,
+        latin1 => "caf\xe9" x 1000,
+        upgraded => $upgraded,
+        structure => { map { ( "key$_" => [ $_, "s$_", -$_ / 3, undef ] ) } 1 .. 500 },
+        repeats => [ ( 'repeated string' x 20 ) x 10 ],
+        tied => \%tied,
+        typed_array => CBOR::Free::TypedArray->new( 'uint16be', pack 'S*', 1 .. 5000 ),
+        raw => CBOR::Free::Raw->new( CBOR::Free::encode( [ 1 .. 100 ] ) ),
+    );
+}
+
+sub T1_matches_encode {
+    my %data = _data();
+
+    my @mismatches;
+
+    for my $name ( sort keys %data ) {
+        for my $mode (@MODES) {
+            for my $opts ( [], [ canonical => 1 ], [ stringrefs => 1 ], [ indefinite_magic => 1 ] ) {
+                my @opts = ( string_encode_mode => $mode, @$opts );
+
+                my $cbor = CBOR::Free::encode( $data{$name}, @opts );
+                my $length = CBOR::Free::encoded_length( $data{$name}, @opts );
+
+                push @mismatches, "$name: @opts ($length, not ${\ length $cbor })" if $length != length $cbor;
+            }
+        }
+    }
+
+    is_deeply( \@mismatches, [], 'same length as encode() gives' ) or diag explain \@mismatches;
+}
+
+sub T3_errors {
+    throws_ok(
+        sub { CBOR::Free::encoded_length( [ 'x' x 10_000, bless [], 'Weird' ] ) },
+        'CBOR::Free::X::Unrecognized',
+        'unrecognized value',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encoded_length( [ 'x' x 10_000, "\x{100}" ], string_encode_mode => 'as_binary' ) },
+        'CBOR::Free::X::WideCharacter',
+        'wide character',
+    );
+
+    my $deep = [];
+    $deep = [$deep] for 1 .. 10;
+
+    throws_ok(
+        sub { CBOR::Free::encoded_length( $deep, max_depth => 5 ) },
+        'CBOR::Free::X::Recursion',
+        'max_depth',
+    );
+}
+
+sub T3_encoder {
+    my $enc = CBOR::Free::Encoder->new( canonical => 1, stringrefs => 1 );
+
+    my %data = _data();
+
+    is(
+        $enc->encoded_length( $data{'structure'} ),
+        length $enc->encode( $data{'structure'} ),
+        'encoder uses its options',
+    );
+
+    throws_ok(
+        sub { $enc->encoded_length( bless [], 'Weird' ) },
+        'CBOR::Free::X::Unrecognized',
+        'encoder error',
+    );
+
+    is(
+        $enc->encoded_length( $data{'repeats'} ),
+        length $enc->encode( $data{'repeats'} ),
+        'encoder survives the error',
+    );
+}
+
+1;
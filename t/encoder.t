@@ -0,0 +1,162 @@
+#!/usr/bin/env perl
+
+package t::encoder;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T1_create_and_destroy {
+    CBOR::Free::Encoder->new();
+
+    ok 1;
+}
+
+sub T4_matches_encode {
+    my @opts_sets = (
+        [],
+        [ canonical => 1 ],
+        [ string_encode_mode => 'encode_text' ],
+        [ preserve_references => 1, scalar_references => 1 ],
+    );
+
+    my $shared = [ 1, 2 ];
+    my $str = 'hello';
+
+    for my $opts_ar (@opts_sets) {
+        my %opts = @$opts_ar;
+
+        my $data = {
+            a => $shared,
+            b => $shared,
+            d => "\x{100}é",
+            e => [ 1.5, -4, undef ],
+            ( $opts{'scalar_references'} ? ( c => \$str ) : () ),
+        };
+
+        my $encoder = CBOR::Free::Encoder->new(@$opts_ar);
+
+        is(
+            $encoder->encode($data),
+            CBOR::Free::encode($data, @$opts_ar),
+            "encode() matches (@$opts_ar)",
+        );
+    }
+}
+
+sub T3_reuse_across_sizes {
+    my $encoder = CBOR::Free::Encoder->new();
+
+    my @docs = (
+        [ 1 .. 10 ],
+        [ ('x' x 100) x 100 ],
+        [ 1 .. 10 ],
+        'abc',
+        { map { $_ => [ $_ ] } 1 .. 500 },
+    );
+
+    for my $round (1, 2) {
+        for my $doc (@docs) {
+            is_deeply(
+                CBOR::Free::decode( $encoder->encode($doc) ),
+                $doc,
+                "round trip (round $round)",
+            );
+        }
+    }
+}
+
+sub T2_survives_errors {
+    my $encoder = CBOR::Free::Encoder->new();
+
+    throws_ok(
+        sub { $encoder->encode( bless [], 'Weird' ) },
+        'CBOR::Free::X::Unrecognized',
+        'error on unrecognized object',
+    );
+
+    is( $encoder->encode([1]), "\x81\x01", 'encoder still works after error' );
+}
+
+# A tied hash’s FETCH dies outside of the encoder’s error handling,
+# which leaves the encoder to clean up when it next encodes.
+sub T4_survives_uncaught_die {
+    my $encoder = CBOR::Free::Encoder->new( preserve_references => 1, canonical => 1 );
+
+    tie my %tied, 't::encoder::DieOnFetch';
+
+    my $shared = [1];
+
+    throws_ok(
+        sub { $encoder->encode( { a => { b => [ $shared, \%tied ] } } ) },
+        qr<nope>,
+        'die in a tied hash',
+    );
+
+    my $expected = CBOR::Free::encode( [ $shared, $shared ], preserve_references => 1 );
+
+    is( $encoder->encode( [ $shared, $shared ] ), $expected, 'encode() afterward' );
+
+    throws_ok(
+        sub { $encoder->encode_iov( [ 'x' x 10_000, \%tied ] ) },
+        qr<nope>,
+        'die in a tied hash, encode_iov()',
+    );
+
+    is( $encoder->encode( [ $shared, $shared ] ), $expected, '… and encode() afterward' );
+}
+
+# Perl code that runs mid-encode (e.g., a TO_CBOR method) mustn’t
+# reenter the encoder that’s running it.
+sub T5_reentrancy {
+    my $encoder = CBOR::Free::Encoder->new( convert_blessed => 1 );
+
+    no warnings 'once';
+
+    local *Reenter::TO_CBOR = sub { $encoder->encode( [ 1 .. 100 ] ) };
+
+    for my $method ( qw( encode encoded_length encode_iov encode_sequence ) ) {
+        throws_ok(
+            sub { $encoder->$method( [ bless {}, 'Reenter' ] ) },
+            qr<busy>,
+            "$method()",
+        );
+    }
+
+    is( $encoder->encode( [1] ), "\x81\x01", 'encoder still works' );
+
+    local *Reenter::TO_CBOR = sub { undef $encoder; 5 };
+
+    my $cbor = $encoder->encode( [ bless( {}, 'Reenter' ), 'x' x 1000 ] );
+
+    is( $cbor, CBOR::Free::encode( [ 5, 'x' x 1000 ] ), 'encoder can go away mid-encode' );
+}
+
+sub T1_invalid_mode {
+    throws_ok(
+        sub { CBOR::Free::Encoder->new( string_encode_mode => 'bogus' ) },
+        qr<bogus>,
+        'invalid string_encode_mode is rejected at construction',
+    );
+}
+
+#----------------------------------------------------------------------
+
+package t::encoder::DieOnFetch;
+
+sub TIEHASH { return bless {}, shift }
+sub FETCH { die 'nope' }
+sub FIRSTKEY { 'a' }
+sub NEXTKEY { undef }
+
+1;
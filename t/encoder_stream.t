@@ -0,0 +1,226 @@
+#!/usr/bin/env perl
+
+package t::encoder_stream;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::Encoder::Stream;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T6_array {
+    my @rows = map { { id => $_, name => "row $_", tags => [ 1 .. $_ ] } } 1 .. 20;
+
+    my $stream = CBOR::Free::Encoder::Stream->new( canonical => 1 );
+
+    $stream->begin_array();
+
+    my $cbor = q<>;
+
+    for my $row (@rows) {
+        $stream->add($row);
+        $cbor .= $stream->take_bytes();
+    }
+
+    $stream->end();
+    $cbor .= $stream->take_bytes();
+
+    is(
+        $cbor,
+        "\x9f" . join( q<>, map { CBOR::Free::encode($_, canonical => 1) } @rows ) . "\xff",
+        'array: expected CBOR',
+    );
+
+    is_deeply( CBOR::Free::decode($cbor), \@rows, 'array: round-trip' );
+
+    is( $stream->take_bytes(), q<>, 'take_bytes() when there’s nothing to take' );
+}
+
+sub T5_nested {
+    my $stream = CBOR::Free::Encoder::Stream->new();
+
+    $stream->begin_map();
+    $stream->add_pair( name => 'things' );
+    $stream->begin_array('items');
+    $stream->add($_) for 1 .. 3;
+    $stream->begin_map();
+    $stream->add_pair( 5 => [] );
+    is( $stream->depth(), 3, 'depth()' );
+    $stream->end();
+    $stream->end();
+    $stream->end();
+
+    is( $stream->depth(), 0, 'depth() after end()' );
+
+    my $cbor = $stream->take_bytes();
+
+    is(
+        $cbor,
+        join(
+            q<>,
+            "\xbf",
+            "\x44name", "\x46things",
+            "\x45items", "\x9f", "\x01\x02\x03",
+            "\xbf", "\x05\x80", "\xff",
+            "\xff",
+            "\xff",
+        ),
+        'nested: expected CBOR',
+    );
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        { name => 'things', items => [ 1, 2, 3, { 5 => [] } ] },
+        'nested: round-trip',
+    );
+}
+
+sub T4_sequence {
+    my $stream = CBOR::Free::Encoder::Stream->new();
+
+    $stream->add($_) for ( 1, 'two', [3] );
+
+    is(
+        $stream->take_bytes(),
+        join( q<>, map { CBOR::Free::encode($_) } ( 1, 'two', [3] ) ),
+        'top-level additions make a CBOR sequence',
+    );
+}
+
+sub T3_misuse {
+    my $stream = CBOR::Free::Encoder::Stream->new();
+
+    throws_ok( sub { $stream->end() }, qr<open>, 'end() with nothing open' );
+    throws_ok( sub { $stream->add_pair( a => 1 ) }, qr<key>, 'add_pair() outside a map' );
+
+    $stream->begin_array();
+    throws_ok( sub { $stream->begin_map('a') }, qr<key>, 'begin_map() with a key in an array' );
+
+    $stream->begin_map();
+    throws_ok( sub { $stream->add(1) }, qr<key>, 'add() in a map' );
+    throws_ok( sub { $stream->begin_array() }, qr<key>, 'begin_array() without a key in a map' );
+
+    $stream->end();
+    $stream->end();
+
+    is( $stream->take_bytes(), "\x9f\xbf\xff\xff", 'misuse doesn’t affect output' );
+
+    my $shallow = CBOR::Free::Encoder::Stream->new( max_depth => 2 );
+    $shallow->begin_array() for 1 .. 2;
+
+    throws_ok(
+        sub { $shallow->begin_array() },
+        'CBOR::Free::X::Recursion',
+        'max_depth limits open containers',
+    );
+
+    is( $shallow->depth(), 2, '… and the failure doesn’t open anything' );
+}
+
+sub T2_failed_addition {
+    my $stream = CBOR::Free::Encoder::Stream->new( canonical => 1 );
+
+    $stream->begin_map();
+    $stream->add_pair( a => { x => 1, y => 2 } );
+
+    throws_ok(
+        sub { $stream->add_pair( b => { x => [ 1, 2, \*STDOUT ], y => 2 } ) },
+        'CBOR::Free::X::Unrecognized',
+        'unrecognized value',
+    );
+
+    # Once for the shape cache to see it, again to use it:
+    $stream->add_pair( c => { x => [9], y => 2 } ) for 1 .. 2;
+
+    my $tied_stream = CBOR::Free::Encoder::Stream->new();
+    $tied_stream->begin_array();
+    $tied_stream->add(1);
+
+    tie my %tied, 't::encoder_stream::DieOnFetch';
+    throws_ok(
+        sub { $tied_stream->add( [ 2, \%tied ] ) },
+        qr<nope>,
+        'die in a tied hash',
+    );
+
+    $tied_stream->end();
+
+    $stream->end();
+
+    is_deeply(
+        CBOR::Free::decode( $stream->take_bytes() ),
+        { a => { x => 1, y => 2 }, c => { x => [9], y => 2 } },
+        'failed addition leaves no trace',
+    );
+
+    is( $tied_stream->take_bytes(), "\x9f\x01\xff", '… even when it dies outside the encoder' );
+}
+
+sub T3_reentrancy {
+    my $stream = CBOR::Free::Encoder::Stream->new( convert_blessed => 1 );
+    $stream->begin_array();
+
+    no warnings 'once';
+
+    local *Reenter::TO_CBOR = sub { $stream->add(2); 3 };
+
+    throws_ok(
+        sub { $stream->add( [ bless {}, 'Reenter' ] ) },
+        qr<busy>,
+        'add() from TO_CBOR',
+    );
+
+    local *Reenter::TO_CBOR = sub { $stream->take_bytes(); 3 };
+
+    throws_ok(
+        sub { $stream->add( bless {}, 'Reenter' ) },
+        qr<busy>,
+        'take_bytes() from TO_CBOR',
+    );
+
+    $stream->add(1);
+    $stream->end();
+
+    is( $stream->take_bytes(), "\x9f\x01\xff", 'stream still works' );
+}
+
+sub T1_shared_references {
+    my $stream = CBOR::Free::Encoder::Stream->new( preserve_references => 1 );
+
+    my $shared1 = [1];
+    my $shared2 = [2];
+
+    $stream->begin_array();
+    $stream->add( [ $shared1, $shared1 ] );
+    $stream->add( [ $shared2, $shared2 ] );
+    $stream->end();
+
+    my $dec = CBOR::Free::Decoder->new();
+    $dec->preserve_references();
+
+    my $got = $dec->decode( $stream->take_bytes() );
+
+    is_deeply( $got, [ [ [1], [1] ], [ [2], [2] ] ], 'shared references: round-trip' );
+    is( $got->[0][0], $got->[0][1], 'first addition’s references are shared' );
+    is( $got->[1][0], $got->[1][1], 'second addition’s references are shared' );
+}
+
+#----------------------------------------------------------------------
+
+package t::encoder_stream::DieOnFetch;
+
+sub TIEHASH { return bless {}, shift }
+sub FETCH { die 'nope' }
+sub FIRSTKEY { 'a' }
+sub NEXTKEY { undef }
+
+1;
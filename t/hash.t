@@ -46,6 +46,38 @@ sub T1_many_keys {
     is_deeply( $rt, \%hash, '%Config-sized hash round trips' );
 }
 
+sub T4_traversal {
+    my %hash = map { ( $_ => $_ ) } 1 .. 100;
+
+    my ($first) = each %hash;
+    CBOR::Free::encode(\%hash);
+    my ($second) = each %hash;
+
+    isnt( $second, $first, 'encode() leaves the hash’s iterator alone' );
+
+    delete @hash{ grep { $_ % 3 } keys %hash };
+
+    is_deeply( CBOR::Free::decode( CBOR::Free::encode(\%hash) ), \%hash, 'hash with deleted keys' );
+
+    require Hash::Util;
+
+    my %restricted = ( a => 1, b => 2, c => 3 );
+    Hash::Util::lock_ref_keys(\%restricted);
+    delete $restricted{'b'};
+
+    _cmpbin(
+        CBOR::Free::encode(\%restricted, canonical => 1),
+        "\xa2\x41a\x01\x41c\x03",
+        'restricted hash with a deleted key (canonical)',
+    );
+
+    is_deeply(
+        CBOR::Free::decode( CBOR::Free::encode(\%restricted) ),
+        { a => 1, c => 3 },
+        'restricted hash with a deleted key',
+    );
+}
+
 #----------------------------------------------------------------------
 
 sub T6_canonical {
@@ -87,6 +119,175 @@ sub T6_canonical {
     }
 }
 
+sub T2_canonical_many_keys {
+    my @keys = (
+        ( map { 'prefix-shared-' . int rand 1_000_000 } 1 .. 1500 ),
+        ( map { "\x{100}" . int rand 1000 } 1 .. 300 ),
+        ( map { chr(200 + $_) } 1 .. 50 ),
+        ( map { "\0" x $_ } 1 .. 40 ),
+    );
+
+    my %hash = map { ( $_ => 0 ) } @keys;
+
+    # Canonical order: binary before text, then shorter before longer,
+    # then bytewise.
+    my @sorted = sort {
+        utf8::is_utf8($a) <=> utf8::is_utf8($b)
+        || do {
+            my ($ea, $eb) = ($a, $b);
+            utf8::is_utf8($_) && utf8::encode($_) for ($ea, $eb);
+            length($ea) <=> length($eb) || $ea cmp $eb;
+        }
+    } keys %hash;
+
+    my $expected = "\xb9" . pack('n', 0 + @sorted) . join( q<>, map { CBOR::Free::encode($_) . "\0" } @sorted );
+
+    _cmpbin(
+        CBOR::Free::encode(\%hash, canonical => 1),
+        $expected,
+        'canonical encoding of a hash with many keys',
+    );
+}
+
+sub T1_canonical_nested {
+    my %inner = map { ( "inner$_" => [ $_ ] ) } reverse 1 .. 100;
+    my %outer = map { ( "outer$_" => { %inner } ) } reverse 1 .. 50;
+
+    my $cbor = CBOR::Free::encode(\%outer, canonical => 1);
+
+    is_deeply( CBOR::Free::decode($cbor), \%outer, 'nested canonical hashes round-trip' );
+}
+
+sub T5_canonical_repeated_shapes {
+    my $upgraded = 'b';
+    utf8::upgrade($upgraded);
+
+    my $downgraded = "\xe9";
+
+    my @records = (
+        ( map { { id => $_, name => "n$_", zz => [$_], a => undef } } 1 .. 20 ),
+        ( map { { id => $_, name => "n$_", zz => [$_], b => undef } } 1 .. 5 ),
+        ( map { { id => $_, "\x{100}" => $_, $upgraded => 1, $downgraded => 2 } } 1 .. 5 ),
+        ( map { { id => $_, "\x{100}" => $_, b => 1, $downgraded => 2 } } 1 .. 5 ),
+        ( map { { id => $_, nested => { id => $_, name => 'x', zz => [], a => 1 } } } 1 .. 5 ),
+    );
+
+    # Each record alone is encoded without any shape to reuse:
+    my @singles = map { CBOR::Free::encode($_, canonical => 1) } @records;
+
+    my $expected = "\x98" . chr(0 + @records) . join(q<>, @singles);
+
+    _cmpbin(
+        CBOR::Free::encode(\@records, canonical => 1),
+        $expected,
+        'canonical encoding of repeated key sets',
+    );
+
+    require CBOR::Free::Encoder;
+    my $enc = CBOR::Free::Encoder->new( canonical => 1 );
+
+    my @mismatch = grep { $enc->encode($records[$_]) ne $singles[$_] } 0 .. $#records, reverse 0 .. $#records;
+    is( "@mismatch", q<>, 'persistent encoder: repeated key sets across encodes' );
+
+    # The octet modes reject wide characters.
+    my @narrow = grep { !exists $_->{"\x{100}"} } @records;
+
+    for my $mode ( qw( encode_text as_text as_binary ) ) {
+        my @in = ($mode eq 'encode_text') ? @records : @narrow;
+
+        my $got = CBOR::Free::encode(\@in, canonical => 1, string_encode_mode => $mode);
+        my $want = "\x98" . chr(0 + @in) . join(q<>, map { CBOR::Free::encode($_, canonical => 1, string_encode_mode => $mode) } @in);
+
+        _cmpbin( $got, $want, "repeated key sets ($mode)" );
+    }
+}
+
+sub T2_changed_by_to_cbor {
+    my %hash;
+    $hash{$_} = t::hash::Clearer->new(\%hash) for 1 .. 20;
+
+    throws_ok(
+        sub { CBOR::Free::encode( \%hash, convert_blessed => 1 ) },
+        qr<lost entries>,
+        'TO_CBOR empties the hash that contains it',
+    );
+}
+
+sub T4_canonical_changed_by_to_cbor {
+    my $long_key = 'k' x 40;
+
+    my $make = sub {
+        my %hash = ( b => 'x' x 40, $long_key => [2], c => {} );
+        $hash{'a'} = t::hash::Clearer->new(\%hash);
+        return \%hash;
+    };
+
+    my $expected = CBOR::Free::encode(
+        { a => 'cleared', b => 'x' x 40, $long_key => [2], c => {} },
+        canonical => 1,
+    );
+
+    my $hash = $make->();
+
+    _cmpbin(
+        CBOR::Free::encode( $hash, canonical => 1, convert_blessed => 1 ),
+        $expected,
+        'canonical: TO_CBOR empties the hash that contains it',
+    );
+
+    is_deeply( $hash, {}, '… and the hash is indeed empty' );
+
+    # The second hash has the first one’s shape.
+    _cmpbin(
+        CBOR::Free::encode( [ $make->(), $make->() ], canonical => 1, convert_blessed => 1 ),
+        "\x82$expected$expected",
+        '… and again with a repeated key set',
+    );
+}
+
+sub T4_repeated_converted_keys {
+    my $upgraded = 'b';
+    utf8::upgrade($upgraded);
+
+    my $downgraded = "\xe9";
+
+    my @records = (
+        ( map { { id => $_, name => "n$_", $downgraded => 1 } } 1 .. 30 ),
+        ( map { { id => $_, "\x{100}" => $_, $upgraded => 1, "$upgraded$upgraded" => 2 } } 1 .. 5 ),
+    );
+
+    my @narrow = grep { !exists $_->{"\x{100}"} } @records;
+
+    require CBOR::Free::Encoder;
+
+    for my $mode ( qw( sv encode_text as_text as_binary ) ) {
+        my @in = ($mode =~ m<^as_>) ? @narrow : @records;
+
+        my @singles = map { CBOR::Free::encode($_, string_encode_mode => $mode) } @in;
+
+        _cmpbin(
+            CBOR::Free::encode(\@in, string_encode_mode => $mode),
+            "\x98" . chr(0 + @in) . join(q<>, @singles),
+            "repeated keys ($mode)",
+        );
+
+        my $enc = CBOR::Free::Encoder->new( string_encode_mode => $mode );
+
+        my @mismatch = grep { $enc->encode($in[$_]) ne $singles[$_] } 0 .. $#in;
+        is( "@mismatch", q<>, "persistent encoder: repeated keys across encodes ($mode)" );
+
+        # Perl frees each of these keys before it creates the next, so
+        # a new key may well reuse an old one’s memory.
+        @mismatch = grep {
+            my $key = "k$_";
+            utf8::upgrade($key);
+            $enc->encode( { $key => 1 } ) ne CBOR::Free::encode( { $key => 1 }, string_encode_mode => $mode );
+        } 1 .. 1000;
+
+        is( "@mismatch", q<>, "persistent encoder: many transient keys ($mode)" );
+    }
+}
+
 #----------------------------------------------------------------------
 
 sub T2_text_key {
@@ -175,3 +376,21 @@ sub _cmpbin {
 
     return is( $got, $expect, $label );
 }
+
+#----------------------------------------------------------------------
+
+package t::hash::Clearer;
+
+sub new {
+    my ($class, $hash) = @_;
+
+    return bless [$hash], $class;
+}
+
+sub TO_CBOR {
+    my ($self) = @_;
+
+    %{ $self->[0] } = ();
+
+    return 'cleared';
+}
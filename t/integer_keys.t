@@ -0,0 +1,125 @@
+#!/usr/bin/env perl
+
+package t::integer_keys;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+
+use parent qw( Test::Class::Tiny );
+
+use Config;
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T4_encode {
+    is(
+        CBOR::Free::encode( { 5 => 1 }, integer_keys => 1 ),
+        "\xa1\x05\x01",
+        'small integer',
+    );
+
+    is(
+        CBOR::Free::encode( { -300 => 1 }, integer_keys => 1 ),
+        "\xa1\x39\x01\x2b\x01",
+        'negative integer',
+    );
+
+    my @strings = ( '01', '-0', '+1', '1.0', ' 1', '-', q<>, '1e3', "1\x{100}" );
+
+    my $cbor = CBOR::Free::encode( { map { $_ => 1 } @strings }, integer_keys => 1, string_encode_mode => 'encode_text' );
+
+    is_deeply(
+        [ sort keys %{ CBOR::Free::decode($cbor) } ],
+        [ sort @strings ],
+        'non-canonical numbers stay strings',
+    );
+
+    like(
+        $cbor,
+        qr<\A\xa9(?:\x61.\x01|\x62..\x01|\x60\x01|\x63...\x01|\x63.\x{c4}\x{80}\x01)+\z>s,
+        '… as text strings',
+    );
+}
+
+sub T4_limits {
+    SKIP: {
+        skip 'Needs 64-bit integers', 4 if $Config{'uvsize'} < 8;
+
+        my %hash = (
+            '18446744073709551615' => 1,
+            '18446744073709551616' => 2,
+            '-9223372036854775808' => 3,
+            '-9223372036854775809' => 4,
+        );
+
+        my $cbor = CBOR::Free::encode( \%hash, integer_keys => 1, canonical => 1 );
+
+        is(
+            substr( $cbor, 0, 21 ),
+            "\xa4\e\xff\xff\xff\xff\xff\xff\xff\xff\x01;\x7f\xff\xff\xff\xff\xff\xff\xff\x03",
+            'largest integers are integers',
+        );
+
+        like( $cbor, qr<\x54-9223372036854775809>, 'too small: string' );
+        like( $cbor, qr<\x5418446744073709551616>, 'too large: string' );
+
+        is_deeply( CBOR::Free::decode($cbor), \%hash, 'round trip' );
+    }
+}
+
+# Canonical CBOR sorts the encoded keys bytewise, which puts unsigned
+# integers first, then negative integers, then strings. Within a type
+# shorter encodings come first.
+sub T3_canonical {
+    my %hash = map { $_ => 0 } ( 0, 23, 24, 255, 256, 65536, -1, -24, -25, 'a', 'bb', '007' );
+
+    my $cbor = CBOR::Free::encode( \%hash, integer_keys => 1, canonical => 1 );
+
+    my @keys = (
+        "\x00", "\x17", "\x18\x18", "\x18\xff", "\x19\x01\x00", "\x1a\x00\x01\x00\x00",
+        "\x20", "\x37", "\x38\x18",
+        "\x41a", "\x42bb", "\x43007",
+    );
+
+    is( $cbor, "\xac" . join( q<>, map { "$_\x00" } @keys ), 'sort order' );
+
+    my $enc = CBOR::Free::Encoder->new( integer_keys => 1, canonical => 1 );
+
+    # Encode enough times to exercise the key-order cache.
+    my @cbors = map { $enc->encode( \%hash ) } 1 .. 4;
+
+    is_deeply( \@cbors, [ ($cbor) x 4 ], 'encoder, repeatedly' );
+
+    my $refs = CBOR::Free::encode( [ \%hash, \%hash ], integer_keys => 1, canonical => 1, stringrefs => 1 );
+
+    is_deeply(
+        CBOR::Free::decode($refs),
+        [ \%hash, \%hash ],
+        'stringrefs',
+    );
+}
+
+sub T2_decode_keys {
+    my @nums = ( 0 .. 200, map { ( 10**$_ - 1, 10**$_ ) } 3 .. 15 );
+    push @nums, map { -$_ } @nums;
+
+    push @nums, ( ~0, -( ~0 >> 1 ) - 1 );
+
+    my %hash = map { $_ => 1 } @nums;
+
+    my $decoded = CBOR::Free::decode( CBOR::Free::encode( \%hash, integer_keys => 1 ) );
+
+    is_deeply( $decoded, \%hash, 'round trip' );
+
+    my $uncanonical = CBOR::Free::decode( "\xa1\x1b\x00\x00\x00\x00\x00\x00\x00\x07\x01" );
+
+    is_deeply( $uncanonical, { 7 => 1 }, 'overlong integer' );
+}
+
+1;
@@ -0,0 +1,109 @@
+#!/usr/bin/env perl
+
+package t::max_depth;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub _nest_arrays {
+    my ($depth) = @_;
+
+    my $d = 1;
+    $d = [$d] for 1 .. $depth;
+
+    return $d;
+}
+
+sub T3_default_limit {
+    my $max = CBOR::Free::_MAX_RECURSION();
+
+    is(
+        CBOR::Free::encode( _nest_arrays($max) ),
+        ("\x81" x $max) . "\x01",
+        "default: $max levels of nesting are OK",
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( _nest_arrays(1 + $max) ) },
+        'CBOR::Free::X::Recursion',
+        'default: one more level fails',
+    );
+
+    like( $@->get_message(), qr<$max>, '… and the error gives the limit' );
+}
+
+sub T4_custom_limit {
+    my $deep = _nest_arrays(20_000);
+
+    is(
+        CBOR::Free::encode( $deep, max_depth => 20_000 ),
+        ("\x81" x 20_000) . "\x01",
+        'very deep nesting with a high max_depth',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( _nest_arrays(6), max_depth => 5 ) },
+        'CBOR::Free::X::Recursion',
+        'low max_depth',
+    );
+
+    like( $@->get_message(), qr<5>, '… and the error gives the limit' );
+
+    my $enc = CBOR::Free::Encoder->new( max_depth => 5 );
+
+    dies_ok( sub { $enc->encode( _nest_arrays(6) ) }, 'encoder object: too deep' );
+
+    is( $enc->encode( _nest_arrays(5) ), ("\x81" x 5) . "\x01", '… and it still works afterward' );
+}
+
+sub T2_deep_mixed {
+    my $depth = 5_000;
+
+    my $d = 'x';
+    my $expected = "\x41x";
+
+    for my $i (1 .. $depth) {
+        if ($i % 3 == 0) {
+            $d = { b => $d, a => 1 };
+            $expected = "\xa2\x41a\x01\x41b$expected";
+        }
+        elsif ($i % 3 == 1) {
+            $d = [ 0, $d ];
+            $expected = "\x82\x00$expected";
+        }
+        else {
+            # tag() aliases its argument, so give it a fresh one.
+            my $inner = $d;
+            $d = CBOR::Free::tag( 1, $inner );
+            $expected = "\xc1$expected";
+        }
+    }
+
+    is(
+        CBOR::Free::encode( $d, canonical => 1, max_depth => $depth ),
+        $expected,
+        'deeply nested arrays, maps, and tags (canonical)',
+    );
+}
+
+sub T1_sparse_array {
+    my @sparse;
+    $#sparse = 2;
+
+    is(
+        CBOR::Free::encode( \@sparse ),
+        "\x83\xf6\xf6\xf6",
+        'nonexistent array elements are encoded as null',
+    );
+}
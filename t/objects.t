@@ -0,0 +1,246 @@
+#!/usr/bin/env perl
+
+package t::objects;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::Encoder;
+use CBOR::Free::SequenceDecoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T4_not_enabled {
+    my $obj = t::objects::Point->new( 1, 2 );
+
+    throws_ok(
+        sub { CBOR::Free::encode($obj) },
+        'CBOR::Free::X::Unrecognized',
+        'objects are rejected by default',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( $obj, freeze_objects => 1 ) },
+        'CBOR::Free::X::Unrecognized',
+        'freeze_objects ignores TO_CBOR',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( bless( {}, 't::objects::Plain' ), convert_blessed => 1, freeze_objects => 1 ) },
+        'CBOR::Free::X::Unrecognized',
+        'class with neither method',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( t::objects::Frozen->new('x'), convert_blessed => 1 ) },
+        'CBOR::Free::X::Unrecognized',
+        'convert_blessed ignores FREEZE',
+    );
+}
+
+sub T5_to_cbor {
+    my @points = map { t::objects::Point->new( $_, -$_ ) } 1 .. 3;
+
+    is(
+        CBOR::Free::encode( [ @points, 'z' ], convert_blessed => 1 ),
+        CBOR::Free::encode( [ [ 1, -1 ], [ 2, -2 ], [ 3, -3 ], 'z' ] ),
+        'TO_CBOR returns replace objects',
+    );
+
+    my $nested = t::objects::Wrapper->new( t::objects::Wrapper->new( $points[0] ) );
+
+    is(
+        CBOR::Free::encode( { a => $nested }, convert_blessed => 1 ),
+        CBOR::Free::encode( { a => { wrapped => { wrapped => [ 1, -1 ] } } } ),
+        'TO_CBOR may return objects',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( t::objects::Selfish->new(), convert_blessed => 1, max_depth => 10 ) },
+        'CBOR::Free::X::Recursion',
+        'TO_CBOR that returns its object hits max_depth',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( [ 1, t::objects::Dies->new() ], convert_blessed => 1 ) },
+        qr<TO_CBOR died>,
+        'TO_CBOR’s exception propagates',
+    );
+
+    my $encoder = CBOR::Free::Encoder->new( convert_blessed => 1 );
+
+    is(
+        $encoder->encode( \@points ),
+        CBOR::Free::encode( [ [ 1, -1 ], [ 2, -2 ], [ 3, -3 ] ] ),
+        'CBOR::Free::Encoder',
+    );
+}
+
+sub T5_freeze_thaw {
+    my $frozen = t::objects::Frozen->new( 'abc', 5 );
+
+    my $cbor = CBOR::Free::encode( [ $frozen, $frozen ], freeze_objects => 1 );
+
+    my $tagged = "\xd8\x1a" . CBOR::Free::encode( [ 't::objects::Frozen', 'abc', 5 ] );
+
+    ok( $cbor eq "\x82$tagged$tagged", 'FREEZE: tag 26 with class name & FREEZE returns' );
+
+    my $decoder = CBOR::Free::Decoder->new();
+    ok( $decoder->thaw_objects(), 'thaw_objects() returns true when enabled' );
+
+    my $got = $decoder->decode($cbor);
+
+    is_deeply(
+        $got,
+        [ t::objects::Frozen->new( 'abc', 5 ), t::objects::Frozen->new( 'abc', 5 ) ],
+        'THAW recreates objects',
+    );
+
+    my $seqdecoder = CBOR::Free::SequenceDecoder->new();
+    $seqdecoder->thaw_objects(1);
+
+    is_deeply(
+        ${ $seqdecoder->give($cbor) },
+        $got,
+        'CBOR::Free::SequenceDecoder',
+    );
+
+    is(
+        CBOR::Free::encode( [ t::objects::Point->new( 1, 2 ), $frozen ], convert_blessed => 1, freeze_objects => 1 ),
+        CBOR::Free::encode( [ [ 1, 2 ] ] ) =~ s<\A\x81><\x82>r . $tagged,
+        'both enabled',
+    );
+}
+
+sub T5_thaw_errors {
+    my $decoder = CBOR::Free::Decoder->new();
+    $decoder->thaw_objects(1);
+
+    throws_ok(
+        sub { $decoder->decode( "\xd8\x1a" . CBOR::Free::encode( ['t::objects::Plain'] ) ) },
+        qr<t::objects::Plain.*THAW>,
+        'class without THAW',
+    );
+
+    throws_ok(
+        sub { $decoder->decode( "\xd8\x1a" . CBOR::Free::encode( ['t::objects::Nonexistent'] ) ) },
+        qr<t::objects::Nonexistent.*THAW>,
+        'nonexistent class',
+    );
+
+    throws_ok(
+        sub { $decoder->decode( "\xd8\x1a\x80" ) },
+        qr<26>,
+        'empty array',
+    );
+
+    ok( !$decoder->thaw_objects(0), 'thaw_objects(0)' );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    $decoder->decode( "\xd8\x1a" . CBOR::Free::encode( ['t::objects::Plain'] ) );
+
+    is( 0 + @warnings, 1, 'tag 26 without thaw_objects()' );
+}
+
+sub T2_to_cbor_frees_parent {
+    my $outer = { list => [ 1 .. 10 ] };
+    unshift @{ $outer->{'list'} }, t::objects::Runner->new( sub { %$outer = () } );
+
+    is_deeply(
+        CBOR::Free::decode( CBOR::Free::encode( $outer, convert_blessed => 1 ) ),
+        { list => [ 'ran', 1 .. 10 ] },
+        'TO_CBOR frees the array that contains it',
+    );
+
+    my $outer_ar = [ { map { ( $_ => $_ ) } 1 .. 10 } ];
+    $outer_ar->[0]{'a'} = t::objects::Runner->new( sub { @$outer_ar = () } );
+
+    is_deeply(
+        CBOR::Free::decode( CBOR::Free::encode( $outer_ar, convert_blessed => 1 ) ),
+        [ { a => 'ran', map { ( $_ => $_ ) } 1 .. 10 } ],
+        'TO_CBOR frees the hash that contains it',
+    );
+}
+
+sub T3_method_cache {
+    my $obj = t::objects::Changing->new();
+
+    my $encoder = CBOR::Free::Encoder->new( convert_blessed => 1 );
+
+    is( $encoder->encode($obj), CBOR::Free::encode('first'), 'first method' );
+
+    no warnings 'redefine';
+    local *t::objects::Changing::TO_CBOR = sub { 'second' };
+
+    is( $encoder->encode($obj), CBOR::Free::encode('second'), 'redefined method' );
+
+    local @t::objects::Child::ISA = ('t::objects::Changing');
+
+    is( $encoder->encode( bless {}, 't::objects::Child' ), CBOR::Free::encode('second'), 'inherited method (after @ISA change)' );
+}
+
+#----------------------------------------------------------------------
+
+package t::objects::Point;
+
+sub new { my ($class, @xy) = @_; bless [@xy], $class }
+sub TO_CBOR { [ @{ $_[0] } ] }
+
+package t::objects::Wrapper;
+
+sub new { bless { wrapped => $_[1] }, $_[0] }
+sub TO_CBOR { return { wrapped => $_[0]{'wrapped'} } }
+
+package t::objects::Selfish;
+
+sub new { bless {}, shift }
+sub TO_CBOR { $_[0] }
+
+package t::objects::Runner;
+
+sub new { bless [ $_[1] ], $_[0] }
+sub TO_CBOR { $_[0][0]->(); 'ran' }
+
+package t::objects::Dies;
+
+sub new { bless {}, shift }
+sub TO_CBOR { die 'TO_CBOR died' }
+
+package t::objects::Frozen;
+
+sub new { my ($class, @values) = @_; bless { values => \@values }, $class }
+
+sub FREEZE {
+    my ($self, $serialiser) = @_;
+    die "bad serialiser: $serialiser" if $serialiser ne 'CBOR';
+
+    return @{ $self->{'values'} };
+}
+
+sub THAW {
+    my ($class, $serialiser, @values) = @_;
+    die "bad serialiser: $serialiser" if $serialiser ne 'CBOR';
+
+    return $class->new(@values);
+}
+
+package t::objects::Plain;
+
+package t::objects::Changing;
+
+sub new { bless {}, shift }
+sub TO_CBOR { 'first' }
+
+package t::objects::Child;
+
+1;
@@ -0,0 +1,109 @@
+#!/usr/bin/env perl
+
+package t::raw;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::SequenceDecoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub T5_encode {
+    my $profile = { name => 'Bob', roles => [ 'admin', 'user' ] };
+    my $profile_cbor = CBOR::Free::encode($profile, canonical => 1);
+
+    my $raw = CBOR::Free::Raw->new($profile_cbor);
+
+    is(
+        CBOR::Free::encode( [ 1, $raw, $raw ] ),
+        CBOR::Free::encode( [ 1, $profile, $profile ], canonical => 1 ),
+        'raw CBOR is spliced in',
+    );
+
+    my $embedded = CBOR::Free::Raw->new($profile_cbor, 1);
+
+    is(
+        CBOR::Free::encode( [ $embedded ] ),
+        "\x81\xd8\x18" . CBOR::Free::encode($profile_cbor),
+        'embedded raw CBOR is in tag 24',
+    );
+
+    ok( !$raw->embedded(), 'embedded() - false' );
+    ok( $embedded->embedded(), 'embedded() - true' );
+    is( $raw->bytes(), $profile_cbor, 'bytes()' );
+    is_deeply( $raw->decode(), $profile, 'decode()' );
+}
+
+sub T3_new_errors {
+    throws_ok( sub { CBOR::Free::Raw->new(q<>) }, qr<empty>, 'empty' );
+    throws_ok( sub { CBOR::Free::Raw->new("\x{100}") }, qr<Wide character>, 'wide character' );
+
+    my $upgraded = "\x41\xe9";
+    utf8::upgrade($upgraded);
+
+    is(
+        CBOR::Free::encode( CBOR::Free::Raw->new($upgraded) ),
+        "\x41\xe9",
+        'upgraded string is output as bytes',
+    );
+}
+
+sub T4_lazy_decode {
+    my $inner = CBOR::Free::encode( { a => [ 1, 2 ] } );
+    my $cbor = CBOR::Free::encode( [ CBOR::Free::Raw->new($inner, 1), 'x' ] );
+
+    my $decoder = CBOR::Free::Decoder->new();
+    ok( $decoder->lazy_embedded_cbor(), 'lazy_embedded_cbor() returns true when enabled' );
+
+    my $got = $decoder->decode($cbor);
+
+    isa_ok( $got->[0], 'CBOR::Free::Raw', 'decoded tag 24' );
+    is( $got->[0]->bytes(), $inner, '… with the expected CBOR' );
+    ok( $got->[0]->embedded(), '… which is embedded' );
+
+    is( CBOR::Free::encode($got), $cbor, 're-encoding gives the original CBOR' );
+
+    ok( !$decoder->lazy_embedded_cbor(0), 'lazy_embedded_cbor(0)' );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    is_deeply( $decoder->decode($cbor), [ $inner, 'x' ], 'tag 24 without lazy_embedded_cbor()' );
+    is( 0 + @warnings, 1, '… warns about the tag' );
+}
+
+sub T2_lazy_decode_non_bytes {
+    my $decoder = CBOR::Free::Decoder->new();
+    $decoder->lazy_embedded_cbor();
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    is( $decoder->decode("\xd8\x18\x01"), 1, 'tag 24 on a non-byte-string is decoded as usual' );
+    is( 0 + @warnings, 1, '… with a warning' );
+}
+
+sub T2_sequence_decoder {
+    my $inner = CBOR::Free::encode( [ 1 .. 10 ] );
+    my $cbor = CBOR::Free::encode( CBOR::Free::Raw->new($inner, 1) );
+
+    my $decoder = CBOR::Free::SequenceDecoder->new();
+    $decoder->lazy_embedded_cbor();
+
+    is( $decoder->give( substr( $cbor, 0, 6 ) ), undef, 'incomplete' );
+
+    my $got_sr = $decoder->give( substr( $cbor, 6 ) );
+
+    is( $$got_sr->bytes(), $inner, 'completed' );
+}
+
+1;
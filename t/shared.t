@@ -45,6 +45,27 @@ sub T1_against_cbor_xs {
     }
 }
 
+sub T3_many_shared {
+    my @nodes = map { [ $_ ] } 1 .. 5000;
+
+    my $cbor = CBOR::Free::encode(
+        [ @nodes, reverse @nodes ],
+        preserve_references => 1,
+    );
+
+    my $dec = CBOR::Free::Decoder->new();
+    $dec->preserve_references();
+
+    my $rt = $dec->decode($cbor);
+
+    is( 0 + @$rt, 10_000, 'many shared nodes: all items decoded' );
+
+    my @mismatches = grep { $rt->[$_] != $rt->[ $#$rt - $_ ] } 0 .. 4999;
+    is( 0 + @mismatches, 0, 'many shared nodes: each node’s 2 references are the same' );
+
+    is_deeply( $rt->[4999], [5000], 'many shared nodes: content is right' );
+}
+
 sub _create_data_struct {
     my $plain_array = [];
     my $plain_hash = {};
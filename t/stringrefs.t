@@ -0,0 +1,195 @@
+#!/usr/bin/env perl
+
+package t::stringrefs;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::Encoder;
+use CBOR::Free::Encoder::Stream;
+use CBOR::Free::SequenceDecoder;
+
+my $NAMESPACE = "\xd9\x01\x00";
+
+__PACKAGE__->runtests() if !caller;
+
+sub _stringref {
+    my ($index) = @_;
+
+    return "\xd8\x19" . CBOR::Free::encode($index);
+}
+
+# From the stringref specification (http://cbor.schmorp.de/stringref).
+# Index 24 needs 4 bytes, so “rrr” is never indexed, but “ssss” is.
+sub T2_specification_example {
+    my @items = ( 1, 222, 333, 4, 555, 666, 777, 888, 999, map( { $_ x 3 } 'a' .. 'r' ), 333, 'ssss', 'qqq', 'rrr', 'ssss' );
+    $_ = "$_" for @items;
+
+    my $cbor = CBOR::Free::encode( \@items, stringrefs => 1 );
+
+    my $expected = $NAMESPACE . "\x98\x20" . join(
+        q<>,
+        ( map { CBOR::Free::encode($_) } @items[ 0 .. 26 ] ),
+        _stringref(1),
+        CBOR::Free::encode('ssss'),
+        _stringref(23),
+        CBOR::Free::encode('rrr'),
+        _stringref(24),
+    );
+
+    ok( $cbor eq $expected, 'expected CBOR' ) or diag explain [ unpack( 'H*', $cbor ), unpack( 'H*', $expected ) ];
+
+    is_deeply( CBOR::Free::decode($cbor), \@items, 'round-trip' );
+}
+
+sub T8_round_trip {
+    my @hosts = map { "host$_.example.com" } 1 .. 5;
+
+    my $data = {
+        hosts => \@hosts,
+        records => [
+            map {
+                {
+                    host => $hosts[ $_ % @hosts ],
+                    url => "https://example.com/$hosts[ $_ % @hosts ]",
+                    "key$_" => 'x' x 300,
+                    $hosts[ $_ % @hosts ] => $_,
+                }
+            } 1 .. 100
+        ],
+    };
+
+    for my $opts_ar ( [], [ canonical => 1 ], [ string_encode_mode => 'encode_text' ], [ string_encode_mode => 'auto' ] ) {
+        my $cbor = CBOR::Free::encode( $data, stringrefs => 1, @$opts_ar );
+
+        my $plain = CBOR::Free::encode( $data, @$opts_ar );
+
+        cmp_ok( length($cbor), '<', length($plain) / 5, "@$opts_ar: smaller" );
+
+        is_deeply( CBOR::Free::decode($cbor), $data, "@$opts_ar: round-trip" );
+    }
+}
+
+sub T2_string_types {
+    my $text = 'abc';
+    utf8::upgrade($text);
+
+    is(
+        CBOR::Free::encode( [ 'abc', $text, 'abc', $text ], stringrefs => 1 ),
+        "$NAMESPACE\x84\x43abc\x63abc" . _stringref(0) . _stringref(1),
+        'binary & text strings are distinct',
+    );
+
+    is(
+        CBOR::Free::encode( [ 'ab', 'ab' ], stringrefs => 1 ),
+        "$NAMESPACE\x82\x42ab\x42ab",
+        'short strings are never indexed',
+    );
+}
+
+sub T4_output {
+    my $data = [ map { { "key$_" => 'y' x $_, long => 'z' x 1000 } } 1 .. 200 ];
+
+    my $expect = CBOR::Free::encode( $data, stringrefs => 1, canonical => 1 );
+
+    for my $chunk_size ( 1, 100, 100_000 ) {
+        my $cbor = q<>;
+
+        CBOR::Free::encode_to_cb( sub { $cbor .= $_[0] }, $data, stringrefs => 1, canonical => 1, chunk_size => $chunk_size );
+
+        ok( $cbor eq $expect, "encode_to_cb(), chunk size $chunk_size" );
+    }
+
+    my $encoder = CBOR::Free::Encoder->new( stringrefs => 1, canonical => 1 );
+    $encoder->encode( [ 'foo', 'bar' ] );
+
+    ok( $encoder->encode($data) eq $expect, 'CBOR::Free::Encoder: each encode is a new namespace' );
+}
+
+sub T3_sequence {
+    my @items = ( [ 'abc', 'abc' ], 'abc', { abc => 'abc' } );
+
+    my ( $cbor, $offsets_ar ) = CBOR::Free::encode_sequence( \@items, stringrefs => 1 );
+
+    is(
+        $cbor,
+        join( q<>, map { CBOR::Free::encode( $_, stringrefs => 1 ) } @items ),
+        'encode_sequence(): each item is a namespace',
+    );
+
+    is_deeply( $offsets_ar, [ 0, 11, 18 ], '… with the expected offsets' );
+
+    my $seqdecoder = CBOR::Free::SequenceDecoder->new();
+
+    is_deeply(
+        [ map { ${ $seqdecoder->give( substr( $cbor, $offsets_ar->[$_], ( $offsets_ar->[ $_ + 1 ] // length $cbor ) - $offsets_ar->[$_] ) ) } } 0 .. $#items ],
+        \@items,
+        'CBOR::Free::SequenceDecoder',
+    );
+}
+
+sub T2_raw {
+    my $raw_cbor = CBOR::Free::encode( [ 'abcd', 'abcd' ], stringrefs => 1 );
+
+    my $cbor = CBOR::Free::encode( [ 'abcd', CBOR::Free::Raw->new($raw_cbor), CBOR::Free::Raw->new( CBOR::Free::encode('abcd'), 1 ), 'abcd' ], stringrefs => 1 );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        [ 'abcd', [ 'abcd', 'abcd' ], CBOR::Free::encode('abcd'), 'abcd' ],
+        'raw CBOR gets its own namespace',
+    );
+
+    is( 0 + @warnings, 1, '… (and tag 24 prompts a warning)' );
+}
+
+sub T6_decode {
+    my $key = 'key';
+    my $value = 'value';
+
+    is_deeply(
+        CBOR::Free::decode( "$NAMESPACE\x83\xa1\x43$key\x45$value" . "\xa1" . _stringref(0) . _stringref(1) . "$NAMESPACE\x82\x43$key" . _stringref(0) ),
+        [ { key => 'value' }, { key => 'value' }, [ 'key', 'key' ] ],
+        'stringref map keys & nested namespaces',
+    );
+
+    my $long = 'x' x 1000;
+    utf8::upgrade( my $text = "$long\x{100}" );
+
+    my $got = CBOR::Free::decode( CBOR::Free::encode( [ $long, $text, $long, $text ], stringrefs => 1 ) );
+
+    is_deeply( $got, [ $long, $text, $long, $text ], 'long strings' );
+    ok( utf8::is_utf8( $got->[3] ), '… text stays text' );
+
+    throws_ok(
+        sub { CBOR::Free::decode( "$NAMESPACE\x82\x43abc" . _stringref(1) ) },
+        qr<stringref>,
+        'missing stringref',
+    );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    is( CBOR::Free::decode( _stringref(0) ), 0, 'stringref outside a namespace' );
+    is( 0 + @warnings, 1, '… prompts a warning' );
+}
+
+sub T1_stream {
+    throws_ok(
+        sub { CBOR::Free::Encoder::Stream->new( stringrefs => 1 ) },
+        qr<stringrefs>,
+        'CBOR::Free::Encoder::Stream rejects stringrefs',
+    );
+}
+
+1;
@@ -0,0 +1,239 @@
+#!/usr/bin/env perl
+
+package t::tied;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Encoder;
+
+__PACKAGE__->runtests() if !caller;
+
+sub _head {
+    my ($major, $len) = @_;
+
+    return ($len < 24) ? chr($major + $len)
+        : ($len < 0x100) ? pack('CC', $major + 24, $len)
+        : ($len < 0x10000) ? pack('Cn', $major + 25, $len)
+        : pack('CN', $major + 26, $len);
+}
+
+sub _tied_hash {
+    my ($plain_hr) = @_;
+
+    tie my %tied, 't::tied::CountingHash', $plain_hr;
+
+    return \%tied;
+}
+
+sub T12_single_pass {
+
+    # These cover each size of length header.
+    for my $count ( 0, 5, 23, 24, 300, 70_000 ) {
+        my %plain = map { ( "key$_" => $_ ) } 1 .. $count;
+
+        my $tied = _tied_hash( \%plain );
+
+        my $cbor = CBOR::Free::encode($tied);
+
+        my $body = join q<>, map { CBOR::Free::encode($_) . CBOR::Free::encode( $plain{$_} ) } sort keys %plain;
+
+        ok( $cbor eq _head(0xa0, $count) . $body, "$count keys: expected CBOR" );
+
+        is( tied(%$tied)->{'iterations'}, 1, "$count keys: one iteration" );
+    }
+}
+
+sub T4_nested {
+    my %inner = map { ( "inner$_" => [ 1 .. $_ ] ) } 1 .. 30;
+    my $inner = _tied_hash( \%inner );
+
+    my %outer = (
+        a => $inner,
+        b => 'x' x 300,
+        c => _tied_hash( { map { ( $_ => $_ ) } 1 .. 3 } ),
+    );
+    my $outer = _tied_hash( \%outer );
+
+    for my $canonical ( 0, 1 ) {
+        my $iterations = tied(%$inner)->{'iterations'};
+
+        my $cbor = CBOR::Free::encode( [ $outer, 1 ], canonical => $canonical );
+
+        is_deeply(
+            CBOR::Free::decode($cbor),
+            [ { a => \%inner, b => 'x' x 300, c => { 1 => 1, 2 => 2, 3 => 3 } }, 1 ],
+            "nested tied hashes (canonical: $canonical)",
+        );
+
+        is( tied(%$inner)->{'iterations'} - $iterations, 1, "… inner hash iterated once (canonical: $canonical)" );
+    }
+}
+
+sub T4_canonical {
+
+    # Enough keys to outgrow the initial sort space, with nested
+    # maps that need sort space of their own:
+    my %plain = map { ( "key$_" => { x => $_, y => [$_], zz => 1 } ) } 1 .. 100;
+
+    my $tied = _tied_hash( \%plain );
+
+    is(
+        CBOR::Free::encode( $tied, canonical => 1 ),
+        CBOR::Free::encode( \%plain, canonical => 1 ),
+        'canonical: same as an untied hash',
+    );
+
+    is( tied(%$tied)->{'iterations'}, 1, 'canonical: one iteration' );
+
+    # This used to yield an empty map since the encoder resumed
+    # the previous encode’s (unfinished) iteration.
+    is(
+        CBOR::Free::encode( $tied, canonical => 1 ),
+        CBOR::Free::encode( \%plain, canonical => 1 ),
+        'canonical: same again',
+    );
+
+    is(
+        CBOR::Free::encode( _tied_hash( {} ), canonical => 1 ),
+        "\xa0",
+        'canonical: empty',
+    );
+}
+
+sub T3_streamed_output {
+    my %plain = map { ( "key$_" => 'x' x $_ ) } 1 .. 300;
+
+    my $data = [ 'a' x 100, _tied_hash( \%plain ), 'b' x 100 ];
+
+    my $expect = CBOR::Free::encode($data);
+
+    for my $chunk_size ( 1, 100, 100_000 ) {
+        my $cbor = q<>;
+
+        CBOR::Free::encode_to_cb( sub { $cbor .= $_[0] }, $data, chunk_size => $chunk_size );
+
+        ok( $cbor eq $expect, "encode_to_cb(), chunk size $chunk_size" );
+    }
+}
+
+sub T6_indefinite_magic {
+    my %plain = map { ( "key$_" => $_ ) } 1 .. 30;
+
+    tie my @array, 't::tied::Array', [ 1 .. 30 ];
+
+    my $data = [ _tied_hash( \%plain ), \@array, { a => 1 }, [2] ];
+
+    my $cbor = CBOR::Free::encode( $data, indefinite_magic => 1 );
+
+    my $hash_body = join q<>, map { CBOR::Free::encode($_) . CBOR::Free::encode( $plain{$_} ) } sort keys %plain;
+    my $array_body = join q<>, map { CBOR::Free::encode($_) } 1 .. 30;
+
+    ok(
+        $cbor eq "\x84\xbf$hash_body\xff\x9f$array_body\xff\xa1\x41a\x01\x81\x02",
+        'indefinite_magic: expected CBOR',
+    );
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        [ \%plain, [ 1 .. 30 ], { a => 1 }, [2] ],
+        'indefinite_magic: round-trip',
+    );
+
+    tie my @empty, 't::tied::Array', [];
+
+    is(
+        CBOR::Free::encode( [ _tied_hash( {} ), \@empty ], indefinite_magic => 1 ),
+        "\x82\xbf\xff\x9f\xff",
+        'indefinite_magic: empty',
+    );
+
+    is(
+        CBOR::Free::encode( $data, indefinite_magic => 1, canonical => 1 ),
+        CBOR::Free::encode( [ \%plain, [ 1 .. 30 ], { a => 1 }, [2] ], canonical => 1 ),
+        'indefinite_magic: canonical ignores',
+    );
+
+    my $cbor_out = q<>;
+    CBOR::Free::encode_to_cb( sub { $cbor_out .= $_[0] }, $data, indefinite_magic => 1, chunk_size => 7 );
+
+    ok( $cbor_out eq $cbor, 'indefinite_magic: encode_to_cb()' );
+
+    ok(
+        CBOR::Free::Encoder->new( indefinite_magic => 1 )->encode($data) eq $cbor,
+        'indefinite_magic: CBOR::Free::Encoder',
+    );
+}
+
+sub T2_failure {
+    my $encoder = CBOR::Free::Encoder->new();
+
+    tie my %tied, 't::tied::DieOnFetch';
+
+    throws_ok(
+        sub { $encoder->encode( [ 1, \%tied ] ) },
+        qr<nope>,
+        'die in a tied hash',
+    );
+
+    my %plain = map { ( "key$_" => $_ ) } 1 .. 30;
+
+    is(
+        $encoder->encode( _tied_hash( \%plain ) ),
+        CBOR::Free::encode( _tied_hash( \%plain ) ),
+        '… and the encoder still works',
+    );
+}
+
+#----------------------------------------------------------------------
+
+package t::tied::CountingHash;
+
+# Iterates in sorted order and counts iterations.
+
+sub TIEHASH {
+    my ($class, $plain_hr) = @_;
+
+    return bless { data => $plain_hr, iterations => 0 }, $class;
+}
+
+sub FETCH { $_[0]{'data'}{ $_[1] } }
+
+sub FIRSTKEY {
+    my ($self) = @_;
+
+    $self->{'iterations'}++;
+    $self->{'keys'} = [ sort keys %{ $self->{'data'} } ];
+
+    return shift @{ $self->{'keys'} };
+}
+
+sub NEXTKEY { shift @{ $_[0]{'keys'} } }
+
+sub SCALAR { scalar %{ $_[0]{'data'} } }
+
+#----------------------------------------------------------------------
+
+package t::tied::Array;
+
+sub TIEARRAY { bless { data => $_[1] }, $_[0] }
+sub FETCH { $_[0]{'data'}[ $_[1] ] }
+sub FETCHSIZE { scalar @{ $_[0]{'data'} } }
+
+#----------------------------------------------------------------------
+
+package t::tied::DieOnFetch;
+
+sub TIEHASH { return bless {}, shift }
+sub FETCH { die 'nope' }
+sub FIRSTKEY { 'a' }
+sub NEXTKEY { undef }
+
+1;
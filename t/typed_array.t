@@ -0,0 +1,255 @@
+#!/usr/bin/env perl
+
+package t::typed_array;
+
+use strict;
+use warnings;
+
+use Test::More;
+use Test::FailWarnings;
+use Test::Exception;
+
+use parent qw( Test::Class::Tiny );
+
+use CBOR::Free;
+use CBOR::Free::Decoder;
+use CBOR::Free::SequenceDecoder;
+
+my $IS_LE = pack('S', 1) eq pack('v', 1);
+
+__PACKAGE__->runtests() if !caller;
+
+# Reverses each $width-byte piece of $bytes.
+sub _swap {
+    my ($bytes, $width) = @_;
+
+    return join q<>, map { scalar reverse } unpack "(a$width)*", $bytes;
+}
+
+sub _tagged {
+    my ($tag, $bytes) = @_;
+
+    return "\xd8" . chr($tag) . CBOR::Free::encode($bytes);
+}
+
+sub T9_encode {
+    my @floats = ( 1.5, -2, 1e300, 0 );
+
+    my $packed = pack 'd*', @floats;
+    my $be = pack 'd>*', @floats;
+    my $le = pack 'd<*', @floats;
+
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'float64be', $packed ) ) eq _tagged( 82, $be ), 'float64be' );
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'float64le', $packed ) ) eq _tagged( 86, $le ), 'float64le' );
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'float64', $packed ) ) eq _tagged( $IS_LE ? 86 : 82, $packed ), 'float64 (native)' );
+
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'int16be', pack 's*', -3 .. 3 ) ) eq _tagged( 73, pack 's>*', -3 .. 3 ), 'int16be' );
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'uint32le', pack 'L*', 1 .. 9 ) ) eq _tagged( 70, pack 'L<*', 1 .. 9 ), 'uint32le' );
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'uint8_clamped', "\x00\xff" ) ) eq _tagged( 68, "\x00\xff" ), 'uint8_clamped' );
+    ok( CBOR::Free::encode( CBOR::Free::TypedArray->new( 'int8', q<> ) ) eq _tagged( 72, q<> ), 'empty int8' );
+
+    is(
+        CBOR::Free::encode( [ CBOR::Free::TypedArray->new( 'float32be', pack 'f', 1 ) ], canonical => 1 ),
+        "\x81" . _tagged( 81, pack 'f>', 1 ),
+        'canonical',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::encode( bless [ 'float64', 'abc', 82 ], 'CBOR::Free::TypedArray' ) },
+        'CBOR::Free::X::Unrecognized',
+        'malformed instance',
+    );
+}
+
+# Each byte-swap kernel that this CPU supports gets the same tests.
+# The odd lengths test the kernels’ handling of leftover elements.
+sub T15_byteswap_kernels {
+    my $initial_kernel = CBOR::Free::_byteswap_kernel();
+
+    my $bytes = join q<>, map { chr( $_ % 251 ) } 1 .. 16 * 1001;
+
+    for my $kernel ( qw( avx2 ssse3 scalar ) ) {
+        SKIP: {
+            skip "No “$kernel” byte-swap kernel here.", 5 if !CBOR::Free::_set_byteswap_kernel($kernel);
+
+            for my $width ( 2, 4, 8, 16 ) {
+                my $type = "float" . ( 8 * $width ) . ( $IS_LE ? 'be' : 'le' );
+                my $tag = { 2 => 80, 4 => 81, 8 => 82, 16 => 83 }->{$width} + ( $IS_LE ? 0 : 4 );
+
+                my $packed = substr( $bytes, 0, $width * ( 200 + $width ) + 7 * $width );
+
+                my $cbor = CBOR::Free::encode( CBOR::Free::TypedArray->new( $type, $packed ) );
+
+                ok( $cbor eq _tagged( $tag, _swap( $packed, $width ) ), "$kernel: $width-byte elements" );
+            }
+
+            my $decoder = CBOR::Free::Decoder->new();
+            $decoder->typed_arrays_as_packed();
+
+            my $be = pack 'L>*', 1 .. 1001;
+
+            ok( $decoder->decode( _tagged( 66, $be ) ) eq pack( 'L*', 1 .. 1001 ), "$kernel: decode" );
+        }
+    }
+
+    CBOR::Free::_set_byteswap_kernel($initial_kernel);
+}
+
+sub T11_decode {
+    my @ints = ( -1000, 0, 12345, -70000 );
+
+    my %cbor = (
+        int32be => _tagged( 74, pack 'l>*', @ints ),
+        int32le => _tagged( 78, pack 'l<*', @ints ),
+        float16be => _tagged( 80, pack 'n*', 0x3c00, 0xc000, 0x7c00 ),
+        uint8 => _tagged( 64, "\x01\x02\xff" ),
+    );
+
+    my $decoder = CBOR::Free::Decoder->new();
+
+    is( $decoder->typed_arrays_as_arrays(), $decoder, 'typed_arrays_as_arrays() returns the object' );
+
+    is_deeply( $decoder->decode( $cbor{'int32be'} ), \@ints, 'arrays: int32be' );
+    is_deeply( $decoder->decode( $cbor{'int32le'} ), \@ints, 'arrays: int32le' );
+    is_deeply( $decoder->decode( $cbor{'float16be'} ), [ 1, -2, 9**9**9 ], 'arrays: float16be' );
+    is_deeply( $decoder->decode( $cbor{'uint8'} ), [ 1, 2, 255 ], 'arrays: uint8' );
+
+    $decoder->typed_arrays_as_packed();
+
+    ok( $decoder->decode( $cbor{'int32be'} ) eq pack( 'l*', @ints ), 'packed: int32be' );
+    ok( $decoder->decode( $cbor{'int32le'} ) eq pack( 'l*', @ints ), 'packed: int32le' );
+
+    $decoder->typed_arrays_as_objects();
+
+    my $obj = $decoder->decode( $cbor{'int32be'} );
+
+    is_deeply(
+        [ ref($obj), $obj->type(), $obj->count(), [ $obj->values() ] ],
+        [ 'CBOR::Free::TypedArray', 'int32be', 4, \@ints ],
+        'objects: int32be',
+    );
+
+    ok( CBOR::Free::encode($obj) eq $cbor{'int32be'}, '… round-trips' );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    $decoder->typed_arrays_as_tags();
+
+    ok( $decoder->decode( $cbor{'uint8'} ) eq "\x01\x02\xff", 'tags: byte string' );
+    is( 0 + @warnings, 1, '… with a warning' );
+}
+
+sub T6_decode_edge_cases {
+    my $decoder = CBOR::Free::Decoder->new();
+    $decoder->typed_arrays_as_arrays();
+
+    throws_ok(
+        sub { $decoder->decode( _tagged( 82, 'x' x 12 ) ) },
+        qr<82.*12.*8>,
+        'length isn’t a multiple of the element size',
+    );
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    ok( $decoder->decode( _tagged( 83, 'x' x 16 ) ) eq 'x' x 16, 'arrays: float128 stays a tag' );
+    is( 0 + @warnings, 1, '… with a warning' );
+
+    is_deeply( $decoder->decode( "\xd8\x46\x80" ), [], 'non-byte-string value stays a tag' );
+
+    $decoder->typed_arrays_as_packed();
+
+    ok(
+        $decoder->decode( "\xd8\x41\x5f\x42\x00\x01\x42\x00\x02\xff" ) eq pack( 'S*', 1, 2 ),
+        'indefinite-length byte string',
+    );
+
+    $decoder->string_decode_always();
+
+    ok( $decoder->decode( _tagged( 64, "\xff" ) ) eq "\xff", 'string_decode_always() doesn’t apply' );
+}
+
+sub T6_stringrefs {
+    my $be = CBOR::Free::TypedArray->new( 'uint16be', pack 'S*', 1 .. 100 );
+    my $long = 'x' x 300;
+
+    my $cbor = CBOR::Free::encode( [ $be, $be, $long, $be, $long ], stringrefs => 1 );
+
+    cmp_ok( length($cbor), '<', 600, 'repeated typed arrays become stringrefs' );
+
+    my $decoder = CBOR::Free::Decoder->new();
+
+    for my $mode ( qw( arrays packed objects ) ) {
+        my $setter = "typed_arrays_as_$mode";
+        $decoder->$setter();
+
+        my $got = $decoder->decode($cbor);
+
+        my $expect = ( $mode eq 'arrays' ) ? [ 1 .. 100 ] : ( $mode eq 'packed' ) ? pack( 'S*', 1 .. 100 ) : $be;
+
+        is_deeply( $got, [ $expect, $expect, $long, $expect, $long ], "$mode: decode" );
+    }
+
+    my @warnings;
+    local $SIG{'__WARN__'} = sub { push @warnings, @_ };
+
+    is_deeply(
+        CBOR::Free::decode($cbor),
+        [ ( pack( 'S>*', 1 .. 100 ) ) x 2, $long, pack( 'S>*', 1 .. 100 ), $long ],
+        'decode() leaves the stringref namespace intact',
+    );
+
+    is( 0 + @warnings, 3, '… (with warnings about the tags)' );
+}
+
+sub T4_output {
+    my $data = [ map { CBOR::Free::TypedArray->new( 'float64be', pack 'd*', 1 .. $_ ) } 1, 10, 1000 ];
+
+    my $expect = CBOR::Free::encode($data);
+
+    for my $chunk_size ( 1, 5, 100, 100_000 ) {
+        my $cbor = q<>;
+
+        CBOR::Free::encode_to_cb( sub { $cbor .= $_[0] }, $data, chunk_size => $chunk_size );
+
+        ok( $cbor eq $expect, "encode_to_cb(), chunk size $chunk_size" );
+    }
+}
+
+sub T2_sequence_decoder {
+    my $seqdecoder = CBOR::Free::SequenceDecoder->new();
+    $seqdecoder->typed_arrays_as_arrays();
+
+    my $cbor = _tagged( 77, pack 's<*', -5 .. 5 );
+
+    is( $seqdecoder->give( substr( $cbor, 0, 9 ) ), undef, 'incomplete' );
+    is_deeply( ${ $seqdecoder->give( substr( $cbor, 9 ) ) }, [ -5 .. 5 ], 'complete' );
+}
+
+sub T5_class {
+    throws_ok(
+        sub { CBOR::Free::TypedArray->new( 'float8', q<> ) },
+        qr<float8>,
+        'unknown type',
+    );
+
+    throws_ok(
+        sub { CBOR::Free::TypedArray->new( 'uint32', 'abc' ) },
+        qr<multiple>,
+        'bad length',
+    );
+
+    my $obj = CBOR::Free::TypedArray->new( 'float32le', pack 'f*', 1, 2, 3 );
+
+    is( $obj->count(), 3, 'count()' );
+    is_deeply( [ $obj->values() ], [ 1, 2, 3 ], 'values()' );
+
+    throws_ok(
+        sub { CBOR::Free::TypedArray->new( 'float16', "\0\0" )->values() },
+        qr<float16>,
+        'values() of float16',
+    );
+}
+
+1;